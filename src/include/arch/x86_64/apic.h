@@ -135,6 +135,7 @@ uint64_t apic_timer_get_frequency(void);
 void     apic_timer_set_frequency(uint64_t freq_hz);
 
 bool apic_timer_tsc_deadline_supported(void);
+void apic_timer_init_tsc_deadline(uint32_t vector);
 void apic_timer_set_tsc_deadline(uint64_t deadline);
 
 void     apic_lvt_set_mask(uint32_t lvt_reg, bool mask);
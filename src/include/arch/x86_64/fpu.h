@@ -0,0 +1,45 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <core/scheduler.h>
+
+#include <klibc/types.h>
+
+#define XCR0_X87            (1ULL << 0)
+#define XCR0_SSE            (1ULL << 1)
+#define XCR0_AVX            (1ULL << 2)
+#define XCR0_OPMASK         (1ULL << 5)
+#define XCR0_ZMM_HI256      (1ULL << 6)
+#define XCR0_HI16_ZMM       (1ULL << 7)
+
+/* User state components we manage; AMX needs XFD and per-task permission */
+#define XCR0_SUPPORTED      (XCR0_X87 | XCR0_SSE | XCR0_AVX | \
+                             XCR0_OPMASK | XCR0_ZMM_HI256 | XCR0_HI16_ZMM)
+
+#define FPU_MODE_FXSR       0
+#define FPU_MODE_XSAVE      1
+#define FPU_MODE_XSAVEOPT   2
+#define FPU_MODE_XSAVES     3
+
+/*
+ * Task FPU/SIMD state is switched lazily: every switch sets CR0.TS, and
+ * the first FPU instruction afterwards traps (#NM) to load the task's
+ * state. A task's area is only allocated on its first trap, and only
+ * saved when it switches out after using the FPU in that slice.
+ */
+
+void fpu_enable(void);          /* CR0/CR4 basics, fpu.s */
+
+void fpu_init(void);            /* BSP, once the heap is up */
+void fpu_ap_init(void);
+
+void fpu_switch(tcb_t *prev, tcb_t *next);
+void fpu_handle_nm(void);
+
+/* Copy the current task's state to a new task (fork) */
+int fpu_copy_current(tcb_t *child);
+
+/* The current task is exiting; drop its state */
+void fpu_release_current(void);
+
+#endif
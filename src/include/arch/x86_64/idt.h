@@ -110,6 +110,8 @@ extern void irq9(void);  extern void irq10(void); extern void irq11(void);
 extern void irq12(void); extern void irq13(void); extern void irq14(void);
 extern void irq15(void);
 
+extern void isr240(void); extern void isr241(void);
+
 extern void idt_flush(uint64_t idt_ptr);
 
 #endif
\ No newline at end of file
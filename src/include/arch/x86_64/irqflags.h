@@ -0,0 +1,17 @@
+#ifndef IRQFLAGS_H
+#define IRQFLAGS_H
+
+#include <klibc/types.h>
+
+/* Disable interrupts, returning RFLAGS so irq_restore() can put IF back */
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    __asm__ volatile("push %0; popfq" :: "r"(flags) : "memory", "cc");
+}
+
+#endif
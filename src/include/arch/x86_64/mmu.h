@@ -48,6 +48,7 @@ void        mmu_load_cr3(phys_addr_t pml4_phys);
 phys_addr_t mmu_get_cr3(void);
 void        mmu_invlpg(virt_addr_t vaddr);
 void        mmu_flush_tlb(void);
+void        mmu_flush_tlb_global(void);
 
 static inline phys_addr_t pte_get_addr(pte_t pte) {
     return pte & MMU_ADDR_MASK;
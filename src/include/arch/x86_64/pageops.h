@@ -0,0 +1,25 @@
+#ifndef PAGEOPS_H
+#define PAGEOPS_H
+
+#include <klibc/types.h>
+
+#define PAGEOPS_MODE_REP        0   /* rep stosb / rep movsb, fast with ERMS */
+#define PAGEOPS_MODE_MOVNTI     1   /* Non-temporal integer stores, bypass the cache */
+
+#define PAGEOPS_BENCH_PAGES     256 /* 1 MB per buffer for the boot benchmark */
+
+/* Picks a variant from CPUID and times both; needs the PMM and the TSC */
+void pageops_init(void);
+
+/* Whole, page-aligned destination pages; usable before pageops_init() */
+void clear_page(void *page);
+void clear_pages(void *page, size_t count);
+void copy_page(void *dst, const void *src);
+void copy_pages(void *dst, const void *src, size_t count);
+
+/* Always non-temporal, for pages nobody is about to touch */
+void clear_page_nt(void *page);
+
+int pageops_get_mode(void);
+
+#endif
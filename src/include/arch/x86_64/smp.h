@@ -3,9 +3,12 @@
 
 #include <arch/x86_64/gdt.h>
 
+#include <core/scheduler.h>
+
 #include <klibc/types.h>
 
 #include <stdbool.h>
+#include <stddef.h>
 
 #define SMP_MAX_CPUS        64          /* hard ceiling on logical CPUs     */
 #define SMP_AP_STACK_SIZE   (16 * 1024) /* per-AP kernel stack (16 KiB)    */
@@ -16,7 +19,25 @@
 #define SMP_IPI_HALT        0xF2   /* ask a remote CPU to stop (debug/panic)*/
 #define SMP_IPI_PANIC       0xF3   /* broadcast: kernel panic on all CPUs   */
 
+#define IA32_GS_BASE        0xC0000101
+#define IA32_KERNEL_GS_BASE 0xC0000102
+
+_Static_assert(SMP_MAX_CPUS <= CPUMASK_BITS, "cpumask_t cannot hold SMP_MAX_CPUS");
+
+/*
+ * While in the kernel, GS base holds this CPU's cpu_info_t and
+ * KERNEL_GS_BASE the user's; every entry from ring 3 does swapgs.
+ * The first three fields are used from assembly at fixed offsets.
+ */
+#define CPU_INFO_SELF           0
+#define CPU_INFO_SYSCALL_RSP    8
+#define CPU_INFO_USER_RSP       16
+
 typedef struct cpu_info {
+    struct cpu_info *self;      /* gs:0, so this CPU is one load away       */
+    uint64_t    syscall_rsp;    /* kernel stack top for syscall_entry       */
+    uint64_t    syscall_user_rsp; /* scratch while syscall_entry swaps stacks */
+
     uint32_t    cpu_id;         /* logical index: 0 = BSP, 1..N = APs      */
     uint32_t    lapic_id;       /* hardware local APIC ID                   */
     bool        is_bsp;         /* true only for the Bootstrap Processor    */
@@ -37,18 +58,48 @@ typedef struct cpu_info {
 
     uint64_t apic_timer_hz;     /* APIC bus frequency used for this CPU     */
 
-    void    *current_thread;    /* points to running tcb_t, NULL if idle    */
+    volatile phys_addr_t active_pml4; /* CR3 loaded here, for TLB shootdown */
+
+    tcb_t   *current_thread;    /* running tcb_t, NULL until scheduling     */
+
+    sched_rq_t rq;              /* this CPU's run queues and idle task      */
 
 } __attribute__((aligned(64))) cpu_info_t;
 
+_Static_assert(offsetof(cpu_info_t, self) == CPU_INFO_SELF, "syscall.s uses CPU_INFO_SELF");
+_Static_assert(offsetof(cpu_info_t, syscall_rsp) == CPU_INFO_SYSCALL_RSP,
+               "syscall.s uses CPU_INFO_SYSCALL_RSP");
+_Static_assert(offsetof(cpu_info_t, syscall_user_rsp) == CPU_INFO_USER_RSP,
+               "syscall.s uses CPU_INFO_USER_RSP");
+
+/* Fields of the running CPU's cpu_info_t, one gs-relative access each */
+#define this_cpu_read(field) ({                                         \
+    __typeof__(((cpu_info_t *)0)->field) __val;                         \
+    __asm__ volatile("mov %%gs:%c1, %0"                                 \
+                     : "=r"(__val) : "i"(offsetof(cpu_info_t, field))); \
+    __val; })
+
+#define this_cpu_write(field, value) do {                               \
+    __typeof__(((cpu_info_t *)0)->field) __val = (value);               \
+    __asm__ volatile("mov %1, %%gs:%c0"                                 \
+                     :: "i"(offsetof(cpu_info_t, field)), "r"(__val)    \
+                     : "memory");                                       \
+} while (0)
+
 extern cpu_info_t       *g_cpus[SMP_MAX_CPUS];
 extern volatile uint32_t g_cpu_count;    /* total CPUs enumerated (incl. BSP) */
 extern volatile uint32_t g_cpus_online;  /* CPUs that have completed init     */
 
 void smp_init(void);
 
+void smp_early_init(void);
+
 cpu_info_t *smp_get_cpu(uint32_t cpu_id);
-cpu_info_t *smp_get_current_cpu(void);
+
+/* NULL until smp_init() has set up this CPU */
+static inline cpu_info_t *smp_get_current_cpu(void) {
+    return this_cpu_read(self);
+}
 
 uint32_t smp_get_cpu_count(void);
 uint32_t smp_get_bsp_lapic_id(void);
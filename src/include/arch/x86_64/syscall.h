@@ -27,10 +27,15 @@
 #define SYS_UNLINK          87
 #define SYS_GETTIMEOFDAY    96
 #define SYS_GETPPID         110
+#define SYS_FUTEX           202
+#define SYS_SCHED_SETAFFINITY 203
+#define SYS_SCHED_GETAFFINITY 204
 #define SYS_GETDENTS64      217
 #define SYS_CLOCK_GETTIME   228
 #define SYS_EXIT_GROUP      231
 #define SYS_OPENAT          257
+#define SYS_SCHED_SETATTR   314
+#define SYS_SCHED_GETATTR   315
 
 #define MMAP_PROT_NONE      0
 #define MMAP_PROT_READ      (1 << 0)
@@ -56,6 +61,23 @@
 #define CLOCK_MONOTONIC_COARSE  6
 #define CLOCK_BOOTTIME          7
 
+#define SCHED_NORMAL            0
+#define SCHED_FIFO              1
+#define SCHED_RR                2
+#define SCHED_DEADLINE          6
+
+#define SCHED_ATTR_SIZE_VER0    48
+
+#define FUTEX_WAIT              0
+#define FUTEX_WAKE              1
+#define FUTEX_REQUEUE           3
+#define FUTEX_CMP_REQUEUE       4
+#define FUTEX_WAIT_BITSET       9
+#define FUTEX_WAKE_BITSET       10
+#define FUTEX_PRIVATE_FLAG      128
+#define FUTEX_CLOCK_REALTIME    256
+#define FUTEX_CMD_MASK          (~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME))
+
 #define IA32_EFER       0xC0000080
 #define IA32_STAR       0xC0000081
 #define IA32_LSTAR      0xC0000082
@@ -65,9 +87,8 @@
 
 #define AT_FDCWD            (-100)
 
-extern uint64_t syscall_kernel_rsp;
-
 void     syscall_init(void);
+void     syscall_cpu_init(void);
 void     stdin_init(void);
 
 uint64_t syscall_dispatch(uint64_t num,
@@ -50,6 +50,17 @@ typedef struct {
     int64_t tv_usec;
 } __attribute__((packed)) linux_timeval_t;
 
+typedef struct {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t  sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+} __attribute__((packed)) linux_sched_attr_t;
+
 int validate_user_buf(const void *ptr, size_t len);
 int validate_user_str(const char *ptr, size_t *out_len);
 
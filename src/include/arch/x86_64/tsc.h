@@ -41,7 +41,7 @@ static inline uint64_t rdtsc_serialized(void) {
 }
 
 static inline uint64_t rdtsc_full_fence(void) {
-    uint32_t eax, ebx, ecx, edx;
+    uint32_t eax, edx;
     __asm__ volatile(
         "cpuid\n\t"
         "rdtsc\n\t"
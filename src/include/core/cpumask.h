@@ -0,0 +1,51 @@
+#ifndef _CPUMASK_H
+#define _CPUMASK_H
+
+#include <klibc/types.h>
+
+/* Must cover SMP_MAX_CPUS; smp.h can't be included here (it needs scheduler.h) */
+#define CPUMASK_BITS        64
+#define CPUMASK_WORDS       ((CPUMASK_BITS + 63) / 64)
+
+typedef struct cpumask {
+    uint64_t bits[CPUMASK_WORDS];
+} cpumask_t;
+
+static inline void cpumask_clear(cpumask_t *mask) {
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+        mask->bits[i] = 0;
+}
+
+static inline void cpumask_setall(cpumask_t *mask) {
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+        mask->bits[i] = ~0ULL;
+}
+
+static inline void cpumask_set(cpumask_t *mask, uint32_t cpu) {
+    if (cpu < CPUMASK_BITS)
+        mask->bits[cpu >> 6] |= 1ULL << (cpu & 63);
+}
+
+static inline void cpumask_unset(cpumask_t *mask, uint32_t cpu) {
+    if (cpu < CPUMASK_BITS)
+        mask->bits[cpu >> 6] &= ~(1ULL << (cpu & 63));
+}
+
+static inline bool cpumask_test(const cpumask_t *mask, uint32_t cpu) {
+    return cpu < CPUMASK_BITS && (mask->bits[cpu >> 6] & (1ULL << (cpu & 63)));
+}
+
+static inline void cpumask_and(cpumask_t *dst, const cpumask_t *a, const cpumask_t *b) {
+    for (int i = 0; i < CPUMASK_WORDS; i++)
+        dst->bits[i] = a->bits[i] & b->bits[i];
+}
+
+static inline bool cpumask_empty(const cpumask_t *mask) {
+    for (int i = 0; i < CPUMASK_WORDS; i++) {
+        if (mask->bits[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+#include <klibc/types.h>
+
+#define FUTEX_HASH_BITS         8
+#define FUTEX_HASH_SIZE         (1 << FUTEX_HASH_BITS)
+
+#define FUTEX_BITSET_MATCH_ANY  0xFFFFFFFFu
+
+#define FUTEX_FLAG_SHARED       (1 << 0)    /* Key by physical address, not by address space */
+
+/*
+ * Sleep until woken on uaddr, provided it still holds val. timeout_ns is
+ * relative, 0 waits forever. Returns 0, -EAGAIN, -ETIMEDOUT or -EINTR.
+ */
+int futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns,
+               uint32_t bitset, int flags);
+
+/* Wake up to nr waiters whose bitset overlaps bitset; returns the count */
+int futex_wake(uint32_t *uaddr, int nr, uint32_t bitset, int flags);
+
+/*
+ * Wake nr_wake waiters on uaddr and move up to nr_requeue of the rest
+ * onto uaddr2. With cmp set, fails with -EAGAIN unless *uaddr == cmpval.
+ * Returns the number of waiters woken or moved.
+ */
+int futex_requeue(uint32_t *uaddr, uint32_t *uaddr2, int nr_wake, int nr_requeue,
+                  bool cmp, uint32_t cmpval, int flags);
+
+#endif
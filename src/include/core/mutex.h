@@ -5,17 +5,25 @@
 
 struct tcb;
 
+/* Longest a waiter spins on a running owner before going to sleep */
+#define MUTEX_SPIN_BUDGET_NS    20000ULL
+
 typedef struct {
     volatile uint64_t entries;      /* Ticket counter for entering threads */
     volatile uint64_t exits;        /* Counter for threads that have exited */
     volatile uint32_t queue_lock;   /* Spinlock protecting wait_queue */
+    bool spin;                      /* Spin while the owner runs instead of sleeping */
     struct tcb *wait_queue;         /* Queue of sleeping waiters (TCBs linked via wait_data) */
     struct tcb *owner;              /* Current owner (for debugging/deadlock detection) */
+    uint64_t spin_acquires;         /* Contended acquisitions won by spinning */
+    uint64_t sleep_acquires;        /* Contended acquisitions that had to sleep */
 } __attribute__((aligned(64))) mutex_t;
 
-#define MUTEX_INIT { .entries = 0, .exits = 0, .queue_lock = 0, .wait_queue = NULL, .owner = NULL }
+#define MUTEX_INIT { .entries = 0, .exits = 0, .queue_lock = 0, .spin = true, \
+                     .wait_queue = NULL, .owner = NULL, .spin_acquires = 0, .sleep_acquires = 0 }
 
 void mutex_init(mutex_t *mutex);
+void mutex_set_spin(mutex_t *mutex, bool spin);
 
 void mutex_lock(mutex_t *mutex);
 bool mutex_try_lock(mutex_t *mutex);
@@ -25,4 +33,7 @@ bool mutex_is_locked(mutex_t *mutex);
 /* Get current mutex owner (for debugging) */
 struct tcb *mutex_get_owner(mutex_t *mutex);
 
+/* Contended lock/unlock throughput with and without spinning, printed */
+void mutex_benchmark(void);
+
 #endif
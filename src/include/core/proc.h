@@ -4,6 +4,7 @@
 #include <klibc/types.h>
 
 #include <core/scheduler.h>
+#include <core/rcu.h>
 
 #define PROC_STATE_NEW          0
 #define PROC_STATE_RUNNING      1
@@ -18,6 +19,10 @@
 #define PROC_CWD_LEN            256
 #define PROC_NSIG               32
 
+#define PROC_PID_MAX            32768   /* PIDs are 1..PROC_PID_MAX-1 */
+#define PROC_PID_HASH_BITS      10
+#define PROC_PID_HASH_SIZE      (1U << PROC_PID_HASH_BITS)
+
 #define PROC_USER_STACK_SIZE    (64 * 1024)     /* 64 KiB */
 
 #define PROC_SIG_NONE           0
@@ -128,7 +133,10 @@ typedef struct pcb {
     clock_t  cpu_time_ns;
 
     int      exit_code;
-    struct pcb *next;
+    struct pcb *next;           /* process_list link; RCU readers follow it unlocked */
+    struct pcb *zombie_next;
+    struct pcb *pid_next;       /* PID hash chain; RCU like next */
+    rcu_head_t  rcu;            /* Deferred free once unlinked */
 
     pid_t    pgid;
     pid_t    sid;
@@ -0,0 +1,48 @@
+#ifndef _RBTREE_H
+#define _RBTREE_H
+
+#include <klibc/types.h>
+
+#define RB_RED      0
+#define RB_BLACK    1
+
+/* Intrusive red-black tree node; embed it and recover the owner with container_of */
+typedef struct rb_node {
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    uint8_t color;
+} rb_node_t;
+
+/* Tree root with the smallest node cached for O(1) lookups */
+typedef struct rb_root {
+    rb_node_t *node;
+    rb_node_t *leftmost;
+} rb_root_t;
+
+#define RB_ROOT_INIT    { NULL, NULL }
+
+static inline bool rb_empty(const rb_root_t *root) {
+    return root->node == NULL;
+}
+
+static inline rb_node_t *rb_first(const rb_root_t *root) {
+    return root->leftmost;
+}
+
+/* Attach node below parent at *link; follow with rb_insert_color() */
+static inline void rb_link_node(rb_node_t *node, rb_node_t *parent, rb_node_t **link) {
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/* Rebalance after rb_link_node(); leftmost = node went down the left spine only */
+void rb_insert_color(rb_root_t *root, rb_node_t *node, bool leftmost);
+void rb_erase(rb_root_t *root, rb_node_t *node);
+
+rb_node_t *rb_next(const rb_node_t *node);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _RCU_H
+#define _RCU_H
+
+#include <core/scheduler.h>
+
+#include <klibc/types.h>
+
+/*
+ * Read-copy-update for read-mostly lists. A read-side section only
+ * postpones task switches, so a CPU that enters __schedule() cannot be
+ * inside one: that is its quiescent state. A grace period ends once
+ * every online CPU has passed through one, after which nothing can
+ * still hold a pointer unlinked before it started.
+ *
+ * Readers must not sleep. Writers still serialise among themselves and
+ * publish with rcu_assign_pointer().
+ */
+
+struct rcu_head;
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+typedef struct rcu_head {
+    struct rcu_head *next;
+    rcu_callback_t func;
+} rcu_head_t;
+
+static inline void rcu_read_lock(void) {
+    lock_scheduler();
+}
+
+static inline void rcu_read_unlock(void) {
+    unlock_scheduler();
+}
+
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_init(void);
+
+/* Called by the scheduler on every pass through __schedule() */
+void rcu_note_qs(uint32_t cpu_id);
+
+/* Sleeps until a grace period has elapsed; not from a read-side section */
+void synchronize_rcu(void);
+
+/* Runs func(head) from the rcu_gp thread after a grace period */
+void call_rcu(rcu_head_t *head, rcu_callback_t func);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef _RWLOCK_H
+#define _RWLOCK_H
+
+#include <klibc/types.h>
+
+#define RWLOCK_WRITER       (1U << 31)     /* Held for writing */
+#define RWLOCK_WAITING      (1U << 30)     /* A writer is waiting; new readers hold off */
+#define RWLOCK_READERS      (RWLOCK_WAITING - 1)
+
+/*
+ * Interrupt-safe reader-writer spinlock. Any number of readers, or one
+ * writer; a waiting writer blocks new readers so it can't be starved.
+ * Readers keep their saved RFLAGS themselves since there may be many.
+ */
+typedef struct {
+    volatile uint32_t state;
+    volatile uint64_t flags;        /* Saved RFLAGS of the writer */
+} __attribute__((aligned(8))) rwlock_t;
+
+#define RWLOCK_INIT { .state = 0, .flags = 0 }
+
+void rwlock_init(rwlock_t *lock);
+
+uint64_t rwlock_read_acquire(rwlock_t *lock);
+void rwlock_read_release(rwlock_t *lock, uint64_t flags);
+
+void rwlock_write_acquire(rwlock_t *lock);
+void rwlock_write_release(rwlock_t *lock);
+
+#endif
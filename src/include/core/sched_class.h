@@ -0,0 +1,73 @@
+#ifndef _SCHED_CLASS_H
+#define _SCHED_CLASS_H
+
+#include <core/scheduler.h>
+
+#define ENQUEUE_WAKEUP      (1 << 0)    /* Coming back from sleep or a wait */
+#define ENQUEUE_NEW         (1 << 1)    /* First enqueue, or a policy change */
+#define ENQUEUE_MIGRATED    (1 << 2)    /* Pulled over from another CPU */
+#define ENQUEUE_PREEMPTED   (1 << 3)    /* Lost the CPU without yielding */
+
+/*
+ * Scheduling class operations. Every hook runs with rq->lock held; the
+ * core keeps rq->nr_running, task->on_rq and task->state in sync.
+ */
+typedef struct sched_class {
+    const char *name;
+
+    /* Running tasks compete in the pick instead of rotating out */
+    bool strict;
+
+    void   (*enqueue)(sched_rq_t *rq, tcb_t *task, int flags);
+    void   (*dequeue)(sched_rq_t *rq, tcb_t *task, int flags);
+
+    /* Best queued task, left on the queue */
+    tcb_t *(*pick_next)(sched_rq_t *rq);
+
+    /* Walk queued tasks in pick order; NULL if the class never migrates */
+    tcb_t *(*first)(sched_rq_t *rq);
+    tcb_t *(*next)(sched_rq_t *rq, tcb_t *task);
+
+    /* Charge delta_ns of CPU time to the running task */
+    void   (*update_curr)(sched_rq_t *rq, tcb_t *curr, uint64_t delta_ns);
+    uint64_t (*time_slice)(sched_rq_t *rq, tcb_t *task);
+
+    /* Both tasks belong to this class */
+    bool   (*check_preempt)(tcb_t *curr, tcb_t *task);
+
+    /* Periodic housekeeping, optional; true if the CPU should reschedule */
+    bool   (*tick)(sched_rq_t *rq, uint64_t now);
+
+    /* Earliest time tick() has work, UINT64_MAX if none; optional */
+    uint64_t (*next_event)(sched_rq_t *rq);
+
+    /* Unqueued task moves off rq, rebase per-CPU state; optional */
+    void   (*migrate)(sched_rq_t *rq, tcb_t *task);
+
+    /* Task leaves the class through a policy change or exit; optional */
+    void   (*detach)(sched_rq_t *rq, tcb_t *task);
+
+    void   (*dump)(sched_rq_t *rq);
+} sched_class_t;
+
+extern const sched_class_t dl_sched_class;
+extern const sched_class_t rt_sched_class;
+extern const sched_class_t prio_sched_class;
+extern const sched_class_t fair_sched_class;
+
+uint32_t sched_prio_to_weight(uint8_t priority);
+
+/* Reserve attr's bandwidth on rq for task; returns 0 or -EBUSY */
+int sched_dl_admit(sched_rq_t *rq, tcb_t *task, const sched_attr_t *attr);
+
+static inline const sched_class_t *sched_class_of(const tcb_t *task) {
+    switch (task->policy) {
+        case SCHED_POLICY_DEADLINE: return &dl_sched_class;
+        case SCHED_POLICY_FIFO:
+        case SCHED_POLICY_RR:       return &rt_sched_class;
+        case SCHED_POLICY_PRIO:     return &prio_sched_class;
+        default:                    return &fair_sched_class;
+    }
+}
+
+#endif
@@ -1,6 +1,11 @@
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include <core/spinlock.h>
+#include <core/timer_wheel.h>
+#include <core/rbtree.h>
+#include <core/cpumask.h>
+
 #include <klibc/types.h>
 
 struct pcb;
@@ -16,8 +21,13 @@ struct pcb;
 
 #define KERNEL_STACK_SIZE           (16 * 1024)
 
+#define FPU_CPU_NONE                0xFFFFFFFFu
+
 #define TIME_SLICE_LENGTH_NS        10000000ULL
 
+#define SCHED_TICK_NS               10000000ULL  /* Longest timer gap on a busy CPU */
+#define SCHED_TIMER_MIN_NS          20000ULL     /* Closest a one-shot event is armed */
+
 #define NUM_PRIORITY_QUEUES         8
 #define PRIORITY_IDLE               0
 #define PRIORITY_LOW                32
@@ -25,9 +35,48 @@ struct pcb;
 #define PRIORITY_HIGH               192
 #define PRIORITY_REALTIME           224
 
-#define AGING_THRESHOLD_TICKS       50   /* ~500ms at 100Hz */
+#define AGING_INTERVAL_NS           100000000ULL
+#define AGING_THRESHOLD_TICKS       50   /* In aging passes */
 #define AGING_BOOST_AMOUNT          16
 
+#define SCHED_POLICY_FAIR           0  /* Weighted virtual runtime */
+#define SCHED_POLICY_PRIO           1  /* Priority buckets with aging */
+#define SCHED_POLICY_FIFO           2  /* Real-time, runs until it blocks or yields */
+#define SCHED_POLICY_RR             3  /* Real-time, round robin within a level */
+#define SCHED_POLICY_DEADLINE       4  /* EDF with a runtime/period reservation */
+#define SCHED_POLICY_MAX            4
+
+#ifndef SCHED_POLICY_DEFAULT
+#define SCHED_POLICY_DEFAULT        SCHED_POLICY_FAIR
+#endif
+
+#define SCHED_LATENCY_NS            12000000ULL  /* Every fair task runs once per period */
+#define SCHED_MIN_GRANULARITY_NS    1500000ULL   /* Shortest fair slice */
+#define SCHED_WAKEUP_GRAN_NS        1000000ULL   /* vruntime lead needed to preempt */
+#define SCHED_NICE_0_WEIGHT         1024
+
+#define SCHED_RT_PRIO_MIN           1
+#define SCHED_RT_PRIO_MAX           99
+#define SCHED_RT_PRIO_LEVELS        (SCHED_RT_PRIO_MAX + 1)
+#define SCHED_RR_TIMESLICE_NS       100000000ULL
+
+#define SCHED_DL_RUNTIME_MIN_NS     100000ULL      /* Below this timer slop dominates */
+#define SCHED_DL_PERIOD_MAX_NS      4000000000ULL  /* Keeps the CBS products in 64 bits */
+#define SCHED_DL_BW_SHIFT           20
+#define SCHED_DL_BW_UNIT            (1ULL << SCHED_DL_BW_SHIFT)
+#define SCHED_DL_BW_LIMIT           (SCHED_DL_BW_UNIT * 95 / 100)  /* Admissible per CPU */
+
+#define BALANCE_INTERVAL_NS         100000000ULL
+#define MIGRATION_COST_NS           500000ULL  /* ran this recently = cache-hot */
+
+#define SCHED_NR_CLASSES            4
+
+#define SCHED_LAT_WAKEUP            0   /* Woken or started, until it first runs */
+#define SCHED_LAT_RUNQ              1   /* Preempted or requeued, until it runs again */
+#define SCHED_LAT_KINDS             2
+#define SCHED_LAT_BUCKETS           24  /* Bucket 0 < 1us, bucket k < 2^k us */
+#define SCHED_LAT_UNIT_SHIFT        10  /* ns to (roughly) us */
+
 typedef struct tcb {
     /* Saved context (must be first for assembly access) */
     uint64_t rsp;                   /* Saved stack pointer */
@@ -39,15 +88,36 @@ typedef struct tcb {
     uint64_t kernel_stack_size;     /* Size of kernel stack */
     uint64_t cr3;                   /* Page table base (for future user-space) */
 
+    void *fpu_state;                /* XSAVE area, allocated on first FPU use */
+    uint32_t fpu_cpu;               /* CPU that last loaded it, or FPU_CPU_NONE */
+
     uint8_t state;                  /* Current task state */
     uint8_t priority;               /* Task priority (0-255) */
     uint8_t base_priority;          /* Original priority (for aging reset) */
-    uint8_t _padding;
+    uint8_t on_rq;                  /* Linked into a ready queue */
+    uint8_t policy;                 /* SCHED_POLICY_* */
+    uint8_t rt_priority;            /* 1-99, FIFO and RR only */
+    uint8_t dl_throttled;           /* Budget used up, waiting for the next period */
+    uint32_t cpu;                   /* CPU whose run queue owns this task */
+    cpumask_t cpus_allowed;         /* CPUs this task may run on */
+    volatile uint8_t on_cpu;        /* Executing, or still switching out */
+    uint8_t exited;                 /* Left through terminate_task(), may be freed */
 
     struct tcb *next;               /* Next task in queue */
 
+    rb_node_t run_node;             /* Link in the fair class timeline */
+    uint64_t vruntime;              /* Weighted runtime, fair class only */
+    uint32_t weight;                /* Load weight derived from priority */
+
+    uint64_t dl_runtime_ns;         /* Reserved runtime per period */
+    uint64_t dl_deadline_ns;        /* Relative deadline */
+    uint64_t dl_period_ns;
+    int64_t  dl_budget_ns;          /* Runtime left in the current period */
+    uint64_t dl_abs_deadline_ns;    /* Current absolute deadline */
+
     uint64_t time_used_ns;          /* Total CPU time consumed (nanoseconds) */
     uint64_t sleep_expiry_ns;       /* Wake up time for sleeping tasks */
+    wheel_node_t sleep_node;        /* Link in the owning CPU's sleep wheel */
 
     uint64_t wait_ticks;            /* Ticks spent waiting (for aging) */
     uint64_t switch_count;          /* Number of times scheduled */
@@ -68,6 +138,9 @@ typedef struct tcb {
     uint64_t yield_count;           /* Times voluntarily yielded */
     uint64_t wakeup_count;          /* Times woken from sleep/wait */
 
+    uint64_t ready_tsc;             /* When it last became runnable, 0 once it runs */
+    uint8_t ready_kind;             /* SCHED_LAT_* the wait is recorded under */
+
 } tcb_t;
 
 typedef struct {
@@ -75,11 +148,91 @@ typedef struct {
     uint64_t total_ticks;           /* Total timer ticks */
     uint64_t idle_time_ns;          /* Time spent in idle */
     uint64_t aging_boosts;          /* Number of priority boosts */
+    uint64_t migrations_in;         /* Tasks pulled onto this CPU */
+    uint64_t migrations_out;        /* Tasks pulled away from this CPU */
+    uint64_t balance_runs;          /* Load balancing passes */
+    uint64_t resched_ipis;          /* Reschedule IPIs received */
+    uint64_t dl_throttles;          /* Deadline tasks that ran out of budget */
 } sched_stats_t;
 
+/* Log2 histograms of the time between becoming runnable and running */
+typedef struct {
+    uint32_t hist[SCHED_LAT_KINDS][SCHED_NR_CLASSES][SCHED_LAT_BUCKETS];
+} sched_latency_t;
+
+/* Priority bucket class state */
+typedef struct sched_prio_rq {
+    tcb_t *heads[NUM_PRIORITY_QUEUES];
+    tcb_t *tails[NUM_PRIORITY_QUEUES];
+    uint8_t bitmap;                 /* Bitmap: bit set = queue has tasks */
+    uint32_t nr_running;
+    uint64_t next_aging_ns;
+} sched_prio_rq_t;
+
+/* Fair class state: READY tasks ordered by vruntime */
+typedef struct sched_fair_rq {
+    rb_root_t timeline;
+    uint64_t min_vruntime;          /* Monotonic floor for placing tasks */
+    uint64_t load_weight;           /* Sum of queued weights */
+    uint32_t nr_running;
+} sched_fair_rq_t;
+
+/* Real-time class state: one FIFO list per rt_priority */
+typedef struct sched_rt_rq {
+    tcb_t *heads[SCHED_RT_PRIO_LEVELS];
+    tcb_t *tails[SCHED_RT_PRIO_LEVELS];
+    uint64_t bitmap[2];             /* Bit set = level has tasks */
+    uint32_t nr_running;
+} sched_rt_rq_t;
+
+/* Deadline class state: tasks with budget ordered by absolute deadline */
+typedef struct sched_dl_rq {
+    rb_root_t timeline;
+    tcb_t *throttled;               /* Out of budget, by replenish time */
+    uint64_t total_bw;              /* Admitted bandwidth, SCHED_DL_BW_UNIT = 1 CPU */
+    uint32_t nr_running;
+} sched_dl_rq_t;
+
+/* Per-CPU run queue, embedded in cpu_info_t */
+typedef struct sched_rq {
+    sched_dl_rq_t dl;
+    sched_rt_rq_t rt;
+    sched_prio_rq_t prio;
+    sched_fair_rq_t fair;
+    uint32_t nr_running;            /* READY tasks queued on this CPU */
+
+    tcb_t *idle;                    /* This CPU's idle task */
+    tcb_t *prev_task;               /* Task being switched out, see finish_task_switch */
+
+    uint64_t time_slice_remaining_ns;
+    uint64_t slice_clock_ns;        /* When time_slice_remaining_ns was last charged */
+    uint64_t clock_ns;              /* Last time accounting ran on this CPU */
+
+    bool tickless;                  /* One-shot TSC-deadline timer in use */
+    uint64_t next_balance_ns;
+
+    bool yield_pending;             /* schedule() comes from yield() */
+
+    int postpone_task_switches;     /* lock_scheduler() nesting depth */
+    int task_switch_postponed;      /* schedule() requested while locked */
+    volatile int resched_ipi_pending; /* Reschedule IPI sent, not yet handled */
+
+    spinlock_irq_t lock;            /* Protects the queues above */
+
+    timer_wheel_t sleepers;         /* Tasks sleeping on this CPU */
+    spinlock_irq_t sleep_lock;      /* Protects sleepers; taken before lock */
+
+    sched_stats_t stats;
+    sched_latency_t latency;
+} sched_rq_t;
+
 void scheduler_init(void);
 
 tcb_t *create_kernel_task(void (*entry_point)(void), const char *name, uint8_t priority);
+tcb_t *create_kernel_task_paused(void (*entry_point)(void), const char *name, uint8_t priority);
+void task_start(tcb_t *task);
+
+void scheduler_ap_start(void);
 
 void schedule(void);
 void yield(void);
@@ -87,6 +240,9 @@ void yield(void);
 void block_task(uint8_t reason);
 void unblock_task(tcb_t *task);
 
+/* Drop a wakeup that arrived after current had stopped waiting for it */
+void cancel_pending_wakeup(void);
+
 void nano_sleep(uint64_t nanoseconds);
 void nano_sleep_until(uint64_t wake_time_ns);
 void sleep_ms(uint64_t milliseconds);
@@ -94,11 +250,20 @@ void sleep_ms(uint64_t milliseconds);
 void terminate_task(void);
 void terminate_other_task(tcb_t *task);
 
+/* The owning process is gone; an exited task can now be freed */
+void task_release(tcb_t *task);
+
 void lock_scheduler(void);
 void unlock_scheduler(void);
 
 uint64_t get_time_since_boot_ns(void);
 void scheduler_timer_tick(void);
+void scheduler_timer_start(void);
+void scheduler_resched_ipi(void);
+void scheduler_kick_cpu(uint32_t cpu_id);
+
+/* Nothing besides current is waiting to run on this CPU */
+bool scheduler_cpu_idle(void);
 
 tcb_t *get_current_task(void);
 uint64_t get_current_tid(void);
@@ -106,9 +271,30 @@ void scheduler_dump_tasks(void);
 void scheduler_dump_stats(void);
 
 void scheduler_get_stats(sched_stats_t *stats);
+int scheduler_get_cpu_stats(uint32_t cpu_id, sched_stats_t *stats);
+
+int scheduler_get_cpu_latency(uint32_t cpu_id, sched_latency_t *latency);
+void scheduler_reset_latency(void);
+const char *scheduler_class_name(uint32_t class_idx);
+
+void finish_task_switch(void);
 
 void task_set_priority(tcb_t *task, uint8_t new_priority);
 
+typedef struct {
+    uint8_t policy;                 /* SCHED_POLICY_* */
+    uint8_t rt_priority;            /* FIFO and RR */
+    uint64_t runtime_ns;            /* DEADLINE */
+    uint64_t deadline_ns;
+    uint64_t period_ns;
+} sched_attr_t;
+
+int  task_set_sched_attr(tcb_t *task, const sched_attr_t *attr);
+void task_get_sched_attr(tcb_t *task, sched_attr_t *attr);
+
+int  task_set_affinity(tcb_t *task, const cpumask_t *mask);
+void task_get_affinity(tcb_t *task, cpumask_t *mask);
+
 extern void idle_task_entry(void);
 
 void task_set_owner_proc(tcb_t *task, struct pcb *proc);
@@ -127,12 +313,15 @@ typedef struct {
     char name[32];
     uint8_t state;
     uint8_t priority;
+    uint8_t policy;
     uint64_t time_used_ns;
     uint64_t switch_count;
     uint64_t preempt_count;
     uint64_t yield_count;
     uint64_t wakeup_count;
     pid_t    owner_pid;  /* PID of owning process */
+    uint32_t cpu;
+    cpumask_t cpus_allowed;
 } task_info_t;
 
 void task_get_info(tcb_t *task, task_info_t *info);
@@ -0,0 +1,52 @@
+#ifndef _SEQLOCK_H
+#define _SEQLOCK_H
+
+#include <klibc/types.h>
+
+#include <core/spinlock.h>
+
+/*
+ * Readers never write shared state: they sample the sequence, read, and
+ * retry if a writer was active (odd) or finished (changed) meanwhile.
+ * Writers serialise on an ordinary spinlock. Only for data that can be
+ * copied out and re-read safely, never for pointers that get freed.
+ */
+typedef struct {
+    volatile uint32_t seq;
+    spinlock_irq_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT_NAMED(n) { .seq = 0, .lock = SPINLOCK_IRQ_INIT_NAMED(n) }
+#define SEQLOCK_INIT SEQLOCK_INIT_NAMED(NULL)
+
+static inline void seqlock_init(seqlock_t *sl) {
+    sl->seq = 0;
+    spinlock_irq_init(&sl->lock);
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t *sl) {
+    uint32_t seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        __asm__ volatile("pause" ::: "memory");
+    return seq;
+}
+
+static inline bool read_seqretry(const seqlock_t *sl, uint32_t start) {
+    /* Orders the protected loads before the re-check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqlock(seqlock_t *sl) {
+    spinlock_irq_acquire(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_sequnlock(seqlock_t *sl) {
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+    spinlock_irq_release(&sl->lock);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef _TIMER_WHEEL_H
+#define _TIMER_WHEEL_H
+
+#include <klibc/types.h>
+
+#define WHEEL_LEVELS        4
+#define WHEEL_SLOT_BITS     6
+#define WHEEL_SLOTS         (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK     (WHEEL_SLOTS - 1)
+
+#define WHEEL_GRAN_SHIFT    20          /* One jiffy = 2^20 ns (~1.05ms) */
+#define WHEEL_GRAN_NS       (1ULL << WHEEL_GRAN_SHIFT)
+
+/* Farthest a node can be placed; later deadlines are re-cascaded */
+#define WHEEL_MAX_DELTA     ((1ULL << (WHEEL_LEVELS * WHEEL_SLOT_BITS)) - 1)
+
+typedef struct wheel_node {
+    struct wheel_node *next;
+    struct wheel_node **pprev;      /* NULL when not queued */
+    uint64_t expires;               /* Jiffy the node fires at */
+    uint8_t level;
+    uint8_t slot;
+} wheel_node_t;
+
+/* Hierarchical timing wheel; callers provide the locking */
+typedef struct timer_wheel {
+    uint64_t clk;                   /* Next jiffy to be processed */
+    uint64_t bitmap[WHEEL_LEVELS];  /* Bit set = slot has nodes */
+    uint32_t count;                 /* Queued nodes */
+    wheel_node_t *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} timer_wheel_t;
+
+static inline bool wheel_node_pending(const wheel_node_t *node) {
+    return node->pprev != NULL;
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ns);
+void timer_wheel_add(timer_wheel_t *wheel, wheel_node_t *node, uint64_t expires_ns);
+void timer_wheel_del(timer_wheel_t *wheel, wheel_node_t *node);
+
+/* Unlinks every node due at now_ns and returns them chained through next */
+wheel_node_t *timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ns);
+
+/* Earliest time timer_wheel_expire has work to do, UINT64_MAX when empty */
+uint64_t timer_wheel_next_expiry(const timer_wheel_t *wheel);
+
+#endif
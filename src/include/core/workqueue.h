@@ -0,0 +1,49 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include <core/timer_wheel.h>
+
+#include <klibc/types.h>
+
+struct work;
+
+typedef void (*work_func_t)(struct work *work);
+
+/*
+ * Deferred work, run by a per-CPU kernel worker with interrupts enabled.
+ * An item is queued at most once; it can be queued again as soon as its
+ * function starts running. Items queued from more than one CPU are not
+ * serialised against themselves, so such callers bring their own lock.
+ */
+typedef struct work {
+    struct work *next;
+    work_func_t func;
+    volatile uint32_t pending;      /* Queued or waiting on its timer */
+} work_t;
+
+typedef struct delayed_work {
+    work_t work;
+    wheel_node_t timer;             /* Link in the worker's timer wheel */
+    uint32_t cpu;                   /* Worker the timer is armed on */
+} delayed_work_t;
+
+#define WORK_INIT(_func)    { .next = NULL, .func = (_func), .pending = 0 }
+
+#define DELAYED_WORK_INIT(_func) \
+    { .work = WORK_INIT(_func), .timer = { 0 }, .cpu = 0 }
+
+void workqueue_init(void);
+
+void work_init(work_t *work, work_func_t func);
+void delayed_work_init(delayed_work_t *dwork, work_func_t func);
+
+/* Safe from interrupt handlers; false if already pending or no worker yet */
+bool queue_work(work_t *work);
+bool queue_work_on(uint32_t cpu, work_t *work);
+
+bool queue_delayed_work(delayed_work_t *dwork, uint64_t delay_ns);
+
+/* Stops a timer that has not fired yet; true if it was cancelled */
+bool cancel_delayed_work(delayed_work_t *dwork);
+
+#endif
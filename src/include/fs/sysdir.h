@@ -44,5 +44,7 @@ int sysdev_register_cpu(void);   /* /sys/devices/cpu0           */
 int sysdev_register_pci(void);   /* /sys/bus/pci/devices/<dev>  */
 int sysdev_register_fs(void);   /* /sys/fs/tmpfs/ */
 int sysdev_register_class(void);   /* /sys/class/block/<dev> */
+int sysdev_register_sched(void);   /* /sys/kernel/sched/ */
+int sysdev_register_locks(void);   /* /sys/kernel/locks/ */
 
 #endif
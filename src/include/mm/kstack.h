@@ -0,0 +1,26 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <klibc/types.h>
+
+/*
+ * Kernel stacks are KERNEL_STACK_SIZE bytes of mapped memory with one
+ * unmapped guard page below, so running off the bottom faults. Freed
+ * stacks are kept in a small per-CPU cache and handed out again as is.
+ */
+
+#define KSTACK_CACHE_SIZE   8       /* Free stacks kept per CPU */
+
+typedef struct kstack_stats {
+    uint64_t cache_hits;            /* Allocations served from a CPU cache */
+    uint64_t cache_misses;          /* Allocations that had to map a stack */
+    uint64_t mapped;                /* Stacks currently mapped, cached or not */
+} kstack_stats_t;
+
+/* Returns the lowest usable address, or NULL */
+void *kstack_alloc(void);
+void kstack_free(void *stack);
+
+void kstack_get_stats(kstack_stats_t *stats);
+
+#endif
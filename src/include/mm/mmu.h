@@ -33,6 +33,9 @@ typedef struct {
     uint64_t single_flushes;    /* invlpg count */
     uint64_t full_flushes;      /* full TLB flush count */
     uint64_t context_switches;  /* CR3 changes */
+    uint64_t shootdowns;        /* Flushes that had to reach other CPUs */
+    uint64_t shootdown_ipis;    /* TLB flush IPIs sent */
+    uint64_t batched_ranges;    /* Ranges carried by those shootdowns */
 } mmu_tlb_stats_t;
 
 typedef struct {
@@ -42,10 +45,33 @@ typedef struct {
     uint64_t pages_unmapped;    /* Total pages unmapped */
     uint64_t tables_allocated;  /* Page tables allocated */
     uint64_t cow_breaks;        /* COW page breaks */
+    uint64_t cow_reuses;        /* COW breaks that kept the last sharer's frame */
     uint64_t page_faults;       /* Page faults handled */
     mmu_tlb_stats_t tlb_stats;  /* TLB statistics */
 } mmu_stats_t;
 
+#ifndef MMU_TLB_BATCH_RANGES
+#define MMU_TLB_BATCH_RANGES      8   /* Ranges carried by one shootdown IPI */
+#endif
+
+#ifndef MMU_TLB_FULL_FLUSH_PAGES
+#define MMU_TLB_FULL_FLUSH_PAGES  32  /* Above this, flush the whole TLB */
+#endif
+
+typedef struct {
+    virt_addr_t virt_start;
+    size_t      pages;
+} mmu_tlb_range_t;
+
+/* Invalidations collected while editing PTEs, sent as one shootdown */
+typedef struct {
+    mmu_context_t  *ctx;        /* NULL = the address space loaded here */
+    uint32_t        nr_ranges;
+    bool            full;       /* Too many pages/ranges: flush everything */
+    size_t          nr_pages;
+    mmu_tlb_range_t ranges[MMU_TLB_BATCH_RANGES];
+} mmu_tlb_batch_t;
+
 typedef struct {
     virt_addr_t fault_addr;     /* Faulting address (CR2) */
     uint64_t    error_code;     /* Page fault error code */
@@ -104,6 +130,16 @@ void mmu_flush_tlb_range(virt_addr_t virt_start, size_t size);
 void mmu_flush_tlb_all(void);
 void mmu_flush_tlb_context(mmu_context_t *ctx);
 
+void mmu_tlb_batch_init(mmu_tlb_batch_t *batch, mmu_context_t *ctx);
+void mmu_tlb_batch_add(mmu_tlb_batch_t *batch, virt_addr_t virt_addr, size_t size);
+void mmu_tlb_batch_flush(mmu_tlb_batch_t *batch);
+void mmu_tlb_shootdown_ipi(void);
+
+/* Ack our part of a pending shootdown; for spin loops with interrupts off */
+void mmu_tlb_shootdown_poll(void);
+
+void mmu_activate_pml4(phys_addr_t pml4_phys);
+
 int mmu_map_range_auto(mmu_context_t *ctx, virt_addr_t virt_start, phys_addr_t phys_start,
                        size_t size, uint64_t flags);
 
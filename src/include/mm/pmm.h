@@ -11,6 +11,8 @@
 #define PMM_ZONE_NORMAL   2   /* >= 4GB normal memory */
 #define PMM_ZONE_COUNT    3
 
+#define PMM_MAX_ORDER     10            /* Largest buddy block is 2^10 pages (4 MB) */
+
 #define PMM_DMA_LIMIT     0x1000000     /* 16 MB */
 #define PMM_DMA32_LIMIT   0x100000000ULL /* 4 GB */
 
@@ -28,13 +30,51 @@ typedef struct pmm_zone_stats {
     uint64_t alloc_count;      /* Total allocations */
     uint64_t free_count;       /* Total frees */
     uint64_t alloc_failed;     /* Failed allocations */
+    uint64_t pcp_hits;         /* Single pages served by a per-CPU list */
+    uint64_t pcp_misses;       /* Single pages that needed a refill first */
+    uint64_t pcp_drains;       /* Batches handed back to the zone */
+    uint64_t zero_hits;        /* Single pages that came already zeroed */
+    uint64_t zero_filled;      /* Pages zeroed in the background */
 } pmm_zone_stats_t;
 
+/* One per page frame below the highest usable address, indexed by PFN */
+typedef struct page {
+    uint32_t refcount;          /* Holders of the frame; freed with the last one */
+    uint32_t mapcount;          /* User PTEs that point at it */
+    uint16_t flags;             /* PAGE_FLAG_* */
+    uint8_t zone;               /* PMM_ZONE_* */
+    uint8_t order;              /* Block order while PAGE_FLAG_BUDDY is set */
+} page_t;
+
+#define PAGE_FLAG_RESERVED  (1 << 0)    /* Not managed: firmware, holes, the page array */
+#define PAGE_FLAG_BUDDY     (1 << 1)    /* First page of a free buddy block */
+
+#define PMM_PCP_BATCH     32    /* Pages moved per refill or drain */
+#define PMM_PCP_HIGH      (PMM_PCP_BATCH * 3)   /* Drain above this many */
+
+#define PMM_ZERO_HIGH     256   /* Pre-zeroed pages kept per CPU and zone */
+#define PMM_ZERO_LOW      128   /* kzerod stays asleep until a pool drops below this */
+
 void pmm_init(void);
+void pmm_zero_init(void);      /* Needs the scheduler */
+void pmm_zero_idle(void);      /* From the idle loop: wake kzerod if a pool ran low */
+
+/* Single pages always come back zeroed */
 
 phys_addr_t pmm_alloc_page(void);
 phys_addr_t pmm_alloc_page_zone(int zone);
-void        pmm_free_page(phys_addr_t phys_addr);
+void        pmm_free_page(phys_addr_t phys_addr);     /* Drops one reference */
+
+/* NULL for frames the allocator doesn't manage */
+page_t     *pmm_phys_to_page(phys_addr_t phys_addr);
+phys_addr_t pmm_page_to_phys(const page_t *page);
+
+void     pmm_get_page(phys_addr_t phys_addr);
+uint32_t pmm_page_refcount(phys_addr_t phys_addr);
+
+void     pmm_page_add_map(phys_addr_t phys_addr);
+void     pmm_page_remove_map(phys_addr_t phys_addr);
+uint32_t pmm_page_mapcount(phys_addr_t phys_addr);
 
 void pmm_print_stats(void);
 void pmm_print_zones(void);
@@ -50,6 +90,9 @@ bool pmm_is_low_memory(int zone);
 
 void pmm_get_stats(int zone, pmm_zone_stats_t *stats);
 
+/* Give every CPU's cached pages in the zone back before returning */
+void pmm_drain_pcp(int zone);
+
 void pmm_reserve_region(phys_addr_t base, uint64_t length);
 
 uint64_t pmm_get_total_pages(void);
@@ -188,6 +188,18 @@ void apic_timer_set_tsc_deadline(uint64_t deadline) {
     wrmsr(0x6E0, deadline);
 }
 
+void apic_timer_init_tsc_deadline(uint32_t vector) {
+    if (!tsc_deadline_available)
+        return;
+
+    apic_write(LAPIC_TIMER, (vector & LAPIC_LVT_VECTOR_MASK) | LAPIC_LVT_TIMER_TSCDEADLINE);
+
+    /* The mode switch must land before the first deadline write (SDM 10.5.4.1) */
+    __asm__ volatile("mfence" ::: "memory");
+
+    wrmsr(0x6E0, 0);    /* Disarmed until the scheduler programs an event */
+}
+
 void apic_timer_init(uint32_t vector, uint32_t divisor, uint32_t initial_count, bool periodic) {
     /* Set timer divisor */
     apic_write(LAPIC_TIMER_DIV, divisor);
@@ -0,0 +1,273 @@
+#include <arch/x86_64/cpuid.h>
+#include <arch/x86_64/fpu.h>
+#include <arch/x86_64/irqflags.h>
+#include <arch/x86_64/smp.h>
+
+#include <mm/heap.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+#include <klibc/string.h>
+#include <klibc/errno.h>
+
+#define CR0_TS              (1ULL << 3)
+#define CR4_OSXSAVE         (1ULL << 18)
+
+#define FXSAVE_SIZE         512
+#define XSAVE_HEADER_SIZE   64
+#define XSTATE_BV_OFFSET    512
+#define XCOMP_BV_OFFSET     520
+#define XCOMP_BV_COMPACT    (1ULL << 63)
+
+#define FCW_DEFAULT         0x037F
+#define MXCSR_DEFAULT       0x1F80
+
+static int fpu_mode = FPU_MODE_FXSR;
+static uint64_t fpu_xcr0;
+static uint32_t fpu_state_size = FXSAVE_SIZE;
+static heap_slab_cache_t *fpu_cache;
+
+/* The default state new tasks start from */
+static uint8_t fpu_init_state[FXSAVE_SIZE + XSAVE_HEADER_SIZE] __attribute__((aligned(64)));
+
+/* Per CPU: whose registers are loaded, and whether they changed this slice */
+static tcb_t *fpu_owner[SMP_MAX_CPUS];
+static bool fpu_active[SMP_MAX_CPUS];
+
+static inline uint64_t read_cr0(void) {
+    uint64_t v;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint64_t v) {
+    __asm__ volatile("mov %0, %%cr0" :: "r"(v) : "memory");
+}
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void clts(void) {
+    __asm__ volatile("clts" ::: "memory");
+}
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+    __asm__ volatile("xsetbv" :: "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static void fpu_save(void *area) {
+    uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    switch (fpu_mode) {
+    case FPU_MODE_XSAVES:
+        __asm__ volatile("xsaves64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVEOPT:
+        __asm__ volatile("xsaveopt64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVE:
+        __asm__ volatile("xsave64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        __asm__ volatile("fxsave64 (%0)" :: "r"(area) : "memory");
+        break;
+    }
+}
+
+static void fpu_restore(const void *area) {
+    uint32_t lo = (uint32_t)fpu_xcr0, hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    switch (fpu_mode) {
+    case FPU_MODE_XSAVES:
+        __asm__ volatile("xrstors64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVEOPT:
+    case FPU_MODE_XSAVE:
+        __asm__ volatile("xrstor64 (%0)" :: "r"(area), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        __asm__ volatile("fxrstor64 (%0)" :: "r"(area) : "memory");
+        break;
+    }
+}
+
+static void fpu_build_init_state(void) {
+    memset(fpu_init_state, 0, sizeof(fpu_init_state));
+
+    *(uint16_t *)&fpu_init_state[0] = FCW_DEFAULT;
+    *(uint32_t *)&fpu_init_state[24] = MXCSR_DEFAULT;
+
+    if (fpu_mode == FPU_MODE_FXSR)
+        return;
+
+    /* x87 and SSE come from the legacy area above; everything else is reset */
+    *(uint64_t *)&fpu_init_state[XSTATE_BV_OFFSET] = XCR0_X87 | XCR0_SSE;
+    if (fpu_mode == FPU_MODE_XSAVES)
+        *(uint64_t *)&fpu_init_state[XCOMP_BV_OFFSET] = XCOMP_BV_COMPACT | fpu_xcr0;
+}
+
+static void fpu_setup_cpu(void) {
+    if (fpu_mode == FPU_MODE_FXSR)
+        return;
+
+    uint64_t cr4;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    __asm__ volatile("mov %0, %%cr4" :: "r"(cr4 | CR4_OSXSAVE) : "memory");
+
+    xsetbv(0, fpu_xcr0);
+}
+
+void fpu_init(void) {
+    ebegin("Starting FPU state switching");
+
+    cpuid_regs_t regs;
+
+    if (cpuid_get_max_leaf() >= 0xD && cpuid_has_feature_ecx(CPUID_FEAT_ECX_XSAVE)) {
+        cpuid(0xD, 0, &regs);
+        fpu_xcr0 = (((uint64_t)regs.edx << 32) | regs.eax) & XCR0_SUPPORTED;
+
+        cpuid(0xD, 1, &regs);
+        if (regs.eax & (1 << 3))
+            fpu_mode = FPU_MODE_XSAVES;
+        else if (regs.eax & (1 << 0))
+            fpu_mode = FPU_MODE_XSAVEOPT;
+        else
+            fpu_mode = FPU_MODE_XSAVE;
+
+        fpu_setup_cpu();
+
+        /* Sizes are for the XCR0 just loaded; XSAVES uses the compacted form */
+        if (fpu_mode == FPU_MODE_XSAVES) {
+            __asm__ volatile("wrmsr" :: "c"(0xDA0), "a"(0), "d"(0));   /* IA32_XSS */
+            cpuid(0xD, 1, &regs);
+        } else {
+            cpuid(0xD, 0, &regs);
+        }
+        fpu_state_size = regs.ebx;
+    }
+
+    fpu_build_init_state();
+
+    fpu_cache = heap_create_slab_cache("fpu_state", fpu_state_size, 64);
+
+    static const char *const mode_names[] = { "fxsave", "xsave", "xsaveopt", "xsaves" };
+    printk("fpu: %s, xcr0=0x%lx, %u bytes per task\n",
+           mode_names[fpu_mode], fpu_xcr0, fpu_state_size);
+
+    eend(fpu_cache == NULL ? -1 : 0, NULL);
+}
+
+void fpu_ap_init(void) {
+    fpu_enable();
+    fpu_setup_cpu();
+
+    if (fpu_mode == FPU_MODE_XSAVES)
+        __asm__ volatile("wrmsr" :: "c"(0xDA0), "a"(0), "d"(0));
+}
+
+static void *fpu_alloc_state(void) {
+    void *area = (fpu_cache != NULL) ? heap_slab_alloc(fpu_cache) : NULL;
+    if (area == NULL)
+        return NULL;
+
+    memset(area, 0, fpu_state_size);
+    memcpy(area, fpu_init_state,
+           fpu_mode == FPU_MODE_FXSR ? FXSAVE_SIZE : FXSAVE_SIZE + XSAVE_HEADER_SIZE);
+    return area;
+}
+
+void fpu_switch(tcb_t *prev, tcb_t *next) {
+    /* NOTE: Called with interrupts disabled from switch_to_task */
+    cpu_info_t *cpu = smp_get_current_cpu();
+
+    /* Only a task that used the FPU this slice has anything to save; TS is clear then */
+    if (cpu != NULL && fpu_active[cpu->cpu_id]) {
+        fpu_active[cpu->cpu_id] = false;
+        if (prev != NULL && prev->fpu_state != NULL && fpu_owner[cpu->cpu_id] == prev)
+            fpu_save(prev->fpu_state);
+    }
+
+    /* The registers stay loaded; #NM decides whether they are still next's */
+    (void)next;
+    stts();
+}
+
+void fpu_handle_nm(void) {
+    /* NOTE: Runs as an exception with interrupts disabled */
+    cpu_info_t *cpu = smp_get_current_cpu();
+    tcb_t *task = get_current_task();
+
+    clts();
+
+    if (cpu == NULL || task == NULL)
+        return;
+
+    uint32_t id = cpu->cpu_id;
+
+    if (task->fpu_state == NULL) {
+        task->fpu_state = fpu_alloc_state();
+        if (task->fpu_state == NULL) {
+            epanic("fpu", "no memory for FPU state");
+        }
+        task->fpu_cpu = FPU_CPU_NONE;
+    }
+
+    /* Still loaded here, and not touched on another CPU since: nothing to do */
+    if (fpu_owner[id] != task || task->fpu_cpu != id) {
+        fpu_restore(task->fpu_state);
+        fpu_owner[id] = task;
+        task->fpu_cpu = id;
+    }
+
+    fpu_active[id] = true;
+}
+
+int fpu_copy_current(tcb_t *child) {
+    tcb_t *task = get_current_task();
+    if (task == NULL || task->fpu_state == NULL)
+        return 0;
+
+    void *area = fpu_alloc_state();
+    if (area == NULL)
+        return -ENOMEM;
+
+    uint64_t flags = irq_save();
+
+    /* Live registers are newer than the saved copy */
+    cpu_info_t *cpu = smp_get_current_cpu();
+    if (cpu != NULL && fpu_active[cpu->cpu_id] && fpu_owner[cpu->cpu_id] == task)
+        fpu_save(task->fpu_state);
+
+    memcpy(area, task->fpu_state, fpu_state_size);
+
+    irq_restore(flags);
+
+    child->fpu_state = area;
+    child->fpu_cpu = FPU_CPU_NONE;
+    return 0;
+}
+
+void fpu_release_current(void) {
+    tcb_t *task = get_current_task();
+    if (task == NULL || task->fpu_state == NULL)
+        return;
+
+    uint64_t flags = irq_save();
+
+    /* Forget it everywhere, or a new tcb at this address could inherit it */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        if (fpu_owner[i] == task) {
+            fpu_owner[i] = NULL;
+            fpu_active[i] = false;
+        }
+    }
+
+    void *area = task->fpu_state;
+    task->fpu_state = NULL;
+
+    irq_restore(flags);
+
+    heap_slab_free(fpu_cache, area);
+}
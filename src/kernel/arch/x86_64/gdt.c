@@ -1,4 +1,3 @@
-#include <arch/x86_64/syscall.h>
 #include <arch/x86_64/gdt.h>
 
 #include <video/printk.h>
@@ -93,8 +92,7 @@ void gdt_init(void)
 
 void gdt_set_kernel_stack(uint64_t stack)
 {
-    tss.rsp0          = stack;
-    syscall_kernel_rsp = stack;
+    tss.rsp0 = stack;
 }
 
 void gdt_set_ist(uint8_t ist_num, uint64_t stack)
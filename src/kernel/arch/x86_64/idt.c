@@ -1,5 +1,6 @@
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/gdt.h>
+#include <arch/x86_64/smp.h>
 
 #include <video/printk.h>
 
@@ -60,6 +61,9 @@ void idt_init(void) {
         idt_set_gate(32 + i, irq_table[i], GDT_KERNEL_CODE, IDT_INTERRUPT_GATE, 0);
     }
 
+    idt_set_gate(SMP_IPI_RESCHEDULE, (uint64_t)isr240, GDT_KERNEL_CODE, IDT_INTERRUPT_GATE, 0);
+    idt_set_gate(SMP_IPI_TLB_FLUSH, (uint64_t)isr241, GDT_KERNEL_CODE, IDT_INTERRUPT_GATE, 0);
+
     /* Uncomment when syscalls exist
        idt_set_gate(0x80, (uint64_t)isr128, GDT_KERNEL_CODE, IDT_USER_INTERRUPT, 0);
     */
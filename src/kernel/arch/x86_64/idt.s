@@ -84,6 +84,9 @@ IRQ 13, 45
 IRQ 14, 46
 IRQ 15, 47
 
+ISR_NOERRCODE 240   /* SMP_IPI_RESCHEDULE */
+ISR_NOERRCODE 241   /* SMP_IPI_TLB_FLUSH */
+
 .extern interrupt_handler
 .type interrupt_common, @function
 interrupt_common:
@@ -116,14 +119,13 @@ interrupt_common:
     and rax, 3
     cmp rax, 3
     jne 1f
-    /* swapgs */
+    swapgs                  /* from ring 3: GS base -> this CPU's cpu_info */
 
 1:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov fs, ax              /* not gs: a selector load would clear its base */
 
     mov rdi, rsp
     mov r15, rsp            /* save RSP in callee-saved r15, NOT rdi */
@@ -138,11 +140,10 @@ interrupt_common:
     and rax, 3
     cmp rax, 3
     jne 2f
-    /* swapgs */
+    swapgs                  /* back to the user's GS base */
 
 2:
-    pop rax
-    mov gs, ax
+    pop rax                 /* saved gs selector, left as is */
     pop rax
     mov fs, ax
     pop rax
@@ -1,10 +1,13 @@
 #include <arch/x86_64/apic.h>
+#include <arch/x86_64/fpu.h>
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/io.h>
+#include <arch/x86_64/smp.h>
 
 #include <core/scheduler.h>
 #include <core/proc.h>
 
+#include <mm/mmu.h>
 #include <mm/vmm.h>
 
 #include <video/printk.h>
@@ -97,6 +100,12 @@ void interrupt_handler(struct interrupt_frame *frame) {
         kernel_panic("Unrecoverable page fault");
     }
 
+    /* Device not available: first FPU use since CR0.TS was set */
+    if (int_no == 7) {
+        fpu_handle_nm();
+        return;
+    }
+
     if (int_no < 32) {
         printk("\n*** CPU EXCEPTION: %s (#%llu) ***\n",
                int_no < 22 ? exception_messages[int_no] : "Unknown",
@@ -112,6 +121,9 @@ void interrupt_handler(struct interrupt_frame *frame) {
     if (int_no >= 32 && int_no < 48) {
         int irq = int_no - 32;
 
+        /* Any reschedule requested by the handlers runs after the EOI */
+        lock_scheduler();
+
         if (irq_handlers[irq])
             irq_handlers[irq](frame);
 
@@ -120,6 +132,22 @@ void interrupt_handler(struct interrupt_frame *frame) {
                 scheduler_timer_tick();
         }
 
+        apic_eoi();
+
+        unlock_scheduler();
+        return;
+    }
+
+    if (int_no == SMP_IPI_RESCHEDULE) {
+        lock_scheduler();
+        scheduler_resched_ipi();
+        apic_eoi();
+        unlock_scheduler();
+        return;
+    }
+
+    if (int_no == SMP_IPI_TLB_FLUSH) {
+        mmu_tlb_shootdown_ipi();
         apic_eoi();
         return;
     }
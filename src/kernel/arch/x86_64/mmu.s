@@ -26,3 +26,13 @@ mmu_flush_tlb:
     mov rax, cr3
     mov cr3, rax
     ret
+
+.global mmu_flush_tlb_global
+.type mmu_flush_tlb_global, @function
+mmu_flush_tlb_global:
+    mov rax, cr4
+    mov rcx, rax
+    and rcx, ~0x80          /* CR4.PGE off drops global entries too */
+    mov cr4, rcx
+    mov cr4, rax
+    ret
@@ -0,0 +1,163 @@
+#include <arch/x86_64/cpuid.h>
+#include <arch/x86_64/pageops.h>
+#include <arch/x86_64/tsc.h>
+
+#include <mm/pmm.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+/*
+ * rep stosb/movsb is the safe default until pageops_init() runs. With
+ * ERMS the microcode moves whole lines and it stays the choice;
+ * without it, movnti writes full lines straight to memory instead of
+ * reading each destination line in first. Either way the stores go
+ * through general purpose registers, so no FPU state is touched.
+ */
+
+static int pageops_mode = PAGEOPS_MODE_REP;
+
+static const char *const pageops_names[] = {
+    [PAGEOPS_MODE_REP]    = "rep",
+    [PAGEOPS_MODE_MOVNTI] = "movnti",
+};
+
+static inline void clear_rep(void *dst, size_t bytes) {
+    __asm__ volatile("rep stosb" : "+D"(dst), "+c"(bytes) : "a"(0) : "memory");
+}
+
+static inline void copy_rep(void *dst, const void *src, size_t bytes) {
+    __asm__ volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) :: "memory");
+}
+
+static void clear_movnti(void *dst, size_t bytes) {
+    /* One 64-byte line per iteration */
+    for (uint8_t *p = dst, *end = p + bytes; p < end; p += 64) {
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %1, 8(%0)\n\t"
+            "movnti %1, 16(%0)\n\t"
+            "movnti %1, 24(%0)\n\t"
+            "movnti %1, 32(%0)\n\t"
+            "movnti %1, 40(%0)\n\t"
+            "movnti %1, 48(%0)\n\t"
+            "movnti %1, 56(%0)\n\t"
+            :: "r"(p), "r"(0UL) : "memory");
+    }
+
+    /* Weakly ordered stores; make them visible before the page is handed out */
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+static void copy_movnti(void *dst, const void *src, size_t bytes) {
+    const uint64_t *s = src;
+    uint64_t *d = dst;
+
+    for (size_t i = 0; i < bytes / 8; i += 4) {
+        uint64_t a = s[i], b = s[i + 1], c = s[i + 2], e = s[i + 3];
+        __asm__ volatile(
+            "movnti %1, 0(%0)\n\t"
+            "movnti %2, 8(%0)\n\t"
+            "movnti %3, 16(%0)\n\t"
+            "movnti %4, 24(%0)\n\t"
+            :: "r"(d + i), "r"(a), "r"(b), "r"(c), "r"(e) : "memory");
+    }
+
+    __asm__ volatile("sfence" ::: "memory");
+}
+
+void clear_pages(void *page, size_t count) {
+    if (pageops_mode == PAGEOPS_MODE_MOVNTI)
+        clear_movnti(page, count * PAGE_SIZE);
+    else
+        clear_rep(page, count * PAGE_SIZE);
+}
+
+void clear_page(void *page) {
+    clear_pages(page, 1);
+}
+
+void copy_pages(void *dst, const void *src, size_t count) {
+    if (pageops_mode == PAGEOPS_MODE_MOVNTI)
+        copy_movnti(dst, src, count * PAGE_SIZE);
+    else
+        copy_rep(dst, src, count * PAGE_SIZE);
+}
+
+void copy_page(void *dst, const void *src) {
+    copy_pages(dst, src, 1);
+}
+
+void clear_page_nt(void *page) {
+    clear_movnti(page, PAGE_SIZE);
+}
+
+int pageops_get_mode(void) {
+    return pageops_mode;
+}
+
+static uint64_t pageops_time(int mode, bool copy, void *dst, const void *src) {
+    /* Best of three, so a stray interrupt doesn't decide */
+    uint64_t best = UINT64_MAX;
+
+    for (int run = 0; run < 3; run++) {
+        uint64_t start = rdtsc_serialized();
+
+        if (copy && mode == PAGEOPS_MODE_MOVNTI)
+            copy_movnti(dst, src, PAGEOPS_BENCH_PAGES * PAGE_SIZE);
+        else if (copy)
+            copy_rep(dst, src, PAGEOPS_BENCH_PAGES * PAGE_SIZE);
+        else if (mode == PAGEOPS_MODE_MOVNTI)
+            clear_movnti(dst, PAGEOPS_BENCH_PAGES * PAGE_SIZE);
+        else
+            clear_rep(dst, PAGEOPS_BENCH_PAGES * PAGE_SIZE);
+
+        uint64_t cycles = rdtsc_serialized() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return tsc_to_ns(best);
+}
+
+static void pageops_benchmark(void) {
+    int zone = pmm_get_zone_free_pages(PMM_ZONE_NORMAL) > 0 ? PMM_ZONE_NORMAL : PMM_ZONE_DMA32;
+
+    uint64_t src_phys = pmm_alloc_pages(PAGEOPS_BENCH_PAGES, zone);
+    uint64_t dst_phys = pmm_alloc_pages(PAGEOPS_BENCH_PAGES, zone);
+    if (src_phys == 0 || dst_phys == 0) {
+        pmm_free_pages(src_phys, PAGEOPS_BENCH_PAGES);
+        pmm_free_pages(dst_phys, PAGEOPS_BENCH_PAGES);
+        printk("pageops: no memory to benchmark, using %s\n", pageops_names[pageops_mode]);
+        return;
+    }
+
+    void *src = PHYS_TO_VIRT(src_phys);
+    void *dst = PHYS_TO_VIRT(dst_phys);
+    uint64_t mb = PAGEOPS_BENCH_PAGES * PAGE_SIZE / (1024 * 1024);
+
+    for (int mode = PAGEOPS_MODE_REP; mode <= PAGEOPS_MODE_MOVNTI; mode++) {
+        uint64_t clear_ns = pageops_time(mode, false, dst, src);
+        uint64_t copy_ns = pageops_time(mode, true, dst, src);
+
+        printk("pageops: %-6s clear %lu us, copy %lu us per %lu MB%s\n",
+               pageops_names[mode], clear_ns / 1000, copy_ns / 1000, mb,
+               mode == pageops_mode ? " (selected)" : "");
+    }
+
+    pmm_free_pages(src_phys, PAGEOPS_BENCH_PAGES);
+    pmm_free_pages(dst_phys, PAGEOPS_BENCH_PAGES);
+}
+
+void pageops_init(void) {
+    ebegin("Selecting page clear/copy routines");
+
+    if (cpuid_has_feature7_ebx(CPUID_FEAT_EBX_ERMS) || !cpuid_has_feature_edx(CPUID_FEAT_EDX_SSE2))
+        pageops_mode = PAGEOPS_MODE_REP;
+    else
+        pageops_mode = PAGEOPS_MODE_MOVNTI;
+
+    pageops_benchmark();
+
+    eend(0, NULL);
+}
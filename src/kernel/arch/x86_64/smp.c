@@ -1,8 +1,13 @@
 #include <arch/x86_64/smp.h>
 #include <arch/x86_64/apic.h>
+#include <arch/x86_64/fpu.h>
 #include <arch/x86_64/gdt.h>
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/io.h>
+#include <arch/x86_64/mmu.h>
+#include <arch/x86_64/syscall.h>
+
+#include <core/scheduler.h>
 
 #include <mm/heap.h>
 
@@ -27,6 +32,15 @@ cpu_info_t       *g_cpus[SMP_MAX_CPUS];
 volatile uint32_t g_cpu_count   = 0;
 volatile uint32_t g_cpus_online = 0;
 
+/* What GS points at before the BSP has a cpu_info_t: every field reads 0 */
+static cpu_info_t smp_boot_area;
+
+static void smp_load_gs_base(cpu_info_t *cpu)
+{
+    wrmsr(IA32_GS_BASE, (uint64_t)cpu);
+    wrmsr(IA32_KERNEL_GS_BASE, 0);      /* User GS until the first swapgs */
+}
+
 static void cpu_gdt_set_gate(struct gdt_entry *gdt, int n,
                               uint32_t base, uint32_t limit,
                               uint8_t access, uint8_t gran)
@@ -104,11 +118,16 @@ static cpu_info_t *smp_alloc_cpu_info(uint32_t cpu_id, uint32_t lapic_id,
     cpu_info_t *cpu = (cpu_info_t *)kmalloc_flags(sizeof(cpu_info_t), HEAP_ZERO);
     if (!cpu) return NULL;
 
+    cpu->self     = cpu;
     cpu->cpu_id   = cpu_id;
     cpu->lapic_id = lapic_id;
     cpu->is_bsp   = is_bsp;
     cpu->online   = is_bsp;
 
+    /* APs record theirs on the first task switch */
+    if (is_bsp)
+        cpu->active_pml4 = mmu_get_cr3();
+
     cpu->stack_bottom = (uint8_t *)kmalloc(SMP_AP_STACK_SIZE);
     if (!cpu->stack_bottom) return NULL;
     cpu->stack_top = cpu->stack_bottom + SMP_AP_STACK_SIZE;
@@ -163,11 +182,17 @@ void smp_ap_init_c(struct limine_mp_info *info)
     gdt_flush((uint64_t)&cpu->gdt_ptr);
     tss_flush();
 
+    /* After the GDT load, which may have reset the GS base */
+    smp_load_gs_base(cpu);
+
     /* idt_get_ptr() must be used here instead of sidt: on an AP, sidt returns
      * Limine's stub IDT, not the kernel's, causing a triple fault on the first
      * exception. */
     idt_flush((uint64_t)idt_get_ptr());
 
+    fpu_ap_init();
+    syscall_cpu_init();
+
     smp_ap_enable_lapic();
 
     uint64_t apic_hz   = apic_timer_get_frequency();
@@ -182,11 +207,16 @@ void smp_ap_init_c(struct limine_mp_info *info)
     __atomic_fetch_add(&g_cpus_online, 1, __ATOMIC_RELEASE);
 
     __asm__ volatile("sti");
-    smp_ap_idle();
+    scheduler_ap_start();
 
     for (;;) __asm__ volatile("hlt");
 }
 
+void smp_early_init(void)
+{
+    smp_load_gs_base(&smp_boot_area);
+}
+
 void smp_init(void)
 {
     struct limine_mp_response *resp = smp_mp_request.response;
@@ -197,6 +227,7 @@ void smp_init(void)
         ewarn("smp: no Limine MP response, running uniprocessor");
         cpu_info_t *bsp = smp_alloc_cpu_info(0, apic_get_id(), true);
         if (bsp) {
+            smp_load_gs_base(bsp);
             g_cpus[0]     = bsp;
             g_cpu_count   = 1;
             g_cpus_online = 1;
@@ -222,6 +253,7 @@ void smp_init(void)
             epanic("smp", "failed to allocate BSP cpu_info");
             return;
         }
+        smp_load_gs_base(bsp);
         g_cpus[next_id] = bsp;
         next_id++;
         g_cpus_online = 1;
@@ -278,15 +310,6 @@ cpu_info_t *smp_get_cpu(uint32_t cpu_id)
     return g_cpus[cpu_id];
 }
 
-cpu_info_t *smp_get_current_cpu(void)
-{
-    uint32_t lapic_id = apic_get_id();
-    for (uint32_t i = 0; i < g_cpu_count; i++)
-        if (g_cpus[i] && g_cpus[i]->lapic_id == lapic_id)
-            return g_cpus[i];
-    return NULL;
-}
-
 uint32_t smp_get_cpu_count(void)    { return g_cpu_count; }
 uint32_t smp_get_bsp_lapic_id(void) { return g_cpus[0] ? g_cpus[0]->lapic_id : 0; }
 
@@ -1,36 +1,50 @@
 #include <arch/x86_64/switch.h>
 #include <arch/x86_64/gdt.h>
+#include <arch/x86_64/fpu.h>
 #include <arch/x86_64/mmu.h>
+#include <arch/x86_64/smp.h>
 
 #include <core/scheduler.h>
 
+#include <mm/mmu.h>
+
 #include <video/printk.h>
 
 #include <stdint.h>
 #include <stddef.h>
 
-extern uint64_t syscall_kernel_rsp;
-extern tcb_t *current_task;
-
-void switch_to_task(tcb_t *next_task) {
+void switch_to_task(tcb_t *prev_task, tcb_t *next_task) {
     if (next_task == NULL)
         return;
 
     uint64_t new_stack_top = next_task->kernel_stack_base
                            + next_task->kernel_stack_size;
-    gdt_set_kernel_stack(new_stack_top);
-    syscall_kernel_rsp = new_stack_top;
+
+    cpu_info_t *cpu = smp_get_current_cpu();
+    if (cpu == NULL || cpu->is_bsp)
+        gdt_set_kernel_stack(new_stack_top);
+    else
+        cpu->tss.rsp0 = new_stack_top;
+
+    if (cpu != NULL)
+        cpu->syscall_rsp = new_stack_top;
 
     if (next_task->cr3 != 0) {
         uint64_t cur_cr3;
         __asm__ volatile("mov %%cr3, %0" : "=r"(cur_cr3));
         if (next_task->cr3 != cur_cr3)
-            mmu_load_cr3(next_task->cr3);
+            mmu_activate_pml4(next_task->cr3);
     }
 
-    switch_to_task_asm(next_task);
+    fpu_switch(prev_task, next_task);
+
+    switch_to_task_asm(prev_task, next_task);
 }
 
 void task_startup_wrapper(void) {
+    finish_task_switch();
     unlock_scheduler();
+
+    /* First run: we arrive here from schedule() with interrupts off */
+    __asm__ volatile("sti");
 }
\ No newline at end of file
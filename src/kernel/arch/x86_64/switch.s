@@ -2,8 +2,6 @@
 
 .section .text
 
-.extern current_task
-
 .global switch_to_task_asm
 .type switch_to_task_asm, @function
 switch_to_task_asm:
@@ -14,14 +12,12 @@ switch_to_task_asm:
     push r14
     push r15
 
-    mov rax, [rip + current_task]
-    test rax, rax
+    test rdi, rdi               /* prev == NULL: nothing to save */
     jz .Lno_save
-    mov [rax], rsp
+    mov [rdi], rsp
 
 .Lno_save:
-    mov [rip + current_task], rdi
-    mov rsp, [rdi]
+    mov rsp, [rsi]
 
     pop r15
     pop r14
@@ -59,6 +55,7 @@ enter_userspace:
     xor r14, r14
     xor r15, r15
 
+    swapgs          /* kernel GS base is parked until the next entry */
     iretq
 
 .att_syntax prefix
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <arch/x86_64/syscall_util.h>
 
 #include <arch/x86_64/tsc.h>
+#include <arch/x86_64/smp.h>
 
 #include <drivers/input/kb.h>
 
@@ -9,6 +10,8 @@
 
 #include <core/scheduler.h>
 #include <core/proc.h>
+#include <core/futex.h>
+#include <core/rcu.h>
 
 #include <mm/heap.h>
 #include <mm/paging.h>
@@ -25,10 +28,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-extern uint64_t syscall_user_rip;
-extern uint64_t syscall_user_rsp;
-extern uint64_t syscall_user_rflags;
-
 static inline uint64_t rdmsr(uint32_t msr)
 {
     uint32_t lo, hi;
@@ -43,13 +42,19 @@ static inline void wrmsr(uint32_t msr, uint64_t val)
                                "d"((uint32_t)(val >> 32)));
 }
 
-void syscall_init(void)
+void syscall_cpu_init(void)
 {
-    ebegin("Starting syscall interface");
+    /* The MSRs are per CPU; each AP programs its own */
     wrmsr(IA32_EFER,   rdmsr(IA32_EFER) | 1);
     wrmsr(IA32_STAR,   ((uint64_t)0x10 << 48) | ((uint64_t)0x08 << 32));
     wrmsr(IA32_LSTAR,  (uint64_t)syscall_entry);
     wrmsr(IA32_SFMASK, (1 << 9));
+}
+
+void syscall_init(void)
+{
+    ebegin("Starting syscall interface");
+    syscall_cpu_init();
     clock_subsystem_init();
     eend(0, NULL);
 }
@@ -1179,6 +1184,252 @@ static int64_t sys_rt_sigprocmask(uint64_t how, uint64_t set_addr,
     return 0;
 }
 
+/* pid 0 is the calling thread, anything else a process's main thread */
+static tcb_t *sched_attr_target(uint64_t pid)
+{
+    /* NOTE: Caller must hold rcu_read_lock(); another process's thread may be freed after it */
+    if (pid == 0)
+        return get_current_task();
+
+    pcb_t *proc = proc_find_by_pid((pid_t)pid);
+    return (proc != NULL) ? proc->main_thread : NULL;
+}
+
+static int64_t sys_sched_setattr(uint64_t pid, uint64_t attr_addr, uint64_t flags)
+{
+    if (flags != 0) return -EINVAL;
+
+    if (validate_user_buf((void *)attr_addr, SCHED_ATTR_SIZE_VER0) != 0)
+        return -EFAULT;
+
+    linux_sched_attr_t *ua = (linux_sched_attr_t *)attr_addr;
+    if (ua->size != 0 && ua->size < SCHED_ATTR_SIZE_VER0)
+        return -EINVAL;
+
+    sched_attr_t attr;
+    memset(&attr, 0, sizeof(attr));
+
+    switch (ua->sched_policy) {
+    case SCHED_NORMAL:
+        if (ua->sched_priority != 0 || ua->sched_nice < -20 || ua->sched_nice > 19)
+            return -EINVAL;
+        attr.policy = SCHED_POLICY_FAIR;
+        break;
+
+    case SCHED_FIFO:
+    case SCHED_RR:
+        attr.policy      = (ua->sched_policy == SCHED_FIFO) ? SCHED_POLICY_FIFO : SCHED_POLICY_RR;
+        attr.rt_priority = (uint8_t)((ua->sched_priority > 255) ? 0 : ua->sched_priority);
+        break;
+
+    case SCHED_DEADLINE:
+        attr.policy      = SCHED_POLICY_DEADLINE;
+        attr.runtime_ns  = ua->sched_runtime;
+        attr.deadline_ns = ua->sched_deadline;
+        attr.period_ns   = ua->sched_period ? ua->sched_period : ua->sched_deadline;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    int32_t nice = ua->sched_nice;
+
+    /* The scheduler calls nest inside the read-side section */
+    rcu_read_lock();
+    tcb_t *task = sched_attr_target(pid);
+    int ret = -ESRCH;
+    if (task != NULL) {
+        ret = task_set_sched_attr(task, &attr);
+        if (ret == 0 && attr.policy == SCHED_POLICY_FAIR)
+            task_set_priority(task, (uint8_t)(PRIORITY_NORMAL - nice * 6));
+    }
+    rcu_read_unlock();
+
+    pcb_t *proc = proc_get_current();
+    if (proc != NULL) proc->stats.syscalls++;
+    return ret;
+}
+
+static int64_t sys_sched_getattr(uint64_t pid, uint64_t attr_addr,
+                                 uint64_t size, uint64_t flags)
+{
+    if (flags != 0 || size < SCHED_ATTR_SIZE_VER0) return -EINVAL;
+
+    if (validate_user_buf((void *)attr_addr, SCHED_ATTR_SIZE_VER0) != 0)
+        return -EFAULT;
+
+    sched_attr_t attr;
+    uint8_t priority = 0;
+
+    rcu_read_lock();
+    tcb_t *task = sched_attr_target(pid);
+    if (task != NULL) {
+        task_get_sched_attr(task, &attr);
+        priority = task->priority;
+    }
+    rcu_read_unlock();
+
+    if (task == NULL) return -ESRCH;
+
+    linux_sched_attr_t *ua = (linux_sched_attr_t *)attr_addr;
+    memset(ua, 0, SCHED_ATTR_SIZE_VER0);
+    ua->size = SCHED_ATTR_SIZE_VER0;
+
+    switch (attr.policy) {
+    case SCHED_POLICY_FIFO:
+    case SCHED_POLICY_RR:
+        ua->sched_policy   = (attr.policy == SCHED_POLICY_FIFO) ? SCHED_FIFO : SCHED_RR;
+        ua->sched_priority = attr.rt_priority;
+        break;
+
+    case SCHED_POLICY_DEADLINE:
+        ua->sched_policy   = SCHED_DEADLINE;
+        ua->sched_runtime  = attr.runtime_ns;
+        ua->sched_deadline = attr.deadline_ns;
+        ua->sched_period   = attr.period_ns;
+        break;
+
+    default:
+        /* The bucket class has no Linux equivalent and reports as normal */
+        ua->sched_policy = SCHED_NORMAL;
+        ua->sched_nice   = ((int32_t)PRIORITY_NORMAL - (int32_t)priority) / 6;
+        break;
+    }
+
+    pcb_t *proc = proc_get_current();
+    if (proc != NULL) proc->stats.syscalls++;
+    return 0;
+}
+
+static int64_t futex_timeout(uint64_t ts_addr, bool absolute, bool realtime, uint64_t *out_ns)
+{
+    *out_ns = 0;
+    if (ts_addr == 0)
+        return 0;
+
+    if (validate_user_buf((void *)ts_addr, sizeof(linux_timespec_t)) != 0)
+        return -EFAULT;
+
+    const linux_timespec_t *ts = (const linux_timespec_t *)ts_addr;
+    if (ts->tv_sec < 0 || ts->tv_nsec < 0 || ts->tv_nsec >= 1000000000LL)
+        return -EINVAL;
+
+    uint64_t ns = (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+
+    if (absolute) {
+        uint64_t now = tsc_get_uptime_ns();
+        if (realtime)
+            now += clock_get_realtime_base() * 1000000000ULL;
+        if (ns <= now)
+            return -ETIMEDOUT;
+        ns -= now;
+    } else if (ns == 0) {
+        return -ETIMEDOUT;
+    }
+
+    *out_ns = ns;
+    return 0;
+}
+
+static int64_t sys_futex(uint64_t uaddr, uint64_t op, uint64_t val,
+                         uint64_t utime, uint64_t uaddr2, uint64_t val3)
+{
+    int cmd   = (int)(op & FUTEX_CMD_MASK);
+    int flags = (op & FUTEX_PRIVATE_FLAG) ? 0 : FUTEX_FLAG_SHARED;
+
+    if (validate_user_buf((void *)uaddr, sizeof(uint32_t)) != 0)
+        return -EFAULT;
+
+    pcb_t *proc = proc_get_current();
+    if (proc != NULL) proc->stats.syscalls++;
+
+    /* Only reached on contention; the fast path is an atomic in user space */
+    switch (cmd) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET: {
+        uint32_t bitset = (cmd == FUTEX_WAIT) ? FUTEX_BITSET_MATCH_ANY : (uint32_t)val3;
+        uint64_t timeout_ns;
+
+        /* FUTEX_WAIT takes a relative timeout, FUTEX_WAIT_BITSET an absolute one */
+        int64_t err = futex_timeout(utime, cmd == FUTEX_WAIT_BITSET,
+                                    (op & FUTEX_CLOCK_REALTIME) != 0, &timeout_ns);
+        if (err != 0)
+            return err;
+
+        return futex_wait((uint32_t *)uaddr, (uint32_t)val, timeout_ns, bitset, flags);
+    }
+
+    case FUTEX_WAKE:
+    case FUTEX_WAKE_BITSET: {
+        uint32_t bitset = (cmd == FUTEX_WAKE) ? FUTEX_BITSET_MATCH_ANY : (uint32_t)val3;
+        return futex_wake((uint32_t *)uaddr, (int)val, bitset, flags);
+    }
+
+    case FUTEX_REQUEUE:
+    case FUTEX_CMP_REQUEUE:
+        /* The requeue count travels in the timeout argument */
+        if (validate_user_buf((void *)uaddr2, sizeof(uint32_t)) != 0)
+            return -EFAULT;
+        return futex_requeue((uint32_t *)uaddr, (uint32_t *)uaddr2, (int)val, (int)utime,
+                             cmd == FUTEX_CMP_REQUEUE, (uint32_t)val3, flags);
+
+    default:
+        return -ENOSYS;
+    }
+}
+
+static int64_t sys_sched_setaffinity(uint64_t pid, uint64_t len, uint64_t mask_addr)
+{
+    if (len == 0) return -EINVAL;
+
+    if (validate_user_buf((void *)mask_addr, len) != 0)
+        return -EFAULT;
+
+    /* Bits past what we track are ignored, like CPUs that don't exist */
+    cpumask_t mask;
+    cpumask_clear(&mask);
+    memcpy(&mask, (const void *)mask_addr, len < sizeof(mask) ? len : sizeof(mask));
+
+    rcu_read_lock();
+    tcb_t *task = sched_attr_target(pid);
+    int ret = (task != NULL) ? task_set_affinity(task, &mask) : -ESRCH;
+    rcu_read_unlock();
+
+    pcb_t *proc = proc_get_current();
+    if (proc != NULL) proc->stats.syscalls++;
+    return ret;
+}
+
+static int64_t sys_sched_getaffinity(uint64_t pid, uint64_t len, uint64_t mask_addr)
+{
+    if (len < sizeof(cpumask_t) || (len & (sizeof(uint64_t) - 1)))
+        return -EINVAL;
+
+    if (validate_user_buf((void *)mask_addr, sizeof(cpumask_t)) != 0)
+        return -EFAULT;
+
+    cpumask_t mask;
+
+    rcu_read_lock();
+    tcb_t *task = sched_attr_target(pid);
+    if (task != NULL)
+        task_get_affinity(task, &mask);
+    rcu_read_unlock();
+
+    if (task == NULL) return -ESRCH;
+
+    /* Only report CPUs that exist */
+    for (uint32_t i = smp_get_cpu_count(); i < CPUMASK_BITS; i++)
+        cpumask_unset(&mask, i);
+
+    memcpy((void *)mask_addr, &mask, sizeof(mask));
+
+    pcb_t *proc = proc_get_current();
+    if (proc != NULL) proc->stats.syscalls++;
+    return (int64_t)sizeof(mask);
+}
+
 [[noreturn]] static void do_exit(int status, bool group)
 {
     pcb_t *proc = proc_get_current();
@@ -1233,6 +1484,11 @@ uint64_t syscall_dispatch(uint64_t num,
     case SYS_GETTIMEOFDAY:   return (uint64_t)sys_gettimeofday(a1, a2);
     case SYS_RT_SIGACTION:   return (uint64_t)sys_rt_sigaction(a1, a2, a3, a4);
     case SYS_RT_SIGPROCMASK: return (uint64_t)sys_rt_sigprocmask(a1, a2, a3, a4);
+    case SYS_SCHED_SETATTR:  return (uint64_t)sys_sched_setattr(a1, a2, a3);
+    case SYS_SCHED_GETATTR:  return (uint64_t)sys_sched_getattr(a1, a2, a3, a4);
+    case SYS_FUTEX:          return (uint64_t)sys_futex(a1, a2, a3, a4, a5, a6);
+    case SYS_SCHED_SETAFFINITY: return (uint64_t)sys_sched_setaffinity(a1, a2, a3);
+    case SYS_SCHED_GETAFFINITY: return (uint64_t)sys_sched_getaffinity(a1, a2, a3);
     case SYS_EXIT:           sys_exit_impl(a1);
     case SYS_EXIT_GROUP:     sys_exit_group_impl(a1);
     default:
@@ -1,38 +1,21 @@
 .intel_syntax noprefix
 
-.section .data
-
-.global syscall_kernel_rsp
-.global syscall_user_rip
-.global syscall_user_rsp
-.global syscall_user_rflags
-
-syscall_kernel_rsp:
-    .quad 0
-
-syscall_user_rip:
-    .quad 0
-
-syscall_user_rsp:
-    .quad 0
-
-syscall_user_rflags:
-    .quad 0
-
 .section .text
 .global syscall_entry
 .type   syscall_entry, @function
 
+/*
+ * IF is masked on entry, so nothing can reuse this CPU's scratch slot
+ * before the user RSP is on the kernel stack. User RSP, RFLAGS and RIP
+ * stay at the top of the task's kernel stack for the whole call.
+ */
 syscall_entry:
-    mov [rip + syscall_user_rip],    rcx    /* save for sys_fork */
-    mov [rip + syscall_user_rflags], r11    /* save for sys_fork */
-    mov [rip + syscall_user_rsp],    rsp    /* save for sys_fork */
+    swapgs                                  /* gs:0 is now this CPU's cpu_info */
 
-    mov r11, rsp
-    mov rsp, [rip + syscall_kernel_rsp]     /* switch to THIS task's kernel stack */
+    mov gs:[16], rsp                        /* cpu->syscall_user_rsp (CPU_INFO_USER_RSP) */
+    mov rsp, gs:[8]                         /* cpu->syscall_rsp (CPU_INFO_SYSCALL_RSP) */
 
-    push r11
-    mov  r11, [rip + syscall_user_rflags]   /* restore r11 = user RFLAGS */
+    push qword ptr gs:[16]  /* user RSP     */
     push r11        /* user RFLAGS  */
     push rcx        /* user RIP     */
     push rax        /* syscall num  */
@@ -87,6 +70,7 @@ syscall_entry:
     pop r11         /* user RFLAGS → r11 for sysretq */
     pop rsp
 
+    swapgs
     sysretq
 
 .att_syntax prefix
\ No newline at end of file
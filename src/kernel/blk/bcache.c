@@ -66,7 +66,7 @@ static inline uint32_t hash_block(struct blk_device *dev, uint64_t blockno)
 
 void bcache_init(void)
 {
-    spinlock_irq_init(&bcache.lock);
+    spinlock_irq_init_named(&bcache.lock, "bcache.lock");
     
     bcache.head.prev = &bcache.head;
     bcache.head.next = &bcache.head;
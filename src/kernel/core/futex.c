@@ -0,0 +1,352 @@
+#include <core/futex.h>
+#include <core/proc.h>
+#include <core/scheduler.h>
+#include <core/spinlock.h>
+
+#include <mm/mmu.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+
+#include <klibc/errno.h>
+
+/*
+ * Waiters live in hashed buckets of wait_queue_t. Each waiter's queue
+ * entry is embedded in a futex_q_t on its own stack, so waiting never
+ * allocates and a wakeup can't be lost to an allocation failure. The
+ * generic waitq_* helpers kfree() entries, so they never touch these
+ * queues.
+ */
+
+typedef struct futex_key {
+    uint64_t word;                  /* Physical address, or user address if private */
+    const void *space;              /* Owning vm_space_t for private keys */
+    bool shared;
+} futex_key_t;
+
+typedef struct futex_bucket {
+    spinlock_irq_t lock;
+    wait_queue_t waiters;
+} futex_bucket_t;
+
+typedef struct futex_q {
+    wait_queue_entry_t entry;
+    futex_key_t key;
+    uint32_t bitset;
+    futex_bucket_t *volatile bucket;    /* Changes under requeue */
+    volatile bool woken;
+} futex_q_t;
+
+static futex_bucket_t futex_table[FUTEX_HASH_SIZE];
+
+static int futex_get_key(uint32_t *uaddr, int flags, futex_key_t *key) {
+    if (((uint64_t)uaddr & 3) != 0)
+        return -EINVAL;
+
+    pcb_t *proc = proc_get_current();
+    vm_space_t *space = (proc != NULL) ? (vm_space_t *)proc->vm_space : NULL;
+
+    key->shared = (flags & FUTEX_FLAG_SHARED) != 0;
+
+    if (!key->shared || space == NULL) {
+        key->word = (uint64_t)uaddr;
+        key->space = space;
+        key->shared = false;
+        return 0;
+    }
+
+    /* Shared mappings land on the same frame whatever the virtual address */
+    uint64_t phys = mmu_virt_to_phys((mmu_context_t *)space->mmu_ctx, (uint64_t)uaddr);
+    if (phys == 0)
+        return -EFAULT;
+
+    key->word = phys;
+    key->space = NULL;
+    return 0;
+}
+
+/*
+ * Read the word with a bucket lock held. A #PF here would take vmm_lock
+ * with interrupts off, so user words are read through the page tables
+ * and the HHDM. -EFAULT means the caller drops its locks, faults the
+ * word in and tries again.
+ */
+static int futex_read_locked(uint32_t *uaddr, uint32_t *val) {
+    pcb_t *proc = proc_get_current();
+    vm_space_t *space = (proc != NULL) ? (vm_space_t *)proc->vm_space : NULL;
+
+    /* Kernel words are never unmapped under us */
+    if (space == NULL) {
+        *val = *(volatile uint32_t *)uaddr;
+        return 0;
+    }
+
+    uint64_t phys = mmu_virt_to_phys((mmu_context_t *)space->mmu_ctx, (uint64_t)uaddr);
+    if (phys == 0)
+        return -EFAULT;
+
+    *val = *(volatile uint32_t *)PHYS_TO_VIRT(phys);
+    return 0;
+}
+
+static inline bool futex_key_match(const futex_key_t *a, const futex_key_t *b) {
+    return a->word == b->word && a->space == b->space && a->shared == b->shared;
+}
+
+static futex_bucket_t *futex_hash(const futex_key_t *key) {
+    uint64_t h = (key->word ^ (uint64_t)key->space) * 0x9E3779B97F4A7C15ULL;
+    return &futex_table[h >> (64 - FUTEX_HASH_BITS)];
+}
+
+static void queue_insert(futex_bucket_t *b, futex_q_t *q) {
+    /* NOTE: Caller must hold b->lock */
+    wait_queue_t *wq = &b->waiters;
+
+    q->entry.next = NULL;
+    if (wq->tail == NULL)
+        wq->head = &q->entry;
+    else
+        wq->tail->next = &q->entry;
+    wq->tail = &q->entry;
+    wq->count++;
+
+    q->bucket = b;
+}
+
+static void queue_unlink(futex_bucket_t *b, futex_q_t *q) {
+    /* NOTE: Caller must hold b->lock */
+    wait_queue_t *wq = &b->waiters;
+    wait_queue_entry_t *prev = NULL;
+
+    for (wait_queue_entry_t *e = wq->head; e != NULL; prev = e, e = e->next) {
+        if (e != &q->entry)
+            continue;
+
+        if (prev == NULL)
+            wq->head = e->next;
+        else
+            prev->next = e->next;
+        if (wq->tail == e)
+            wq->tail = prev;
+
+        e->next = NULL;
+        wq->count--;
+        return;
+    }
+}
+
+static void wake_q(futex_bucket_t *b, futex_q_t *q) {
+    /* NOTE: Caller must hold b->lock and lock_scheduler(); q may be gone once b->lock is dropped */
+    tcb_t *thread = q->entry.thread;
+
+    queue_unlink(b, q);
+    b->waiters.wakeup_seq++;
+    q->woken = true;
+
+    unblock_task(thread);
+}
+
+static futex_bucket_t *lock_q_bucket(futex_q_t *q) {
+    for (;;) {
+        futex_bucket_t *b = q->bucket;
+
+        spinlock_irq_acquire(&b->lock);
+        if (q->bucket == b)
+            return b;
+        spinlock_irq_release(&b->lock);
+    }
+}
+
+static void double_bucket_lock(futex_bucket_t *a, futex_bucket_t *b) {
+    if (a == b) {
+        spinlock_irq_acquire(&a->lock);
+    } else if (a < b) {
+        spinlock_irq_acquire(&a->lock);
+        spinlock_irq_acquire(&b->lock);
+    } else {
+        spinlock_irq_acquire(&b->lock);
+        spinlock_irq_acquire(&a->lock);
+    }
+}
+
+static void double_bucket_unlock(futex_bucket_t *a, futex_bucket_t *b) {
+    /* Reverse order, the first lock holds the caller's interrupt state */
+    if (a == b) {
+        spinlock_irq_release(&a->lock);
+    } else if (a < b) {
+        spinlock_irq_release(&b->lock);
+        spinlock_irq_release(&a->lock);
+    } else {
+        spinlock_irq_release(&a->lock);
+        spinlock_irq_release(&b->lock);
+    }
+}
+
+int futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns,
+               uint32_t bitset, int flags) {
+    if (bitset == 0)
+        return -EINVAL;
+
+    tcb_t *current = get_current_task();
+    if (current == NULL)
+        return -EINVAL;
+
+    /* Fault the word in now, so the locked read below rarely has to retry */
+    (void)*(volatile uint32_t *)uaddr;
+
+    futex_q_t q;
+    int err = futex_get_key(uaddr, flags, &q.key);
+    if (err != 0)
+        return err;
+
+    q.entry.thread = current;
+    q.entry.wake_reason = 0;
+    q.entry.wake_data = NULL;
+    q.bitset = bitset;
+    q.woken = false;
+
+    futex_bucket_t *b = futex_hash(&q.key);
+
+    /* A waker changes the word before taking the lock, so no wakeup slips by */
+    uint32_t cur;
+    for (;;) {
+        spinlock_irq_acquire(&b->lock);
+        if (futex_read_locked(uaddr, &cur) == 0)
+            break;
+        spinlock_irq_release(&b->lock);
+
+        /* Unmapped since we touched it; fault it back in unlocked */
+        (void)*(volatile uint32_t *)uaddr;
+    }
+
+    if (cur != val) {
+        spinlock_irq_release(&b->lock);
+        return -EAGAIN;
+    }
+    queue_insert(b, &q);
+    spinlock_irq_release(&b->lock);
+
+    /* A wakeup landing before we sleep is left pending and consumed here */
+    if (timeout_ns > 0)
+        nano_sleep_interruptible(timeout_ns);
+    else
+        block_task(TASK_STATE_INTERRUPTIBLE);
+
+    b = lock_q_bucket(&q);
+    bool woken = q.woken;
+    if (!woken)
+        queue_unlink(b, &q);
+    spinlock_irq_release(&b->lock);
+
+    if (woken) {
+        /*
+         * wake_q() runs unblock_task() under the bucket lock, so it is done.
+         * If we had already left on a timeout or signal, that wakeup is still
+         * pending and would cut the next wait short; drop it.
+         */
+        cancel_pending_wakeup();
+        return 0;
+    }
+    if (timeout_ns > 0 && current->pending_signals == 0)
+        return -ETIMEDOUT;
+    return -EINTR;
+}
+
+int futex_wake(uint32_t *uaddr, int nr, uint32_t bitset, int flags) {
+    if (bitset == 0)
+        return -EINVAL;
+
+    futex_key_t key;
+    int err = futex_get_key(uaddr, flags, &key);
+    if (err == -EFAULT)
+        return 0;   /* Not present, so nobody can be waiting on it */
+    if (err != 0)
+        return err;
+
+    futex_bucket_t *b = futex_hash(&key);
+    int woken = 0;
+
+    /* Any preemption the wakeups cause waits until the bucket is unlocked */
+    lock_scheduler();
+    spinlock_irq_acquire(&b->lock);
+
+    wait_queue_entry_t *e = b->waiters.head;
+    while (e != NULL && woken < nr) {
+        futex_q_t *q = container_of(e, futex_q_t, entry);
+        e = e->next;
+
+        if (futex_key_match(&q->key, &key) && (q->bitset & bitset)) {
+            wake_q(b, q);
+            woken++;
+        }
+    }
+
+    spinlock_irq_release(&b->lock);
+    unlock_scheduler();
+
+    return woken;
+}
+
+int futex_requeue(uint32_t *uaddr, uint32_t *uaddr2, int nr_wake, int nr_requeue,
+                  bool cmp, uint32_t cmpval, int flags) {
+    if (nr_wake < 0 || nr_requeue < 0)
+        return -EINVAL;
+
+    if (cmp)
+        (void)*(volatile uint32_t *)uaddr;
+
+    futex_key_t key1, key2;
+    int err = futex_get_key(uaddr, flags, &key1);
+    if (err == 0)
+        err = futex_get_key(uaddr2, flags, &key2);
+    if (err != 0)
+        return err;
+
+    futex_bucket_t *b1 = futex_hash(&key1);
+    futex_bucket_t *b2 = futex_hash(&key2);
+
+    uint32_t cur = cmpval;
+    for (;;) {
+        lock_scheduler();
+        double_bucket_lock(b1, b2);
+
+        if (!cmp || futex_read_locked(uaddr, &cur) == 0)
+            break;
+
+        double_bucket_unlock(b1, b2);
+        unlock_scheduler();
+        (void)*(volatile uint32_t *)uaddr;
+    }
+
+    if (cur != cmpval) {
+        double_bucket_unlock(b1, b2);
+        unlock_scheduler();
+        return -EAGAIN;
+    }
+
+    int woken = 0, moved = 0;
+    wait_queue_entry_t *e = b1->waiters.head;
+
+    while (e != NULL && (woken < nr_wake || moved < nr_requeue)) {
+        futex_q_t *q = container_of(e, futex_q_t, entry);
+        e = e->next;
+
+        if (!futex_key_match(&q->key, &key1))
+            continue;
+
+        if (woken < nr_wake) {
+            wake_q(b1, q);
+            woken++;
+        } else {
+            /* The waiter finds its new bucket through q->bucket */
+            queue_unlink(b1, q);
+            q->key = key2;
+            queue_insert(b2, q);
+            moved++;
+        }
+    }
+
+    double_bucket_unlock(b1, b2);
+    unlock_scheduler();
+
+    return woken + moved;
+}
@@ -1,6 +1,8 @@
 #include <arch/x86_64/atomic.h>
+#include <arch/x86_64/tsc.h>
 
 #include <core/mutex.h>
+#include <core/rcu.h>
 #include <core/scheduler.h>
 
 #include <mm/heap.h>
@@ -27,8 +29,49 @@ void mutex_init(mutex_t *mutex)
     atomic_store_64(&mutex->entries, 0);
     atomic_store_64(&mutex->exits, 0);
     atomic_store_32((uint32_t*)&mutex->queue_lock, 0);
+    mutex->spin = true;
     mutex->wait_queue = NULL;
     mutex->owner = NULL;
+    mutex->spin_acquires = 0;
+    mutex->sleep_acquires = 0;
+}
+
+void mutex_set_spin(mutex_t *mutex, bool spin)
+{
+    mutex->spin = spin;
+}
+
+static inline bool owner_on_other_cpu(tcb_t *owner, tcb_t *self)
+{
+    return owner->on_cpu && owner->state == TASK_STATE_RUNNING && owner->cpu != self->cpu;
+}
+
+/* Wait for our ticket without sleeping; false once that stops paying off */
+static bool mutex_spin_on_owner(mutex_t *mutex, uint64_t my_ticket, tcb_t *self)
+{
+    uint64_t deadline = rdtsc() + ns_to_tsc(MUTEX_SPIN_BUDGET_NS);
+    bool acquired = true;
+
+    /* The owner may unlock, exit and be reaped; RCU keeps its tcb around */
+    rcu_read_lock();
+
+    while (atomic_load_acquire_64(&mutex->exits) != my_ticket) {
+        tcb_t *owner = __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED);
+
+        /*
+         * A blocked or preempted owner won't release soon. NULL is a
+         * handoff to a ticket ahead of ours; the budget bounds that wait.
+         */
+        if ((owner != NULL && !owner_on_other_cpu(owner, self)) || rdtsc() >= deadline) {
+            acquired = false;
+            break;
+        }
+
+        cpu_pause();
+    }
+
+    rcu_read_unlock();
+    return acquired;
 }
 
 void mutex_lock(mutex_t *mutex)
@@ -56,6 +99,15 @@ void mutex_lock(mutex_t *mutex)
     }
 
     tcb_t *task = get_current_task();
+
+    /* The owner is running elsewhere: a short spin beats two context switches */
+    if (mutex->spin && mutex_spin_on_owner(mutex, my_ticket, task)) {
+        mutex->owner = task;
+        mutex->spin_acquires++;
+        barrier();  /* Prevent critical section from moving up */
+        return;
+    }
+
     task->wait_reason = my_ticket;
     task->wait_data = NULL;
 
@@ -101,6 +153,7 @@ void mutex_lock(mutex_t *mutex)
     queue_lock_release(&mutex->queue_lock);
 
     mutex->owner = task;
+    mutex->sleep_acquires++;
     barrier();  /* Prevent critical section from moving up */
 }
 
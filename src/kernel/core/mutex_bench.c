@@ -0,0 +1,126 @@
+#include <arch/x86_64/smp.h>
+#include <arch/x86_64/tsc.h>
+
+#include <core/mutex.h>
+#include <core/scheduler.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+/*
+ * Every contender hammers one mutex with a short critical section, once
+ * with optimistic spinning and once with sleep-only waiting. Built only
+ * with -DMUTEX_BENCHMARK; it takes a few hundred milliseconds of boot.
+ */
+
+#define BENCH_MAX_THREADS   4
+#define BENCH_ITERATIONS    20000
+#define BENCH_HOLD_PAUSES   32      /* Work inside the critical section */
+#define BENCH_GAP_PAUSES    64      /* Work between acquisitions */
+
+static mutex_t bench_mutex = MUTEX_INIT;
+static volatile uint64_t bench_counter;
+static volatile uint32_t bench_running;
+static tcb_t *bench_controller;
+
+static inline void bench_pause(uint32_t n) {
+    for (uint32_t i = 0; i < n; i++)
+        __asm__ volatile("pause" ::: "memory");
+}
+
+static void bench_worker(void) {
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++) {
+        mutex_lock(&bench_mutex);
+        bench_counter++;
+        bench_pause(BENCH_HOLD_PAUSES);
+        mutex_unlock(&bench_mutex);
+
+        bench_pause(BENCH_GAP_PAUSES);
+    }
+
+    if (__atomic_sub_fetch(&bench_running, 1, __ATOMIC_ACQ_REL) == 0)
+        unblock_task(bench_controller);
+}
+
+static uint32_t bench_online_cpus(uint32_t *ids) {
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < smp_get_cpu_count() && n < BENCH_MAX_THREADS; i++) {
+        cpu_info_t *cpu = smp_get_cpu(i);
+        if (cpu != NULL && cpu->online)
+            ids[n++] = cpu->cpu_id;
+    }
+    return n;
+}
+
+static void bench_round(bool spin, const uint32_t *cpus, uint32_t ncpus, uint32_t nthreads) {
+    sched_stats_t before, after;
+
+    mutex_init(&bench_mutex);
+    mutex_set_spin(&bench_mutex, spin);
+    bench_counter = 0;
+    bench_running = nthreads;
+
+    tcb_t *threads[BENCH_MAX_THREADS];
+    for (uint32_t i = 0; i < nthreads; i++) {
+        threads[i] = create_kernel_task_paused(bench_worker, "mutex-bench", PRIORITY_NORMAL);
+        if (threads[i] == NULL) {
+            eerror("mutex_bench: cannot create worker %u\n", i);
+            bench_running -= nthreads - i;
+            nthreads = i;
+            break;
+        }
+
+        cpumask_t mask;
+        cpumask_clear(&mask);
+        cpumask_set(&mask, cpus[i % ncpus]);
+        task_set_affinity(threads[i], &mask);
+    }
+
+    if (nthreads == 0)
+        return;
+
+    scheduler_get_stats(&before);
+    uint64_t start = rdtsc();
+
+    for (uint32_t i = 0; i < nthreads; i++)
+        task_start(threads[i]);
+
+    /* The last worker out wakes us; an early wakeup is left pending */
+    while (__atomic_load_n(&bench_running, __ATOMIC_ACQUIRE) != 0)
+        block_task(TASK_STATE_WAITING_EVENT);
+
+    uint64_t elapsed_ns = tsc_to_ns(rdtsc() - start);
+    scheduler_get_stats(&after);
+
+    uint64_t ops = (uint64_t)nthreads * BENCH_ITERATIONS;
+
+    printk("mutex_bench: %s: %u threads, %lu ops in %lu us, %lu ns/op, "
+           "%lu switches, %lu spun, %lu slept%s\n",
+           spin ? "spin " : "sleep", nthreads, ops, elapsed_ns / 1000,
+           elapsed_ns / ops, after.total_switches - before.total_switches,
+           bench_mutex.spin_acquires, bench_mutex.sleep_acquires,
+           bench_counter == ops ? "" : " (COUNTER MISMATCH)");
+}
+
+static void bench_thread(void) {
+    uint32_t cpus[BENCH_MAX_THREADS];
+    uint32_t ncpus = bench_online_cpus(cpus);
+    if (ncpus == 0)
+        return;
+
+    /* At least two contenders, even if they have to share a CPU */
+    uint32_t nthreads = (ncpus < 2) ? 2 : ncpus;
+
+    bench_round(false, cpus, ncpus, nthreads);
+    bench_round(true, cpus, ncpus, nthreads);
+}
+
+void mutex_benchmark(void) {
+    bench_controller = create_kernel_task_paused(bench_thread, "mutex-bench", PRIORITY_NORMAL);
+    if (bench_controller == NULL) {
+        eerror("mutex_bench: cannot create controller\n");
+        return;
+    }
+    task_start(bench_controller);
+}
@@ -1,8 +1,11 @@
 #include <arch/x86_64/switch.h>
+#include <arch/x86_64/fpu.h>
 #include <arch/x86_64/mmu.h>
 
 #include <core/scheduler.h>
 #include <core/proc.h>
+#include <core/rcu.h>
+#include <core/spinlock.h>
 
 #include <fs/vfs.h>
 
@@ -16,9 +19,27 @@
 
 #include <klibc/string.h>
 
+/* Readers walk process_list under RCU; writers hold process_list_lock */
 static pcb_t *process_list = NULL;
+static spinlock_irq_t process_list_lock = SPINLOCK_IRQ_INIT_NAMED("process_list_lock");
 static pcb_t *init_process = NULL;
-static uint64_t next_pid = 1;
+
+/* PID -> pcb; chains are read under RCU and changed under process_list_lock */
+static pcb_t *pid_hash[PROC_PID_HASH_SIZE];
+
+/*
+ * PID bitmap, one bit per PID in use, plus a summary bit per bitmap word
+ * that is completely full, so allocation skips full words 64 at a time.
+ * Allocation continues after the last PID handed out, so a freed PID
+ * isn't reused straight away.
+ */
+#define PID_WORDS           (PROC_PID_MAX / 64)
+#define PID_SUMMARY_WORDS   ((PID_WORDS + 63) / 64)
+
+static spinlock_irq_t pid_lock = SPINLOCK_IRQ_INIT_NAMED("pid_lock");
+static uint64_t pid_map[PID_WORDS];
+static uint64_t pid_full[PID_SUMMARY_WORDS];
+static pid_t pid_last;
 
 static pcb_t *current_process = NULL;
 
@@ -209,12 +230,13 @@ int proc_signal_send(pcb_t *proc, int signum) {
 }
 
 int proc_signal_send_by_pid(pid_t pid, int signum) {
+    rcu_read_lock();
+
     pcb_t *proc = proc_find_by_pid(pid);
-    if (proc == NULL) {
-        return -1;
-    }
+    int ret = (proc != NULL) ? proc_signal_send(proc, signum) : -1;
 
-    return proc_signal_send(proc, signum);
+    rcu_read_unlock();
+    return ret;
 }
 
 int proc_signal_set_handler(pcb_t *proc, int signum, void (*handler)(int)) {
@@ -306,6 +328,77 @@ int proc_kill(pid_t pid, int signal) {
     return proc_signal_send_by_pid(pid, signal);
 }
 
+static int pid_find_free_word(uint32_t from) {
+    /* NOTE: Caller must hold pid_lock; first word >= from with a free bit */
+    for (uint32_t s = from / 64; s < PID_SUMMARY_WORDS; s++) {
+        uint64_t open = ~pid_full[s];
+        if (s == from / 64)
+            open &= ~0ULL << (from % 64);
+        if (open != 0)
+            return (int)(s * 64 + (uint32_t)__builtin_ctzll(open));
+    }
+    return -1;
+}
+
+static int pid_find_free(uint32_t from) {
+    /* NOTE: Caller must hold pid_lock */
+    uint32_t w = from / 64;
+
+    uint64_t free = ~pid_map[w] & (~0ULL << (from % 64));
+    if (free != 0)
+        return (int)(w * 64 + (uint32_t)__builtin_ctzll(free));
+
+    int next = (w + 1 < PID_WORDS) ? pid_find_free_word(w + 1) : -1;
+    if (next < 0)
+        return -1;
+    return next * 64 + __builtin_ctzll(~pid_map[next]);
+}
+
+static pid_t pid_alloc(void) {
+    spinlock_irq_acquire(&pid_lock);
+
+    /* PID 0 is never handed out */
+    pid_map[0] |= 1;
+
+    uint32_t start = (uint32_t)pid_last + 1;
+    if (start >= PROC_PID_MAX)
+        start = 1;
+
+    int pid = pid_find_free(start);
+    if (pid < 0)
+        pid = pid_find_free(1);
+
+    if (pid > 0) {
+        uint32_t w = (uint32_t)pid / 64;
+        pid_map[w] |= 1ULL << (pid % 64);
+        if (pid_map[w] == ~0ULL)
+            pid_full[w / 64] |= 1ULL << (w % 64);
+        pid_last = pid;
+    }
+
+    spinlock_irq_release(&pid_lock);
+    return (pid > 0) ? (pid_t)pid : 0;
+}
+
+static void pid_free(pid_t pid) {
+    if (pid <= 0 || pid >= PROC_PID_MAX)
+        return;
+
+    uint32_t w = (uint32_t)pid / 64;
+
+    spinlock_irq_acquire(&pid_lock);
+    pid_map[w] &= ~(1ULL << (pid % 64));
+    pid_full[w / 64] &= ~(1ULL << (w % 64));
+    spinlock_irq_release(&pid_lock);
+}
+
+static void free_pcb(pcb_t *proc) {
+    /* Only for a pcb that never made it onto process_list */
+    pid_free(proc->pid);
+    kfree(proc->fd_table);
+    kfree(proc);
+}
+
 static pcb_t *alloc_pcb(const char *name, uint8_t priority) {
     pcb_t *proc = (pcb_t *)kmalloc(sizeof(pcb_t));
     if (proc == NULL) {
@@ -323,7 +416,13 @@ static pcb_t *alloc_pcb(const char *name, uint8_t priority) {
     }
     memset(proc->fd_table, 0, PROC_MAX_FDS * sizeof(file_descriptor_t *));
 
-    proc->pid = next_pid++;
+    proc->pid = pid_alloc();
+    if (proc->pid == 0) {
+        eerror("proc: out of PIDs\n");
+        kfree(proc->fd_table);
+        kfree(proc);
+        return NULL;
+    }
     strncpy(proc->name, name, PROC_NAME_LEN - 1);
     proc->name[PROC_NAME_LEN - 1] = '\0';
 
@@ -393,13 +492,58 @@ static pcb_t *alloc_pcb(const char *name, uint8_t priority) {
     return proc;
 }
 
+static inline pcb_t **pid_bucket(pid_t pid) {
+    /* PIDs are handed out in sequence, so the low bits spread them evenly */
+    return &pid_hash[(uint32_t)pid & (PROC_PID_HASH_SIZE - 1)];
+}
+
 static void add_to_process_list(pcb_t *proc) {
-    lock_scheduler();
+    spinlock_irq_acquire(&process_list_lock);
 
     proc->next = process_list;
-    process_list = proc;
+    rcu_assign_pointer(process_list, proc);
 
-    unlock_scheduler();
+    pcb_t **bucket = pid_bucket(proc->pid);
+    proc->pid_next = *bucket;
+    rcu_assign_pointer(*bucket, proc);
+
+    spinlock_irq_release(&process_list_lock);
+}
+
+static void remove_from_process_list(pcb_t *proc) {
+    spinlock_irq_acquire(&process_list_lock);
+
+    /* proc->next stays intact for readers already standing on proc */
+    for (pcb_t **link = &process_list; *link != NULL; link = &(*link)->next) {
+        if (*link == proc) {
+            rcu_assign_pointer(*link, proc->next);
+            break;
+        }
+    }
+
+    for (pcb_t **link = pid_bucket(proc->pid); *link != NULL; link = &(*link)->pid_next) {
+        if (*link == proc) {
+            rcu_assign_pointer(*link, proc->pid_next);
+            break;
+        }
+    }
+
+    spinlock_irq_release(&process_list_lock);
+}
+
+static void remove_child_from_parent(pcb_t *child) {
+    /* NOTE: Caller must hold lock_scheduler() */
+    pcb_t *parent = child->parent;
+    if (parent == NULL)
+        return;
+
+    for (pcb_t **link = &parent->first_child; *link != NULL; link = &(*link)->next_sibling) {
+        if (*link == child) {
+            *link = child->next_sibling;
+            break;
+        }
+    }
+    child->next_sibling = NULL;
 }
 
 static void add_child_to_parent(pcb_t *parent, pcb_t *child) {
@@ -464,10 +608,10 @@ pcb_t *proc_create_child(pcb_t *parent, const char *name, void (*entry_point)(vo
     char thread_name[32];
     snprintk(thread_name, sizeof(thread_name), "%s-main", name);
 
-    tcb_t *main_thread = create_kernel_task(entry_point, thread_name, priority);
+    tcb_t *main_thread = create_kernel_task_paused(entry_point, thread_name, priority);
     if (main_thread == NULL) {
         epanic("proc", "failed to create main thread");
-        kfree(proc);
+        free_pcb(proc);
         return NULL;
     }
 
@@ -483,6 +627,8 @@ pcb_t *proc_create_child(pcb_t *parent, const char *name, void (*entry_point)(vo
 
     proc->state = PROC_STATE_READY;
 
+    task_start(main_thread);
+
     return proc;
 
 }
@@ -494,7 +640,7 @@ pcb_t *proc_create_user(const char *name, uint64_t entry,
     if (proc == NULL) return NULL;
 
     vm_space_t *space = vmm_create_space();
-    if (space == NULL) { kfree(proc); return NULL; }
+    if (space == NULL) { free_pcb(proc); return NULL; }
     proc->vm_space = space;
 
     uint64_t pml4_phys = mmu_get_pml4_phys((mmu_context_t *)space->mmu_ctx);
@@ -508,10 +654,10 @@ pcb_t *proc_create_user(const char *name, uint64_t entry,
     proc->flags          &= ~PROC_FLAG_KERNEL;
     proc->flags          |=  PROC_FLAG_USER;
 
-    tcb_t *t = create_kernel_task(user_task_trampoline, name, priority);
+    tcb_t *t = create_kernel_task_paused(user_task_trampoline, name, priority);
     if (t == NULL) {
         vmm_destroy_space(space);
-        kfree(proc);
+        free_pcb(proc);
         return NULL;
     }
     t->cr3 = pml4_phys;   /* so switch_to_task loads the right PML4 */
@@ -525,6 +671,8 @@ pcb_t *proc_create_user(const char *name, uint64_t entry,
     add_to_process_list(proc);
     proc->state = PROC_STATE_READY;
 
+    task_start(t);
+
     return proc;
 }
 
@@ -550,8 +698,8 @@ pcb_t *proc_create_user_with_space(const char *name, uint64_t entry,
     proc->flags          &= ~PROC_FLAG_KERNEL;
     proc->flags          |=  PROC_FLAG_USER;
 
-    tcb_t *t = create_kernel_task(user_task_trampoline, name, priority);
-    if (t == NULL) { kfree(proc); return NULL; }
+    tcb_t *t = create_kernel_task_paused(user_task_trampoline, name, priority);
+    if (t == NULL) { free_pcb(proc); return NULL; }
     t->cr3 = pml4_phys;
 
     proc->threads[0]   = t;
@@ -563,6 +711,8 @@ pcb_t *proc_create_user_with_space(const char *name, uint64_t entry,
     add_to_process_list(proc);
     proc->state = PROC_STATE_READY;
 
+    task_start(t);
+
     return proc;
 }
 
@@ -578,8 +728,7 @@ pcb_t *proc_fork(uint64_t user_rip, uint64_t user_rsp, uint64_t user_rflags)
 
     vm_space_t *child_space = vmm_fork_space((vm_space_t *)parent->vm_space);
     if (child_space == NULL) {
-        kfree(child->fd_table);
-        kfree(child);
+        free_pcb(child);
         return NULL;
     }
     child->vm_space = child_space;
@@ -621,16 +770,19 @@ pcb_t *proc_fork(uint64_t user_rip, uint64_t user_rsp, uint64_t user_rflags)
     child->user_stack_virt = parent->user_stack_virt;
     child->user_stack_size = parent->user_stack_size;
 
-    tcb_t *t = create_kernel_task(user_task_trampoline, child->name, child->priority);
+    tcb_t *t = create_kernel_task_paused(user_task_trampoline, child->name, child->priority);
     if (t == NULL) {
         vmm_destroy_space(child_space);
         proc_fd_close_all(child);
-        kfree(child->fd_table);
-        kfree(child);
+        free_pcb(child);
         return NULL;
     }
     t->cr3 = child->cr3;
 
+    /* The child resumes mid-instruction stream, with the parent's registers */
+    if (fpu_copy_current(t) != 0)
+        ewarn("fork: pid %d starts with a clean FPU state", child->pid);
+
     child->threads[0]   = t;
     child->main_thread  = t;
     child->thread_count = 1;
@@ -640,6 +792,8 @@ pcb_t *proc_fork(uint64_t user_rip, uint64_t user_rsp, uint64_t user_rflags)
     add_to_process_list(child);
     child->state = PROC_STATE_READY;
 
+    task_start(t);
+
     veinfo("fork: pid %lu -> child pid %lu (rip=0x%lx)",
            parent->pid, child->pid, user_rip);
 
@@ -651,7 +805,7 @@ tcb_t *proc_add_thread(pcb_t *proc, void (*entry_point)(void), const char *threa
         return NULL;
     }
 
-    tcb_t *thread = create_kernel_task(entry_point, thread_name, proc->priority);
+    tcb_t *thread = create_kernel_task_paused(entry_point, thread_name, proc->priority);
     if (thread == NULL) {
         return NULL;
     }
@@ -665,6 +819,7 @@ tcb_t *proc_add_thread(pcb_t *proc, void (*entry_point)(void), const char *threa
 
     unlock_scheduler();
 
+    task_start(thread);
 
     return thread;
 }
@@ -774,36 +929,40 @@ pcb_t *proc_get_current(void) {
         return (pcb_t *)current_thread->owner_proc;
     }
 
-    lock_scheduler();
+    rcu_read_lock();
 
-    pcb_t *proc = process_list;
+    pcb_t *proc = rcu_dereference(process_list);
     while (proc != NULL) {
         for (uint32_t i = 0; i < proc->thread_count; i++) {
             if (proc->threads[i] == current_thread) {
-                unlock_scheduler();
+                rcu_read_unlock();
                 return proc;
             }
         }
-        proc = proc->next;
+        proc = rcu_dereference(proc->next);
     }
 
-    unlock_scheduler();
+    rcu_read_unlock();
     return NULL;
 }
 
 pcb_t *proc_find_by_pid(pid_t pid) {
-    lock_scheduler();
+    /* NOTE: The result only stays valid inside the caller's own rcu_read_lock() */
+    if (pid <= 0 || pid >= PROC_PID_MAX)
+        return NULL;
+
+    rcu_read_lock();
 
-    pcb_t *proc = process_list;
+    pcb_t *proc = rcu_dereference(*pid_bucket(pid));
     while (proc != NULL) {
         if (proc->pid == pid) {
-            unlock_scheduler();
+            rcu_read_unlock();
             return proc;
         }
-        proc = proc->next;
+        proc = rcu_dereference(proc->pid_next);
     }
 
-    unlock_scheduler();
+    rcu_read_unlock();
     return NULL;
 }
 
@@ -828,15 +987,22 @@ int proc_waitpid(pid_t pid, int *status, int options) {
 
     lock_scheduler();
 
-    pcb_t *child = current->first_child;
     pcb_t *zombie_child = NULL;
 
-    while (child != NULL) {
-        if ((pid == 0 || child->pid == pid) && child->state == PROC_STATE_ZOMBIE) {
+    if (pid > 0) {
+        /* A specific child: straight from the PID hash */
+        pcb_t *child = proc_find_by_pid(pid);
+        if (child != NULL && child->parent == current && child->state == PROC_STATE_ZOMBIE)
             zombie_child = child;
-            break;
+    } else if (pid == 0) {
+        pcb_t *child = current->first_child;
+        while (child != NULL) {
+            if (child->state == PROC_STATE_ZOMBIE) {
+                zombie_child = child;
+                break;
+            }
+            child = child->next_sibling;
         }
-        child = child->next_sibling;
     }
 
     if (zombie_child != NULL) {
@@ -850,10 +1016,12 @@ int proc_waitpid(pid_t pid, int *status, int options) {
         zombie_child->waited_on = true;
         zombie_child->state = PROC_STATE_TERMINATED;
 
-        zombie_child->next = zombie_list;
+        zombie_child->zombie_next = zombie_list;
         zombie_list = zombie_child;
 
         unlock_scheduler();
+
+        proc_reap_zombies();
         return child_pid;
     }
 
@@ -868,6 +1036,25 @@ int proc_waitpid(pid_t pid, int *status, int options) {
     return proc_waitpid(pid, status, options);
 }
 
+static void pcb_free_rcu(rcu_head_t *head) {
+    pcb_t *proc = container_of(head, pcb_t, rcu);
+
+    for (uint32_t i = 0; i < proc->thread_count; i++)
+        task_release(proc->threads[i]);
+
+    for (int i = 0; i < PROC_MAX_FDS; i++) {
+        if (proc->fd_table[i] != NULL) {
+            if (proc->fd_table[i]->f_path != NULL)
+                kfree(proc->fd_table[i]->f_path);
+            kfree(proc->fd_table[i]);
+        }
+    }
+
+    pid_free(proc->pid);
+    kfree(proc->fd_table);
+    kfree(proc);
+}
+
 void proc_reap_zombies(void) {
     lock_scheduler();
 
@@ -875,24 +1062,17 @@ void proc_reap_zombies(void) {
     pcb_t *proc = zombie_list;
 
     while (proc != NULL) {
-        pcb_t *next = proc->next;
+        pcb_t *next = proc->zombie_next;
 
         if (proc->state == PROC_STATE_TERMINATED && proc->waited_on) {
-            /* Really dead now, free it */
+            /* Really dead now: unlink it, free it once no reader can see it */
             *prev = next;
 
-            for (int i = 0; i < PROC_MAX_FDS; i++) {
-                if (proc->fd_table[i] != NULL) {
-                    if (proc->fd_table[i]->f_path != NULL)
-                        kfree(proc->fd_table[i]->f_path);
-                    kfree(proc->fd_table[i]);
-                }
-            }
-
-            kfree(proc->fd_table);
-            kfree(proc);
+            remove_child_from_parent(proc);
+            remove_from_process_list(proc);
+            call_rcu(&proc->rcu, pcb_free_rcu);
         } else {
-            prev = &proc->next;
+            prev = &proc->zombie_next;
         }
 
         proc = next;
@@ -909,7 +1089,7 @@ int proc_count_zombies(void) {
 
     while (proc != NULL) {
         count++;
-        proc = proc->next;
+        proc = proc->zombie_next;
     }
 
     unlock_scheduler();
@@ -1180,15 +1360,15 @@ void proc_update_cpu_time(pcb_t *proc) {
 void proc_for_each(proc_iter_fn fn, void *data) {
     if (fn == NULL) return;
 
-    lock_scheduler();
+    rcu_read_lock();
 
-    pcb_t *proc = process_list;
+    pcb_t *proc = rcu_dereference(process_list);
     while (proc != NULL) {
         fn(proc, data);
-        proc = proc->next;
+        proc = rcu_dereference(proc->next);
     }
 
-    unlock_scheduler();
+    rcu_read_unlock();
 }
 
 void proc_for_each_child(pcb_t *parent, proc_iter_fn fn, void *data) {
@@ -1336,17 +1516,17 @@ void proc_dump_credentials(pcb_t *proc) {
 void proc_dump_all(void) {
     printk("process table:\n");
 
-    lock_scheduler();
+    rcu_read_lock();
 
     int count = 0;
-    pcb_t *proc = process_list;
+    pcb_t *proc = rcu_dereference(process_list);
     while (proc != NULL) {
         proc_dump_info(proc);
-        proc = proc->next;
+        proc = rcu_dereference(proc->next);
         count++;
     }
 
-    unlock_scheduler();
+    rcu_read_unlock();
 
     printk("total processes: %d\n", count);
 
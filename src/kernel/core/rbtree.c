@@ -0,0 +1,238 @@
+#include <core/rbtree.h>
+
+static inline bool is_red(const rb_node_t *node) {
+    return node != NULL && node->color == RB_RED;
+}
+
+static inline bool is_black(const rb_node_t *node) {
+    return node == NULL || node->color == RB_BLACK;
+}
+
+static void replace_child(rb_root_t *root, rb_node_t *parent,
+                          rb_node_t *old, rb_node_t *new) {
+    if (parent == NULL)
+        root->node = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+}
+
+static void rotate_left(rb_root_t *root, rb_node_t *node) {
+    rb_node_t *right = node->right;
+
+    node->right = right->left;
+    if (right->left != NULL)
+        right->left->parent = node;
+
+    right->parent = node->parent;
+    replace_child(root, node->parent, node, right);
+
+    right->left = node;
+    node->parent = right;
+}
+
+static void rotate_right(rb_root_t *root, rb_node_t *node) {
+    rb_node_t *left = node->left;
+
+    node->left = left->right;
+    if (left->right != NULL)
+        left->right->parent = node;
+
+    left->parent = node->parent;
+    replace_child(root, node->parent, node, left);
+
+    left->right = node;
+    node->parent = left;
+}
+
+void rb_insert_color(rb_root_t *root, rb_node_t *node, bool leftmost) {
+    if (leftmost)
+        root->leftmost = node;
+
+    rb_node_t *parent;
+
+    while (is_red(parent = node->parent)) {
+        rb_node_t *gparent = parent->parent;
+
+        if (parent == gparent->left) {
+            rb_node_t *uncle = gparent->right;
+
+            if (is_red(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right) {
+                rotate_left(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rotate_right(root, gparent);
+        } else {
+            rb_node_t *uncle = gparent->left;
+
+            if (is_red(uncle)) {
+                parent->color = RB_BLACK;
+                uncle->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left) {
+                rotate_right(root, parent);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rotate_left(root, gparent);
+        }
+    }
+
+    root->node->color = RB_BLACK;
+}
+
+/* Restore black height after removing a black node; node may be NULL */
+static void erase_fixup(rb_root_t *root, rb_node_t *node, rb_node_t *parent) {
+    while (node != root->node && is_black(node)) {
+        if (node == parent->left) {
+            rb_node_t *sibling = parent->right;
+
+            if (is_red(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rotate_left(root, parent);
+                sibling = parent->right;
+            }
+
+            if (is_black(sibling->left) && is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (is_black(sibling->right)) {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rotate_right(root, sibling);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rotate_left(root, parent);
+            node = root->node;
+        } else {
+            rb_node_t *sibling = parent->left;
+
+            if (is_red(sibling)) {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rotate_right(root, parent);
+                sibling = parent->left;
+            }
+
+            if (is_black(sibling->left) && is_black(sibling->right)) {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (is_black(sibling->left)) {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rotate_left(root, sibling);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rotate_right(root, parent);
+            node = root->node;
+        }
+    }
+
+    if (node != NULL)
+        node->color = RB_BLACK;
+}
+
+void rb_erase(rb_root_t *root, rb_node_t *node) {
+    if (root->leftmost == node)
+        root->leftmost = rb_next(node);
+
+    rb_node_t *child;
+    rb_node_t *parent;
+    uint8_t removed_color;
+
+    if (node->left == NULL || node->right == NULL) {
+        child = (node->left != NULL) ? node->left : node->right;
+        parent = node->parent;
+        removed_color = node->color;
+
+        if (child != NULL)
+            child->parent = parent;
+        replace_child(root, parent, node, child);
+    } else {
+        /* Two children: splice out the successor and put it in node's place */
+        rb_node_t *succ = node->right;
+        while (succ->left != NULL)
+            succ = succ->left;
+
+        child = succ->right;
+        removed_color = succ->color;
+
+        if (succ->parent == node) {
+            parent = succ;
+        } else {
+            parent = succ->parent;
+            parent->left = child;
+            if (child != NULL)
+                child->parent = parent;
+
+            succ->right = node->right;
+            node->right->parent = succ;
+        }
+
+        succ->left = node->left;
+        node->left->parent = succ;
+
+        succ->parent = node->parent;
+        succ->color = node->color;
+        replace_child(root, node->parent, node, succ);
+    }
+
+    if (removed_color == RB_BLACK)
+        erase_fixup(root, child, parent);
+
+    node->parent = NULL;
+    node->left = NULL;
+    node->right = NULL;
+}
+
+rb_node_t *rb_next(const rb_node_t *node) {
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL)
+            node = node->left;
+        return (rb_node_t *)node;
+    }
+
+    rb_node_t *parent;
+    while ((parent = node->parent) != NULL && node == parent->right)
+        node = parent;
+
+    return parent;
+}
@@ -0,0 +1,117 @@
+#include <arch/x86_64/smp.h>
+
+#include <core/rcu.h>
+#include <core/scheduler.h>
+#include <core/spinlock.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+/* Bumped only by the owning CPU, sampled by grace-period waiters */
+static volatile uint64_t rcu_qs_count[SMP_MAX_CPUS];
+
+static spinlock_irq_t rcu_cb_lock = SPINLOCK_IRQ_INIT_NAMED("rcu_cb_lock");
+static rcu_head_t *rcu_cb_head;
+static rcu_head_t *rcu_cb_tail;
+static tcb_t *rcu_gp_task;
+static bool rcu_gp_idle;
+
+void rcu_note_qs(uint32_t cpu_id) {
+    if (cpu_id < SMP_MAX_CPUS)
+        __atomic_store_n(&rcu_qs_count[cpu_id], rcu_qs_count[cpu_id] + 1, __ATOMIC_RELEASE);
+}
+
+static bool cpu_is_self(uint32_t cpu_id) {
+    /* Even if we migrate right after, we were just running there unlocked */
+    cpu_info_t *cpu = smp_get_current_cpu();
+    return cpu != NULL && cpu->cpu_id == cpu_id;
+}
+
+void synchronize_rcu(void) {
+    uint32_t ncpus = smp_get_cpu_count();
+    uint64_t snap[SMP_MAX_CPUS];
+
+    if (ncpus > SMP_MAX_CPUS)
+        ncpus = SMP_MAX_CPUS;
+
+    for (uint32_t i = 0; i < ncpus; i++)
+        snap[i] = __atomic_load_n(&rcu_qs_count[i], __ATOMIC_ACQUIRE);
+
+    /* Unlinks done before we got here are visible to every later reader */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (uint32_t i = 0; i < ncpus; i++) {
+        cpu_info_t *cpu = smp_get_cpu(i);
+        if (cpu == NULL || !cpu->online)
+            continue;
+
+        while (__atomic_load_n(&rcu_qs_count[i], __ATOMIC_ACQUIRE) == snap[i]) {
+            /* We aren't in a read-side section, so our own CPU is quiescent */
+            if (cpu_is_self(i))
+                break;
+
+            /* A busy or tickless CPU may not schedule for a while; make it */
+            scheduler_kick_cpu(i);
+            sleep_ms(1);
+        }
+    }
+}
+
+void call_rcu(rcu_head_t *head, rcu_callback_t func) {
+    head->next = NULL;
+    head->func = func;
+
+    spinlock_irq_acquire(&rcu_cb_lock);
+    if (rcu_cb_tail == NULL)
+        rcu_cb_head = head;
+    else
+        rcu_cb_tail->next = head;
+    rcu_cb_tail = head;
+
+    bool wake = rcu_gp_idle;
+    rcu_gp_idle = false;
+    spinlock_irq_release(&rcu_cb_lock);
+
+    if (wake)
+        unblock_task(rcu_gp_task);
+}
+
+static void rcu_gp_thread(void) {
+    for (;;) {
+        spinlock_irq_acquire(&rcu_cb_lock);
+
+        rcu_head_t *list = rcu_cb_head;
+        rcu_cb_head = NULL;
+        rcu_cb_tail = NULL;
+
+        if (list == NULL) {
+            rcu_gp_idle = true;
+            spinlock_irq_release(&rcu_cb_lock);
+
+            /* A call_rcu() in between leaves a pending wakeup */
+            block_task(TASK_STATE_WAITING_EVENT);
+            continue;
+        }
+
+        spinlock_irq_release(&rcu_cb_lock);
+
+        /* Everything in the batch was unlinked before this grace period */
+        synchronize_rcu();
+
+        while (list != NULL) {
+            rcu_head_t *head = list;
+            list = head->next;
+            head->func(head);
+        }
+    }
+}
+
+void rcu_init(void) {
+    ebegin("Starting RCU");
+
+    rcu_gp_task = create_kernel_task_paused(rcu_gp_thread, "rcu_gp", PRIORITY_HIGH);
+    if (rcu_gp_task != NULL)
+        task_start(rcu_gp_task);
+
+    eend(rcu_gp_task == NULL ? -1 : 0, NULL);
+}
@@ -0,0 +1,72 @@
+#include <arch/x86_64/atomic.h>
+#include <arch/x86_64/irqflags.h>
+
+#include <core/rwlock.h>
+
+#include <mm/mmu.h>
+
+static inline void cpu_pause(void)
+{
+    __asm__ volatile("pause" ::: "memory");
+}
+
+void rwlock_init(rwlock_t *lock)
+{
+    atomic_store_32(&lock->state, 0);
+    lock->flags = 0;
+}
+
+uint64_t rwlock_read_acquire(rwlock_t *lock)
+{
+    uint64_t flags = irq_save();
+
+    for (;;) {
+        uint32_t state = atomic_load_acquire_32(&lock->state);
+
+        if ((state & (RWLOCK_WRITER | RWLOCK_WAITING)) == 0 &&
+            atomic_compare_exchange_32(&lock->state, &state, state + 1))
+            return flags;
+
+        /* Interrupts are off; a writer may be waiting on our TLB ack */
+        mmu_tlb_shootdown_poll();
+        cpu_pause();
+    }
+}
+
+void rwlock_read_release(rwlock_t *lock, uint64_t flags)
+{
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
+
+void rwlock_write_acquire(rwlock_t *lock)
+{
+    uint64_t flags = irq_save();
+
+    for (;;) {
+        uint32_t state = atomic_load_acquire_32(&lock->state);
+
+        /* Free apart from (possibly our own) waiting bit */
+        if ((state & ~RWLOCK_WAITING) == 0 &&
+            atomic_compare_exchange_32(&lock->state, &state, RWLOCK_WRITER))
+            break;
+
+        /* Cleared whenever a writer gets in, so keep re-announcing */
+        if ((state & RWLOCK_WAITING) == 0)
+            __atomic_fetch_or(&lock->state, RWLOCK_WAITING, __ATOMIC_RELAXED);
+
+        mmu_tlb_shootdown_poll();
+        cpu_pause();
+    }
+
+    lock->flags = flags;
+}
+
+void rwlock_write_release(rwlock_t *lock)
+{
+    uint64_t flags = lock->flags;
+
+    /* Keeps a WAITING bit another writer set meanwhile */
+    __atomic_fetch_and(&lock->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
@@ -0,0 +1,243 @@
+#include <core/sched_class.h>
+#include <core/proc.h>
+
+#include <video/printk.h>
+
+#include <klibc/errno.h>
+
+/*
+ * Partitioned EDF: a deadline task is admitted onto one CPU and never
+ * migrates, so the per-CPU bandwidth test is all EDF needs. Budgets are
+ * hard CBS reservations: a task that uses up its runtime is throttled
+ * until its next period instead of eating into everyone else's.
+ */
+
+static inline bool time_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static inline tcb_t *node_to_task(rb_node_t *node) {
+    return node ? container_of(node, tcb_t, run_node) : NULL;
+}
+
+static inline uint64_t dl_bandwidth(uint64_t runtime, uint64_t deadline) {
+    /* Density; equals utilisation for implicit deadlines */
+    return (runtime << SCHED_DL_BW_SHIFT) / deadline;
+}
+
+static inline uint64_t dl_next_period(tcb_t *task) {
+    return task->dl_abs_deadline_ns - task->dl_deadline_ns + task->dl_period_ns;
+}
+
+int sched_dl_admit(sched_rq_t *rq, tcb_t *task, const sched_attr_t *attr) {
+    /* NOTE: Caller must hold rq->lock, rq being task's run queue */
+    uint64_t new_bw = dl_bandwidth(attr->runtime_ns, attr->deadline_ns);
+    uint64_t old_bw = 0;
+
+    if (task->policy == SCHED_POLICY_DEADLINE)
+        old_bw = dl_bandwidth(task->dl_runtime_ns, task->dl_deadline_ns);
+
+    if (rq->dl.total_bw - old_bw + new_bw > SCHED_DL_BW_LIMIT)
+        return -EBUSY;
+
+    rq->dl.total_bw = rq->dl.total_bw - old_bw + new_bw;
+    return 0;
+}
+
+static void replenish(tcb_t *task, uint64_t now) {
+    task->dl_throttled = 0;
+
+    while (task->dl_budget_ns <= 0) {
+        task->dl_abs_deadline_ns += task->dl_period_ns;
+        task->dl_budget_ns += (int64_t)task->dl_runtime_ns;
+    }
+
+    /* Fell too far behind to catch up: start a fresh period */
+    if (time_before(task->dl_abs_deadline_ns, now)) {
+        task->dl_abs_deadline_ns = now + task->dl_deadline_ns;
+        task->dl_budget_ns = (int64_t)task->dl_runtime_ns;
+    }
+}
+
+/* CBS wakeup rule: keep the old deadline only if the leftover budget fits before it */
+static void check_wakeup_deadline(tcb_t *task, uint64_t now) {
+    if (time_before(now, task->dl_abs_deadline_ns)) {
+        uint64_t left = task->dl_abs_deadline_ns - now;
+        uint64_t budget = (task->dl_budget_ns > 0) ? (uint64_t)task->dl_budget_ns : 0;
+
+        if (budget * task->dl_deadline_ns <= left * task->dl_runtime_ns)
+            return;
+    }
+
+    task->dl_abs_deadline_ns = now + task->dl_deadline_ns;
+    task->dl_budget_ns = (int64_t)task->dl_runtime_ns;
+}
+
+static void timeline_insert(sched_dl_rq_t *dl, tcb_t *task) {
+    rb_node_t **link = &dl->timeline.node;
+    rb_node_t *parent = NULL;
+    bool leftmost = true;
+
+    while (*link != NULL) {
+        parent = *link;
+        if (time_before(task->dl_abs_deadline_ns, node_to_task(parent)->dl_abs_deadline_ns)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&task->run_node, parent, link);
+    rb_insert_color(&dl->timeline, &task->run_node, leftmost);
+}
+
+static void throttled_insert(sched_dl_rq_t *dl, tcb_t *task) {
+    uint64_t when = dl_next_period(task);
+    tcb_t **link = &dl->throttled;
+
+    while (*link != NULL && !time_before(when, dl_next_period(*link)))
+        link = &(*link)->next;
+
+    task->next = *link;
+    *link = task;
+}
+
+static void throttled_remove(sched_dl_rq_t *dl, tcb_t *task) {
+    for (tcb_t **link = &dl->throttled; *link != NULL; link = &(*link)->next) {
+        if (*link == task) {
+            *link = task->next;
+            task->next = NULL;
+            return;
+        }
+    }
+}
+
+static void enqueue_dl(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_dl_rq_t *dl = &rq->dl;
+    uint64_t now = get_time_since_boot_ns();
+
+    if (task->dl_throttled && !time_before(now, dl_next_period(task)))
+        replenish(task, now);
+    else if (!task->dl_throttled && (flags & ENQUEUE_WAKEUP))
+        check_wakeup_deadline(task, now);
+
+    if (task->dl_throttled)
+        throttled_insert(dl, task);
+    else
+        timeline_insert(dl, task);
+
+    dl->nr_running++;
+}
+
+static void dequeue_dl(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_dl_rq_t *dl = &rq->dl;
+    (void)flags;
+
+    if (task->dl_throttled)
+        throttled_remove(dl, task);
+    else
+        rb_erase(&dl->timeline, &task->run_node);
+
+    dl->nr_running--;
+}
+
+static tcb_t *pick_next_dl(sched_rq_t *rq) {
+    return node_to_task(rb_first(&rq->dl.timeline));
+}
+
+static void update_curr_dl(sched_rq_t *rq, tcb_t *curr, uint64_t delta_ns) {
+    if (curr->dl_throttled)
+        return;
+
+    curr->dl_budget_ns -= (int64_t)delta_ns;
+    if (curr->dl_budget_ns <= 0) {
+        /* Requeued onto the throttled list when it leaves the CPU */
+        curr->dl_throttled = 1;
+        rq->stats.dl_throttles++;
+    }
+}
+
+static uint64_t time_slice_dl(sched_rq_t *rq, tcb_t *task) {
+    (void)rq;
+
+    /* Slice expiry is what throttles a task at the end of its budget */
+    if (task->dl_budget_ns < (int64_t)SCHED_TIMER_MIN_NS)
+        return SCHED_TIMER_MIN_NS;
+    return (uint64_t)task->dl_budget_ns;
+}
+
+static bool check_preempt_dl(tcb_t *curr, tcb_t *task) {
+    return time_before(task->dl_abs_deadline_ns, curr->dl_abs_deadline_ns);
+}
+
+static bool tick_dl(sched_rq_t *rq, uint64_t now) {
+    sched_dl_rq_t *dl = &rq->dl;
+    bool woke = false;
+
+    while (dl->throttled != NULL && !time_before(now, dl_next_period(dl->throttled))) {
+        tcb_t *task = dl->throttled;
+        dl->throttled = task->next;
+        task->next = NULL;
+
+        replenish(task, now);
+        timeline_insert(dl, task);
+        woke = true;
+    }
+
+    return woke;
+}
+
+static uint64_t next_event_dl(sched_rq_t *rq) {
+    tcb_t *task = rq->dl.throttled;
+    return (task != NULL) ? dl_next_period(task) : UINT64_MAX;
+}
+
+static void detach_dl(sched_rq_t *rq, tcb_t *task) {
+    rq->dl.total_bw -= dl_bandwidth(task->dl_runtime_ns, task->dl_deadline_ns);
+    task->dl_throttled = 0;
+}
+
+static void dump_dl_task(tcb_t *task, uint64_t now) {
+    printk("    [%lu] %s (runtime=%lu us, period=%lu us, budget=%ld us, deadline in %ld us%s)\n",
+           task->tid, task->name,
+           task->dl_runtime_ns / 1000, task->dl_period_ns / 1000,
+           task->dl_budget_ns / 1000,
+           (int64_t)(task->dl_abs_deadline_ns - now) / 1000,
+           task->dl_throttled ? ", throttled" : "");
+}
+
+static void dump_dl(sched_rq_t *rq) {
+    sched_dl_rq_t *dl = &rq->dl;
+
+    if (dl->nr_running == 0 && dl->total_bw == 0)
+        return;
+
+    uint64_t now = get_time_since_boot_ns();
+
+    printk("\ndeadline tasks (%u queued, bandwidth %lu/%lu):\n",
+           dl->nr_running, dl->total_bw, SCHED_DL_BW_UNIT);
+
+    for (rb_node_t *node = rb_first(&dl->timeline); node != NULL; node = rb_next(node))
+        dump_dl_task(node_to_task(node), now);
+
+    for (tcb_t *task = dl->throttled; task != NULL; task = task->next)
+        dump_dl_task(task, now);
+}
+
+const sched_class_t dl_sched_class = {
+    .name           = "deadline",
+    .strict         = true,
+    .enqueue        = enqueue_dl,
+    .dequeue        = dequeue_dl,
+    .pick_next      = pick_next_dl,
+    .first          = NULL,     /* Admitted onto one CPU, never migrated */
+    .next           = NULL,
+    .update_curr    = update_curr_dl,
+    .time_slice     = time_slice_dl,
+    .check_preempt  = check_preempt_dl,
+    .tick           = tick_dl,
+    .next_event     = next_event_dl,
+    .detach         = detach_dl,
+    .dump           = dump_dl,
+};
@@ -0,0 +1,178 @@
+#include <core/sched_class.h>
+#include <core/proc.h>
+
+#include <video/printk.h>
+
+/* Nice -20..19 to load weight; each step is roughly 10% of CPU time */
+static const uint32_t nice_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+uint32_t sched_prio_to_weight(uint8_t priority) {
+    /* PRIORITY_NORMAL is nice 0; six priority levels per nice step */
+    int nice = ((int)PRIORITY_NORMAL - (int)priority) / 6;
+
+    if (nice < -20)
+        nice = -20;
+    if (nice > 19)
+        nice = 19;
+
+    return nice_to_weight[nice + 20];
+}
+
+/* vruntime wraps; compare through the signed difference */
+static inline bool vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static inline tcb_t *node_to_task(rb_node_t *node) {
+    return node ? container_of(node, tcb_t, run_node) : NULL;
+}
+
+static void update_min_vruntime(sched_fair_rq_t *cfs, tcb_t *curr) {
+    uint64_t vruntime = curr->vruntime;
+
+    tcb_t *leftmost = node_to_task(rb_first(&cfs->timeline));
+    if (leftmost != NULL && vruntime_before(leftmost->vruntime, vruntime))
+        vruntime = leftmost->vruntime;
+
+    if (vruntime_before(cfs->min_vruntime, vruntime))
+        cfs->min_vruntime = vruntime;
+}
+
+static void place_task(sched_fair_rq_t *cfs, tcb_t *task, int flags) {
+    if (flags & ENQUEUE_NEW) {
+        task->vruntime = cfs->min_vruntime;
+        return;
+    }
+
+    /* Sleepers get a bounded credit, they can't bank runtime while blocked */
+    uint64_t floor = cfs->min_vruntime - SCHED_LATENCY_NS / 2;
+    if (vruntime_before(task->vruntime, floor))
+        task->vruntime = floor;
+}
+
+static void enqueue_fair(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_fair_rq_t *cfs = &rq->fair;
+
+    if (flags & ENQUEUE_MIGRATED)
+        task->vruntime += cfs->min_vruntime;
+    if (flags & (ENQUEUE_WAKEUP | ENQUEUE_NEW))
+        place_task(cfs, task, flags);
+
+    rb_node_t **link = &cfs->timeline.node;
+    rb_node_t *parent = NULL;
+    bool leftmost = true;
+
+    /* Equal keys go right, so ties run in FIFO order */
+    while (*link != NULL) {
+        parent = *link;
+        if (vruntime_before(task->vruntime, node_to_task(parent)->vruntime)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    rb_link_node(&task->run_node, parent, link);
+    rb_insert_color(&cfs->timeline, &task->run_node, leftmost);
+
+    cfs->load_weight += task->weight;
+    cfs->nr_running++;
+}
+
+static void dequeue_fair(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_fair_rq_t *cfs = &rq->fair;
+
+    rb_erase(&cfs->timeline, &task->run_node);
+
+    cfs->load_weight -= task->weight;
+    cfs->nr_running--;
+    (void)flags;
+}
+
+static void migrate_fair(sched_rq_t *rq, tcb_t *task) {
+    /* Carried as an offset, rebased on the destination's min_vruntime */
+    task->vruntime -= rq->fair.min_vruntime;
+}
+
+static tcb_t *pick_next_fair(sched_rq_t *rq) {
+    return node_to_task(rb_first(&rq->fair.timeline));
+}
+
+static tcb_t *first_fair(sched_rq_t *rq) {
+    return node_to_task(rb_first(&rq->fair.timeline));
+}
+
+static tcb_t *next_fair(sched_rq_t *rq, tcb_t *task) {
+    (void)rq;
+    return node_to_task(rb_next(&task->run_node));
+}
+
+static void update_curr_fair(sched_rq_t *rq, tcb_t *curr, uint64_t delta_ns) {
+    curr->vruntime += delta_ns * SCHED_NICE_0_WEIGHT / curr->weight;
+    update_min_vruntime(&rq->fair, curr);
+}
+
+static uint64_t time_slice_fair(sched_rq_t *rq, tcb_t *task) {
+    /* NOTE: task is running, so it is not part of rq->fair yet */
+    sched_fair_rq_t *cfs = &rq->fair;
+    uint64_t nr = cfs->nr_running + 1;
+
+    uint64_t period = SCHED_LATENCY_NS;
+    if (nr > SCHED_LATENCY_NS / SCHED_MIN_GRANULARITY_NS)
+        period = nr * SCHED_MIN_GRANULARITY_NS;
+
+    uint64_t slice = period * task->weight / (cfs->load_weight + task->weight);
+    if (slice < SCHED_MIN_GRANULARITY_NS)
+        slice = SCHED_MIN_GRANULARITY_NS;
+
+    return slice;
+}
+
+static bool check_preempt_fair(tcb_t *curr, tcb_t *task) {
+    return (int64_t)(curr->vruntime - task->vruntime) > (int64_t)SCHED_WAKEUP_GRAN_NS;
+}
+
+static void dump_fair(sched_rq_t *rq) {
+    sched_fair_rq_t *cfs = &rq->fair;
+
+    printk("\nfair timeline (%u tasks, load=%lu, min_vruntime=%lu us):\n",
+           cfs->nr_running, cfs->load_weight, cfs->min_vruntime / 1000);
+
+    int count = 0;
+    for (tcb_t *task = first_fair(rq); task != NULL && count < 20;
+         task = next_fair(rq, task), count++) {
+        printk("    [%lu] %s (prio=%u, weight=%u, vruntime=%lu us, time=%lu ms)\n",
+               task->tid, task->name, task->priority, task->weight,
+               task->vruntime / 1000, task->time_used_ns / 1000000);
+
+        if (task->owner_proc != NULL) {
+            struct pcb *proc = (struct pcb *)task->owner_proc;
+            printk("           PID=%lu", proc->pid);
+        }
+    }
+}
+
+const sched_class_t fair_sched_class = {
+    .name           = "fair",
+    .enqueue        = enqueue_fair,
+    .dequeue        = dequeue_fair,
+    .pick_next      = pick_next_fair,
+    .first          = first_fair,
+    .next           = next_fair,
+    .update_curr    = update_curr_fair,
+    .time_slice     = time_slice_fair,
+    .check_preempt  = check_preempt_fair,
+    .tick           = NULL,
+    .migrate        = migrate_fair,
+    .dump           = dump_fair,
+};
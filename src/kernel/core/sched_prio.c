@@ -0,0 +1,209 @@
+#include <core/sched_class.h>
+#include <core/proc.h>
+
+#include <video/printk.h>
+
+static inline int priority_to_queue(uint8_t priority) {
+    return priority >> 5;  /* Divide by 32 */
+}
+
+static inline int find_highest_priority_queue(sched_prio_rq_t *prq) {
+    if (prq->bitmap == 0)
+        return -1;
+
+    for (int i = NUM_PRIORITY_QUEUES - 1; i >= 0; i--) {
+        if (prq->bitmap & (1 << i))
+            return i;
+    }
+    return -1;
+}
+
+static void link_to_queue(sched_prio_rq_t *prq, tcb_t *task) {
+    task->next = NULL;
+
+    int queue_idx = priority_to_queue(task->priority);
+
+    if (prq->heads[queue_idx] == NULL) {
+        prq->heads[queue_idx] = task;
+        prq->tails[queue_idx] = task;
+        prq->bitmap |= (1 << queue_idx);  /* Mark queue as non-empty */
+    } else {
+        prq->tails[queue_idx]->next = task;
+        prq->tails[queue_idx] = task;
+    }
+}
+
+static void unlink_from_queue(sched_prio_rq_t *prq, int queue_idx, tcb_t *task) {
+    tcb_t *prev = NULL;
+    tcb_t *curr = prq->heads[queue_idx];
+
+    while (curr != NULL && curr != task) {
+        prev = curr;
+        curr = curr->next;
+    }
+    if (curr == NULL)
+        return;
+
+    if (prev == NULL)
+        prq->heads[queue_idx] = task->next;
+    else
+        prev->next = task->next;
+
+    if (prq->tails[queue_idx] == task)
+        prq->tails[queue_idx] = prev;
+
+    if (prq->heads[queue_idx] == NULL)
+        prq->bitmap &= ~(1 << queue_idx);  /* Mark queue as empty */
+
+    task->next = NULL;
+}
+
+static void enqueue_prio(sched_rq_t *rq, tcb_t *task, int flags) {
+    (void)flags;
+
+    task->wait_ticks = 0;  /* Reset aging counter */
+    link_to_queue(&rq->prio, task);
+    rq->prio.nr_running++;
+}
+
+static void dequeue_prio(sched_rq_t *rq, tcb_t *task, int flags) {
+    (void)flags;
+
+    unlink_from_queue(&rq->prio, priority_to_queue(task->priority), task);
+    rq->prio.nr_running--;
+}
+
+static tcb_t *pick_next_prio(sched_rq_t *rq) {
+    int queue_idx = find_highest_priority_queue(&rq->prio);
+    return (queue_idx < 0) ? NULL : rq->prio.heads[queue_idx];
+}
+
+static tcb_t *next_in_lower_queue(sched_prio_rq_t *prq, int queue_idx) {
+    for (int i = queue_idx - 1; i >= 0; i--) {
+        if (prq->bitmap & (1 << i))
+            return prq->heads[i];
+    }
+    return NULL;
+}
+
+static tcb_t *first_prio(sched_rq_t *rq) {
+    return next_in_lower_queue(&rq->prio, NUM_PRIORITY_QUEUES);
+}
+
+static tcb_t *next_prio(sched_rq_t *rq, tcb_t *task) {
+    if (task->next != NULL)
+        return task->next;
+    return next_in_lower_queue(&rq->prio, priority_to_queue(task->priority));
+}
+
+static void update_curr_prio(sched_rq_t *rq, tcb_t *curr, uint64_t delta_ns) {
+    (void)rq; (void)curr; (void)delta_ns;
+}
+
+static uint64_t time_slice_prio(sched_rq_t *rq, tcb_t *task) {
+    /* Higher priority = longer time slices
+     * Priority 0-31:   5ms
+     * Priority 32-63:  7ms
+     * Priority 64-95:  10ms
+     * Priority 96-127: 12ms
+     * Priority 128-159: 15ms
+     * Priority 160-191: 20ms
+     * Priority 192-223: 25ms
+     * Priority 224-255: 30ms
+     */
+    static const uint64_t time_slices_ms[] = {
+        5, 7, 10, 12, 15, 20, 25, 30
+    };
+
+    (void)rq;
+    int queue = priority_to_queue(task->priority);
+    return time_slices_ms[queue] * 1000000ULL;  /* Convert to nanoseconds */
+}
+
+static bool check_preempt_prio(tcb_t *curr, tcb_t *task) {
+    return task->priority > curr->priority;
+}
+
+static void age_waiting_tasks(sched_rq_t *rq) {
+    sched_prio_rq_t *prq = &rq->prio;
+
+    for (int i = 0; i < NUM_PRIORITY_QUEUES; i++) {
+        tcb_t *task = prq->heads[i];
+        while (task != NULL) {
+            task->wait_ticks++;
+
+            if (task->wait_ticks >= AGING_THRESHOLD_TICKS &&
+                task->priority < 255 - AGING_BOOST_AMOUNT) {
+
+                int old_queue = i;
+                int new_queue = priority_to_queue(task->priority + AGING_BOOST_AMOUNT);
+
+                if (new_queue != old_queue) {
+                    unlink_from_queue(prq, old_queue, task);
+                    task->priority += AGING_BOOST_AMOUNT;
+                    task->wait_ticks = 0;
+                    link_to_queue(prq, task);
+                    rq->stats.aging_boosts++;
+
+                    break;  /* Only age one task per queue per tick */
+                }
+
+                task->priority += AGING_BOOST_AMOUNT;
+            }
+
+            task = task->next;
+        }
+    }
+}
+
+static bool tick_prio(sched_rq_t *rq, uint64_t now) {
+    /* Only this class pays for the aging walk, and only while it has tasks */
+    if (rq->prio.nr_running == 0 || now < rq->prio.next_aging_ns)
+        return false;
+
+    age_waiting_tasks(rq);
+    rq->prio.next_aging_ns = now + AGING_INTERVAL_NS;
+    return false;
+}
+
+static void dump_prio(sched_rq_t *rq) {
+    sched_prio_rq_t *prq = &rq->prio;
+
+    printk("\nready queues (by priority):\n");
+    for (int i = NUM_PRIORITY_QUEUES - 1; i >= 0; i--) {
+        if (prq->heads[i] != NULL) {
+            printk("  queue %d (priority %u-%u):\n", i, i * 32, (i * 32) + 31);
+            tcb_t *task = prq->heads[i];
+            int count = 0;
+            while (task != NULL && count < 20) {
+                printk("    [%lu] %s (prio=%u/%u, time=%lu ms, waits=%lu)\n",
+                       task->tid, task->name,
+                       task->priority, task->base_priority,
+                       task->time_used_ns / 1000000,
+                       task->wait_ticks);
+
+                if (task->owner_proc != NULL) {
+                    struct pcb *proc = (struct pcb *)task->owner_proc;
+                    printk("           PID=%lu", proc->pid);
+                }
+
+                task = task->next;
+                count++;
+            }
+        }
+    }
+}
+
+const sched_class_t prio_sched_class = {
+    .name           = "prio",
+    .enqueue        = enqueue_prio,
+    .dequeue        = dequeue_prio,
+    .pick_next      = pick_next_prio,
+    .first          = first_prio,
+    .next           = next_prio,
+    .update_curr    = update_curr_prio,
+    .time_slice     = time_slice_prio,
+    .check_preempt  = check_preempt_prio,
+    .tick           = tick_prio,
+    .dump           = dump_prio,
+};
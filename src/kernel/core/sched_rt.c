@@ -0,0 +1,152 @@
+#include <core/sched_class.h>
+#include <core/proc.h>
+
+#include <video/printk.h>
+
+static inline bool level_queued(sched_rt_rq_t *rt, int level) {
+    return rt->bitmap[level >> 6] & (1ULL << (level & 63));
+}
+
+static int highest_level_below(sched_rt_rq_t *rt, int level) {
+    /* Highest non-empty level strictly below level, or -1 */
+    for (int word = (level - 1) >> 6; word >= 0 && level > 0; word--) {
+        uint64_t bits = rt->bitmap[word];
+
+        int top = level - 1 - word * 64;
+        if (top < 63)
+            bits &= (1ULL << (top + 1)) - 1;
+
+        if (bits != 0)
+            return word * 64 + 63 - __builtin_clzll(bits);
+
+        level = word * 64;
+    }
+    return -1;
+}
+
+static void enqueue_rt(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_rt_rq_t *rt = &rq->rt;
+    int level = task->rt_priority;
+
+    /* A preempted task resumes first, unless its RR slice is spent */
+    bool head = (flags & ENQUEUE_PREEMPTED) &&
+                (task->policy == SCHED_POLICY_FIFO || rq->time_slice_remaining_ns > 0);
+
+    if (rt->heads[level] == NULL) {
+        task->next = NULL;
+        rt->heads[level] = task;
+        rt->tails[level] = task;
+        rt->bitmap[level >> 6] |= 1ULL << (level & 63);
+    } else if (head) {
+        task->next = rt->heads[level];
+        rt->heads[level] = task;
+    } else {
+        task->next = NULL;
+        rt->tails[level]->next = task;
+        rt->tails[level] = task;
+    }
+
+    rt->nr_running++;
+}
+
+static void dequeue_rt(sched_rq_t *rq, tcb_t *task, int flags) {
+    sched_rt_rq_t *rt = &rq->rt;
+    int level = task->rt_priority;
+    (void)flags;
+
+    tcb_t *prev = NULL;
+    tcb_t *curr = rt->heads[level];
+
+    while (curr != NULL && curr != task) {
+        prev = curr;
+        curr = curr->next;
+    }
+    if (curr == NULL)
+        return;
+
+    if (prev == NULL)
+        rt->heads[level] = task->next;
+    else
+        prev->next = task->next;
+
+    if (rt->tails[level] == task)
+        rt->tails[level] = prev;
+
+    if (rt->heads[level] == NULL)
+        rt->bitmap[level >> 6] &= ~(1ULL << (level & 63));
+
+    task->next = NULL;
+    rt->nr_running--;
+}
+
+static tcb_t *pick_next_rt(sched_rq_t *rq) {
+    int level = highest_level_below(&rq->rt, SCHED_RT_PRIO_LEVELS);
+    return (level < 0) ? NULL : rq->rt.heads[level];
+}
+
+static tcb_t *first_rt(sched_rq_t *rq) {
+    return pick_next_rt(rq);
+}
+
+static tcb_t *next_rt(sched_rq_t *rq, tcb_t *task) {
+    if (task->next != NULL)
+        return task->next;
+
+    int level = highest_level_below(&rq->rt, task->rt_priority);
+    return (level < 0) ? NULL : rq->rt.heads[level];
+}
+
+static void update_curr_rt(sched_rq_t *rq, tcb_t *curr, uint64_t delta_ns) {
+    (void)rq; (void)curr; (void)delta_ns;
+}
+
+static uint64_t time_slice_rt(sched_rq_t *rq, tcb_t *task) {
+    (void)rq;
+
+    /* FIFO tasks have no slice; 0 keeps the tick from ever expiring one */
+    return (task->policy == SCHED_POLICY_RR) ? SCHED_RR_TIMESLICE_NS : 0;
+}
+
+static bool check_preempt_rt(tcb_t *curr, tcb_t *task) {
+    return task->rt_priority > curr->rt_priority;
+}
+
+static void dump_rt(sched_rq_t *rq) {
+    sched_rt_rq_t *rt = &rq->rt;
+
+    if (rt->nr_running == 0)
+        return;
+
+    printk("\nreal-time queues (%u tasks):\n", rt->nr_running);
+
+    int count = 0;
+    for (tcb_t *task = first_rt(rq); task != NULL && count < 20;
+         task = next_rt(rq, task), count++) {
+        printk("    [%lu] %s (%s, rt_prio=%u, time=%lu ms)\n",
+               task->tid, task->name,
+               task->policy == SCHED_POLICY_RR ? "rr" : "fifo",
+               task->rt_priority, task->time_used_ns / 1000000);
+
+        if (task->owner_proc != NULL) {
+            struct pcb *proc = (struct pcb *)task->owner_proc;
+            printk("           PID=%lu", proc->pid);
+        }
+    }
+}
+
+const sched_class_t rt_sched_class = {
+    .name           = "rt",
+    .strict         = true,
+    .enqueue        = enqueue_rt,
+    .dequeue        = dequeue_rt,
+    .pick_next      = pick_next_rt,
+    .first          = first_rt,
+    .next           = next_rt,
+    .update_curr    = update_curr_rt,
+    .time_slice     = time_slice_rt,
+    .check_preempt  = check_preempt_rt,
+    .tick           = NULL,
+    .next_event     = NULL,
+    .detach         = NULL,
+    .dump           = dump_rt,
+};
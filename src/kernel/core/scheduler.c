@@ -1,239 +1,591 @@
 #include <arch/x86_64/switch.h>
+#include <arch/x86_64/fpu.h>
 #include <arch/x86_64/tsc.h>
 #include <arch/x86_64/io.h>
 #include <arch/x86_64/apic.h>
 #include <arch/x86_64/idt.h>
+#include <arch/x86_64/smp.h>
+#include <arch/x86_64/irqflags.h>
 
 #include <core/scheduler.h>
+#include <core/sched_class.h>
 #include <core/proc.h>
 #include <core/spinlock.h>
+#include <core/seqlock.h>
+#include <core/rcu.h>
+#include <core/workqueue.h>
 
 #include <mm/heap.h>
+#include <mm/kstack.h>
+#include <mm/mmu.h>
 #include <mm/paging.h>
+#include <mm/pmm.h>
 
 #include <video/printk.h>
 #include <video/log.h>
 
 #include <klibc/string.h>
-
-tcb_t *current_task = NULL;
-
-static tcb_t *ready_queue_heads[NUM_PRIORITY_QUEUES] = {NULL};
-static tcb_t *ready_queue_tails[NUM_PRIORITY_QUEUES] = {NULL};
-static uint8_t ready_queue_bitmap = 0;  /* Bitmap: bit set = queue has tasks */
-
-static tcb_t *sleeping_tasks = NULL;
+#include <klibc/errno.h>
 
 static tcb_t *terminated_tasks = NULL;
 
-static tcb_t *idle_task = NULL;
-
-static uint64_t next_tid = 1;
+static heap_slab_cache_t *tcb_cache = NULL;
 
-static int scheduler_lock_count = 0;
+/* Frees exited tasks from terminated_tasks once they are off their CPU */
+static delayed_work_t reap_work;
 
-static int postpone_task_switches = 0;
-static int task_switch_postponed = 0;
+static uint64_t next_tid = 1;
 
 static uint64_t time_since_boot_ns = 0;
 static uint64_t last_tsc = 0;
 
-static uint64_t time_slice_remaining_ns = 0;
-
 static int scheduler_initialized = 0;
 
-static sched_stats_t sched_stats = {0};
+/* Highest first: pick_next_task() asks each class in turn */
+static const sched_class_t *const sched_classes[] = {
+    &dl_sched_class,
+    &rt_sched_class,
+    &prio_sched_class,
+    &fair_sched_class,
+};
+
+#define NUM_SCHED_CLASSES   (sizeof(sched_classes) / sizeof(sched_classes[0]))
 
-static spinlock_irq_t scheduler_data_lock = SPINLOCK_IRQ_INIT;
+_Static_assert(NUM_SCHED_CLASSES == SCHED_NR_CLASSES, "latency histograms are sized per class");
+
+/* Protects terminated_tasks; taken before any rq->lock */
+static spinlock_irq_t scheduler_data_lock = SPINLOCK_IRQ_INIT_NAMED("scheduler_data_lock");
+
+/* Guards the time_since_boot_ns/last_tsc pair; only the tick writes it */
+static seqlock_t clock_seq = SEQLOCK_INIT_NAMED("clock_seq");
 
 bool scheduler_is_initialized(void) {
     return scheduler_initialized;
 }
 
-static inline void cli(void) {
-    __asm__ volatile("cli" ::: "memory");
+static inline cpu_info_t *this_cpu(void) {
+    return smp_get_current_cpu();
 }
 
-static inline void sti(void) {
-    __asm__ volatile("sti" ::: "memory");
+static void task_exit_wrapper(void) {
+    terminate_task();
+    for (;;) __asm__("hlt");
 }
 
-static inline int priority_to_queue(uint8_t priority) {
-    return priority >> 5;  /* Divide by 32 */
-}
+static uint64_t read_clock(void) {
+    uint64_t now;
+    uint32_t seq;
 
-static inline int find_highest_priority_queue(void) {
-    if (ready_queue_bitmap == 0)
-        return -1;
+    /* Extrapolated from the last tick, without writing anything shared */
+    do {
+        seq = read_seqbegin(&clock_seq);
 
-    for (int i = NUM_PRIORITY_QUEUES - 1; i >= 0; i--) {
-        if (ready_queue_bitmap & (1 << i))
-            return i;
-    }
-    return -1;
+        /* TSCs of different CPUs may be slightly apart; never step backwards */
+        uint64_t current_tsc = rdtsc();
+        now = time_since_boot_ns;
+        if (current_tsc > last_tsc)
+            now += tsc_to_ns(current_tsc - last_tsc);
+    } while (read_seqretry(&clock_seq, seq));
+
+    return now;
 }
 
-static inline uint64_t calculate_time_slice(uint8_t priority) {
-    /* Higher priority = longer time slices
-     * Priority 0-31:   5ms
-     * Priority 32-63:  7ms
-     * Priority 64-95:  10ms
-     * Priority 96-127: 12ms
-     * Priority 128-159: 15ms
-     * Priority 160-191: 20ms
-     * Priority 192-223: 25ms
-     * Priority 224-255: 30ms
-     */
-    static const uint64_t time_slices_ms[] = {
-        5, 7, 10, 12, 15, 20, 25, 30
-    };
+static uint64_t update_clock(void) {
+    write_seqlock(&clock_seq);
 
-    int queue = priority_to_queue(priority);
-    return time_slices_ms[queue] * 1000000ULL;  /* Convert to nanoseconds */
-}
+    uint64_t current_tsc = rdtsc();
+    if (current_tsc > last_tsc) {
+        time_since_boot_ns += tsc_to_ns(current_tsc - last_tsc);
+        last_tsc = current_tsc;
+    }
+    uint64_t now = time_since_boot_ns;
 
-static void task_exit_wrapper(void) {
-    terminate_task();
-    for (;;) __asm__("hlt");
+    write_sequnlock(&clock_seq);
+    return now;
 }
 
-static void update_time_accounting(void) {
-    uint64_t current_tsc = rdtsc();
-    uint64_t tsc_delta = current_tsc - last_tsc;
-    uint64_t ns_elapsed = tsc_to_ns(tsc_delta);
+static void update_time_accounting(cpu_info_t *cpu) {
+    /* NOTE: Caller must hold cpu->rq.lock */
+    uint64_t now = read_clock();
+    sched_rq_t *rq = &cpu->rq;
 
-    last_tsc = current_tsc;
-    time_since_boot_ns += ns_elapsed;
+    uint64_t ns_elapsed = (now > rq->clock_ns) ? now - rq->clock_ns : 0;
+    rq->clock_ns = now;
 
-    if (current_task != NULL) {
-        current_task->time_used_ns += ns_elapsed;
-        current_task->last_run_time_ns = time_since_boot_ns;
+    tcb_t *current = cpu->current_thread;
+    if (current != NULL) {
+        current->time_used_ns += ns_elapsed;
+        current->last_run_time_ns = now;
 
-        if (current_task == idle_task) {
-            sched_stats.idle_time_ns += ns_elapsed;
+        if (current == rq->idle) {
+            rq->stats.idle_time_ns += ns_elapsed;
+        } else if (!current->on_rq) {
+            /* A wakeup may have requeued it already; keys must not move in the tree */
+            sched_class_of(current)->update_curr(rq, current, ns_elapsed);
         }
     }
 }
 
 void lock_scheduler(void) {
-    scheduler_lock_count++;
-    postpone_task_switches++;
+    uint64_t flags = irq_save();
+
+    cpu_info_t *cpu = this_cpu();
+    if (cpu != NULL)
+        cpu->rq.postpone_task_switches++;
+
+    irq_restore(flags);
 }
 
 void unlock_scheduler(void) {
-    postpone_task_switches--;
+    uint64_t flags = irq_save();
+
+    cpu_info_t *cpu = this_cpu();
+    if (cpu == NULL) {
+        irq_restore(flags);
+        return;
+    }
 
-    int should_schedule = (postpone_task_switches == 0 && task_switch_postponed);
+    sched_rq_t *rq = &cpu->rq;
+    rq->postpone_task_switches--;
 
-    scheduler_lock_count--;
+    int should_schedule = (rq->postpone_task_switches == 0 && rq->task_switch_postponed);
+    if (should_schedule)
+        rq->task_switch_postponed = 0;
+
+    irq_restore(flags);
 
     if (should_schedule) {
-        task_switch_postponed = 0;
         schedule();
     }
 }
 
-static void add_to_ready_queue(tcb_t *task) {
-    /* NOTE: Caller must hold scheduler_data_lock */
-    task->next = NULL;
+static void enqueue_task(sched_rq_t *rq, tcb_t *task, int flags) {
+    /* NOTE: Caller must hold rq->lock */
     task->state = TASK_STATE_READY;
-    task->wait_ticks = 0;  /* Reset aging counter */
+    task->on_rq = 1;
 
-    int queue_idx = priority_to_queue(task->priority);
+    /* Requeues and migrations keep the stamp, the wait is still the same one */
+    if (task->ready_tsc == 0) {
+        task->ready_tsc = rdtsc();
+        task->ready_kind = (flags & (ENQUEUE_WAKEUP | ENQUEUE_NEW)) ?
+                           SCHED_LAT_WAKEUP : SCHED_LAT_RUNQ;
+    }
 
-    if (ready_queue_heads[queue_idx] == NULL) {
-        ready_queue_heads[queue_idx] = task;
-        ready_queue_tails[queue_idx] = task;
-        ready_queue_bitmap |= (1 << queue_idx);  /* Mark queue as non-empty */
-    } else {
-        ready_queue_tails[queue_idx]->next = task;
-        ready_queue_tails[queue_idx] = task;
+    sched_class_of(task)->enqueue(rq, task, flags);
+    rq->nr_running++;
+}
+
+static void dequeue_task(sched_rq_t *rq, tcb_t *task, int flags) {
+    /* NOTE: Caller must hold rq->lock */
+    if (!task->on_rq)
+        return;
+
+    sched_class_of(task)->dequeue(rq, task, flags);
+    task->on_rq = 0;
+    rq->nr_running--;
+}
+
+static void detach_task(sched_rq_t *rq, tcb_t *task) {
+    /* NOTE: Caller must hold rq->lock */
+    const sched_class_t *class = sched_class_of(task);
+    if (class->detach != NULL)
+        class->detach(rq, task);
+}
+
+static tcb_t *pick_next_task(sched_rq_t *rq) {
+    /* NOTE: Caller must hold rq->lock */
+    if (rq->nr_running == 0)
+        return NULL;
+
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        tcb_t *task = sched_classes[i]->pick_next(rq);
+        if (task != NULL) {
+            dequeue_task(rq, task, 0);
+            return task;
+        }
     }
+    return NULL;
 }
 
-static tcb_t *remove_from_ready_queue(void) {
-    /* NOTE: Caller must hold scheduler_data_lock */
-    int queue_idx = find_highest_priority_queue();
-    if (queue_idx < 0)
+static size_t sched_class_rank(const sched_class_t *class) {
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        if (sched_classes[i] == class)
+            return i;
+    }
+    return NUM_SCHED_CLASSES;
+}
+
+static void account_latency(sched_rq_t *rq, tcb_t *task) {
+    /* NOTE: Caller must hold rq->lock; task is about to run */
+    if (task->ready_tsc == 0)
+        return;
+
+    /* Stamped on another CPU; TSCs may be a little apart */
+    int64_t delta = (int64_t)(rdtsc() - task->ready_tsc);
+    uint64_t units = (delta > 0) ? tsc_to_ns((uint64_t)delta) >> SCHED_LAT_UNIT_SHIFT : 0;
+
+    uint32_t bucket = (units == 0) ? 0 : 64 - __builtin_clzll(units);
+    if (bucket >= SCHED_LAT_BUCKETS)
+        bucket = SCHED_LAT_BUCKETS - 1;
+
+    size_t class = sched_class_rank(sched_class_of(task));
+    rq->latency.hist[task->ready_kind][class][bucket]++;
+    task->ready_tsc = 0;
+}
+
+/* Should a freshly queued task take the CPU from curr? */
+static bool task_preempts(tcb_t *curr, tcb_t *task) {
+    const sched_class_t *curr_class = sched_class_of(curr);
+    const sched_class_t *task_class = sched_class_of(task);
+
+    if (curr_class == task_class)
+        return curr_class->check_preempt(curr, task);
+
+    return sched_class_rank(task_class) < sched_class_rank(curr_class);
+}
+
+static bool task_allowed_on_cpu(tcb_t *task, uint32_t cpu_id) {
+    return cpumask_test(&task->cpus_allowed, cpu_id);
+}
+
+static uint32_t select_task_cpu(tcb_t *task) {
+    /* Deadline bandwidth was admitted on one CPU */
+    if (task->policy == SCHED_POLICY_DEADLINE)
+        return task->cpu;
+
+    uint32_t best = 0;
+    uint32_t best_load = UINT32_MAX;
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || !cpu->online || cpu->rq.idle == NULL)
+            continue;
+
+        if (!task_allowed_on_cpu(task, i))
+            continue;
+
+        uint32_t load = cpu->rq.nr_running;
+        if (cpu->current_thread != NULL && cpu->current_thread != cpu->rq.idle)
+            load++;
+
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+static sched_rq_t *task_rq(tcb_t *task) {
+    cpu_info_t *cpu = smp_get_cpu(task->cpu);
+    if (cpu == NULL)
+        cpu = g_cpus[0];
+    return &cpu->rq;
+}
+
+/* Lock the run queue owning task, retrying if the balancer moves it meanwhile */
+static sched_rq_t *task_rq_lock(tcb_t *task) {
+    for (;;) {
+        sched_rq_t *rq = task_rq(task);
+
+        spinlock_irq_acquire(&rq->lock);
+        if (rq == task_rq(task))
+            return rq;
+        spinlock_irq_release(&rq->lock);
+    }
+}
+
+static void migrate_task_rq(sched_rq_t *src, tcb_t *task) {
+    /* NOTE: Caller must hold src->lock; task is not queued */
+    const sched_class_t *class = sched_class_of(task);
+    if (class->migrate != NULL)
+        class->migrate(src, task);
+}
+
+/* Make a blocked task runnable on its CPU; returns that CPU's run queue */
+static sched_rq_t *activate_task(tcb_t *task, int flags) {
+    /* Its affinity may have changed since it last ran */
+    if (!task_allowed_on_cpu(task, task->cpu)) {
+        sched_rq_t *src = task_rq_lock(task);
+        migrate_task_rq(src, task);
+        task->cpu = select_task_cpu(task);
+        spinlock_irq_release(&src->lock);
+
+        flags |= ENQUEUE_MIGRATED;
+    }
+
+    sched_rq_t *rq = task_rq(task);
+
+    spinlock_irq_acquire(&rq->lock);
+    if (!task->on_rq && task->state != TASK_STATE_TERMINATED)
+        enqueue_task(rq, task, flags);
+    spinlock_irq_release(&rq->lock);
+
+    return rq;
+}
+
+static void resched_cpu(cpu_info_t *cpu) {
+    /* One IPI in flight is enough; the handler clears the flag */
+    if (__atomic_exchange_n(&cpu->rq.resched_ipi_pending, 1, __ATOMIC_ACQ_REL))
+        return;
+
+    uint64_t flags = irq_save();
+    smp_send_ipi(cpu->lapic_id, SMP_IPI_RESCHEDULE);
+    irq_restore(flags);
+}
+
+void scheduler_kick_cpu(uint32_t cpu_id) {
+    cpu_info_t *cpu = smp_get_cpu(cpu_id);
+    if (cpu == NULL || !cpu->online || cpu == this_cpu())
+        return;
+    resched_cpu(cpu);
+}
+
+/* Tickless idle CPUs never balance on their own; wake one to pull work */
+static void kick_idle_cpu(cpu_info_t *busy, tcb_t *task) {
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu == busy || !cpu->online || !cpu->rq.tickless)
+            continue;
+
+        if (!task_allowed_on_cpu(task, cpu->cpu_id))
+            continue;
+
+        if (cpu->current_thread == cpu->rq.idle && cpu->rq.nr_running == 0) {
+            resched_cpu(cpu);
+            return;
+        }
+    }
+}
+
+/* Kick the task's CPU if the wakeup should preempt what is running there */
+static void check_preempt_wakeup(tcb_t *task) {
+    cpu_info_t *target = smp_get_cpu(task->cpu);
+    if (target == NULL || !target->online)
+        return;
+
+    tcb_t *curr = __atomic_load_n(&target->current_thread, __ATOMIC_ACQUIRE);
+    if (curr == NULL)
+        return;
+
+    if (curr == target->rq.idle || task_preempts(curr, task)) {
+        /* Callers hold lock_scheduler(), so ours runs once they drop it */
+        if (target == this_cpu())
+            schedule();
+        else
+            resched_cpu(target);
+        return;
+    }
+
+    kick_idle_cpu(target, task);
+}
+
+/* Lock the sleep wheel task would be on; it can't commit to sleeping meanwhile */
+static sched_rq_t *task_sleep_lock(tcb_t *task) {
+    for (;;) {
+        sched_rq_t *rq = task_rq(task);
+
+        spinlock_irq_acquire(&rq->sleep_lock);
+        if (rq == task_rq(task))
+            return rq;
+        spinlock_irq_release(&rq->sleep_lock);
+    }
+}
+
+static void sleep_queue_remove(tcb_t *task) {
+    /* A sleeping task is off the run queues, so task->cpu is stable */
+    sched_rq_t *rq = task_rq(task);
+
+    spinlock_irq_acquire(&rq->sleep_lock);
+    timer_wheel_del(&rq->sleepers, &task->sleep_node);
+    spinlock_irq_release(&rq->sleep_lock);
+}
+
+static inline uint32_t cpu_load(cpu_info_t *cpu) {
+    uint32_t load = cpu->rq.nr_running;
+    if (cpu->current_thread != NULL && cpu->current_thread != cpu->rq.idle)
+        load++;
+    return load;
+}
+
+static cpu_info_t *find_busiest_cpu(cpu_info_t *this_cpu, bool idle) {
+    uint32_t this_load = cpu_load(this_cpu);
+    cpu_info_t *busiest = NULL;
+    uint32_t busiest_load = 0;
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu == this_cpu || cpu->rq.idle == NULL)
+            continue;
+
+        /* Only queued tasks can be pulled, the running one stays put */
+        if (cpu->rq.nr_running == 0)
+            continue;
+
+        uint32_t load = cpu_load(cpu);
+        if (load > busiest_load) {
+            busiest = cpu;
+            busiest_load = load;
+        }
+    }
+
+    /* Periodic balancing only moves work when it evens things out */
+    if (busiest != NULL && !idle && busiest_load <= this_load + 1)
         return NULL;
 
-    tcb_t *task = ready_queue_heads[queue_idx];
-    ready_queue_heads[queue_idx] = task->next;
+    return busiest;
+}
+
+static bool task_can_migrate(tcb_t *task, uint32_t dst_cpu, uint64_t now, bool allow_hot) {
+    if (__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE))
+        return false;
+
+    if (!task_allowed_on_cpu(task, dst_cpu))
+        return false;
+
+    /* Leave cache-hot tasks on their last CPU unless we would go idle */
+    if (!allow_hot && now - task->last_run_time_ns < MIGRATION_COST_NS)
+        return false;
+
+    return true;
+}
+
+static tcb_t *pick_migratable_task(sched_rq_t *src, uint32_t dst_cpu, uint64_t now, bool allow_hot) {
+    /* NOTE: Caller must hold src->lock */
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        const sched_class_t *class = sched_classes[i];
+        if (class->first == NULL)
+            continue;
 
-    if (ready_queue_heads[queue_idx] == NULL) {
-        ready_queue_tails[queue_idx] = NULL;
-        ready_queue_bitmap &= ~(1 << queue_idx);  /* Mark queue as empty */
+        for (tcb_t *task = class->first(src); task != NULL; task = class->next(src, task)) {
+            if (task_can_migrate(task, dst_cpu, now, allow_hot))
+                return task;
+        }
     }
+    return NULL;
+}
 
-    task->next = NULL;
-    return task;
+static void double_rq_lock(cpu_info_t *a, cpu_info_t *b) {
+    if (a->cpu_id < b->cpu_id) {
+        spinlock_irq_acquire(&a->rq.lock);
+        spinlock_irq_acquire(&b->rq.lock);
+    } else {
+        spinlock_irq_acquire(&b->rq.lock);
+        spinlock_irq_acquire(&a->rq.lock);
+    }
 }
 
-static void age_waiting_tasks(void) {
-    /* NOTE: Caller must hold scheduler_data_lock */
-    for (int i = 0; i < NUM_PRIORITY_QUEUES; i++) {
-        tcb_t *task = ready_queue_heads[i];
-        while (task != NULL) {
-            task->wait_ticks++;
-
-            if (task->wait_ticks >= AGING_THRESHOLD_TICKS &&
-                task->priority < 255 - AGING_BOOST_AMOUNT) {
-
-                int old_queue = i;
-                task->priority += AGING_BOOST_AMOUNT;
-                int new_queue = priority_to_queue(task->priority);
-
-                if (new_queue != old_queue) {
-                    /* Remove from current queue */
-                    tcb_t **prev = &ready_queue_heads[old_queue];
-                    tcb_t *curr = ready_queue_heads[old_queue];
-
-                    while (curr != NULL) {
-                        if (curr == task) {
-                            *prev = curr->next;
-                            if (ready_queue_tails[old_queue] == task)
-                                ready_queue_tails[old_queue] = (prev == &ready_queue_heads[old_queue]) ? NULL : (tcb_t*)prev;
-                            if (ready_queue_heads[old_queue] == NULL)
-                                ready_queue_bitmap &= ~(1 << old_queue);
-                            break;
-                        }
-                        prev = &curr->next;
-                        curr = curr->next;
-                    }
-
-                    task->wait_ticks = 0;
-                    add_to_ready_queue(task);
-                    sched_stats.aging_boosts++;
-
-                    break;  /* Only age one task per queue per tick */
-                }
-            }
+static void double_rq_unlock(cpu_info_t *a, cpu_info_t *b) {
+    if (a->cpu_id < b->cpu_id) {
+        spinlock_irq_release(&b->rq.lock);
+        spinlock_irq_release(&a->rq.lock);
+    } else {
+        spinlock_irq_release(&a->rq.lock);
+        spinlock_irq_release(&b->rq.lock);
+    }
+}
+
+/* Pull one READY task from the busiest CPU onto this one */
+static bool load_balance(cpu_info_t *this_cpu, bool idle) {
+    cpu_info_t *busiest = find_busiest_cpu(this_cpu, idle);
+    if (busiest == NULL)
+        return false;
+
+    uint64_t now = read_clock();
+
+    double_rq_lock(this_cpu, busiest);
+
+    this_cpu->rq.stats.balance_runs++;
+
+    tcb_t *task = pick_migratable_task(&busiest->rq, this_cpu->cpu_id, now, false);
+    if (task == NULL && idle)
+        task = pick_migratable_task(&busiest->rq, this_cpu->cpu_id, now, true);
+
+    if (task != NULL) {
+        dequeue_task(&busiest->rq, task, 0);
+        migrate_task_rq(&busiest->rq, task);
+        task->cpu = this_cpu->cpu_id;
+        enqueue_task(&this_cpu->rq, task, ENQUEUE_MIGRATED);
+
+        busiest->rq.stats.migrations_out++;
+        this_cpu->rq.stats.migrations_in++;
+    }
+
+    double_rq_unlock(this_cpu, busiest);
+
+    return task != NULL;
+}
 
-            task = task->next;
+/* A wakeup that landed while task was still running; returns true if taken */
+static bool take_pending_wakeup(sched_rq_t *rq, tcb_t *task) {
+    /* NOTE: Caller must hold rq->lock; task is current */
+    if (!task->on_rq)
+        return false;
+
+    dequeue_task(rq, task, 0);
+    task->state = TASK_STATE_RUNNING;
+    task->ready_tsc = 0;
+    return true;
+}
+
+/*
+ * Put current into state, and on the sleep wheel if wake_time_ns is set.
+ * Wakers hold sleep_lock across their enqueue, so the check and the
+ * commit can't straddle one. Returns false if a wakeup got in first; it
+ * is consumed and the task keeps running.
+ */
+static bool prepare_to_sleep(tcb_t *task, uint8_t state, uint64_t wake_time_ns) {
+    /* NOTE: task is current, so this is our own CPU's wheel */
+    sched_rq_t *rq = task_rq(task);
+
+    spinlock_irq_acquire(&rq->sleep_lock);
+    spinlock_irq_acquire(&rq->lock);
+
+    bool pending = take_pending_wakeup(rq, task);
+    if (!pending) {
+        task->state = state;
+        if (wake_time_ns != 0) {
+            task->sleep_expiry_ns = wake_time_ns;
+            timer_wheel_add(&rq->sleepers, &task->sleep_node, wake_time_ns);
         }
     }
+
+    spinlock_irq_release(&rq->lock);
+    spinlock_irq_release(&rq->sleep_lock);
+
+    return !pending;
 }
 
 extern void task_startup_wrapper(void);
 
-tcb_t *create_kernel_task(void (*entry_point)(void), const char *name, uint8_t priority) {
+static tcb_t *tcb_alloc(void) {
+    tcb_t *task = (tcb_t *)heap_slab_alloc(tcb_cache);
+    if (task != NULL)
+        memset(task, 0, sizeof(tcb_t));
+    return task;
+}
+
+static void tcb_free(tcb_t *task) {
+    heap_slab_free(tcb_cache, task);
+}
+
+tcb_t *create_kernel_task_paused(void (*entry_point)(void), const char *name, uint8_t priority) {
     /* Allocate TCB */
-    tcb_t *task = (tcb_t *)kmalloc(sizeof(tcb_t));
+    tcb_t *task = tcb_alloc();
     if (task == NULL) {
         eerror("sched: failed to allocate TCB\n");
         return NULL;
     }
 
-    memset(task, 0, sizeof(tcb_t));
-
-    void *stack = kmalloc(KERNEL_STACK_SIZE);
+    void *stack = kstack_alloc();
     if (stack == NULL) {
         eerror("sched: failed to allocate kernel stack\n");
-        kfree(task);
+        tcb_free(task);
         return NULL;
     }
 
-    task->tid = next_tid++;
+    task->tid = __atomic_fetch_add(&next_tid, 1, __ATOMIC_RELAXED);
     strncpy(task->name, name, sizeof(task->name) - 1);
     task->name[sizeof(task->name) - 1] = '\0';
 
@@ -241,9 +593,15 @@ tcb_t *create_kernel_task(void (*entry_point)(void), const char *name, uint8_t p
     task->kernel_stack_size = KERNEL_STACK_SIZE;
     task->cr3 = paging_get_pml4();  /* Use kernel's page table for now */
 
-    task->state = TASK_STATE_READY;
+    task->state = TASK_STATE_PAUSED;
     task->priority = priority;
     task->base_priority = priority;
+    task->policy = SCHED_POLICY_DEFAULT;
+    task->weight = sched_prio_to_weight(priority);
+    task->vruntime = 0;
+    task->on_rq = 0;
+    task->cpu = 0;
+    cpumask_setall(&task->cpus_allowed);
     task->next = NULL;
 
     task->time_used_ns = 0;
@@ -283,70 +641,228 @@ tcb_t *create_kernel_task(void (*entry_point)(void), const char *name, uint8_t p
 
     task->rsp = (uint64_t)stack_top;
 
+    return task;
+}
+
+void task_start(tcb_t *task) {
+    if (task == NULL || task->state != TASK_STATE_PAUSED)
+        return;
+
     lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-    add_to_ready_queue(task);
-    spinlock_irq_release(&scheduler_data_lock);
+
+    task->cpu = select_task_cpu(task);
+    activate_task(task, ENQUEUE_NEW);
+    check_preempt_wakeup(task);
+
     unlock_scheduler();
+}
 
+tcb_t *create_kernel_task(void (*entry_point)(void), const char *name, uint8_t priority) {
+    tcb_t *task = create_kernel_task_paused(entry_point, name, priority);
+    if (task == NULL)
+        return NULL;
+
+    task_start(task);
     return task;
 }
 
-void schedule(void) {
-    /* Check if task switches are postponed */
-    if (postpone_task_switches != 0) {
-        task_switch_postponed = 1;
+static void program_next_event(cpu_info_t *cpu) {
+    /* NOTE: Called with interrupts disabled on cpu itself */
+    sched_rq_t *rq = &cpu->rq;
+    if (!rq->tickless)
+        return;
+
+    uint64_t now = read_clock();
+
+    spinlock_irq_acquire(&rq->sleep_lock);
+    uint64_t next = timer_wheel_next_expiry(&rq->sleepers);
+    spinlock_irq_release(&rq->sleep_lock);
+
+    spinlock_irq_acquire(&rq->lock);
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        if (sched_classes[i]->next_event == NULL)
+            continue;
+
+        uint64_t event = sched_classes[i]->next_event(rq);
+        if (event < next)
+            next = event;
+    }
+    spinlock_irq_release(&rq->lock);
+
+    /* Busy CPUs still need slice expiry, aging and balancing */
+    if (cpu->current_thread != rq->idle) {
+        uint64_t tick = now + SCHED_TICK_NS;
+        uint64_t slice_end = rq->slice_clock_ns + rq->time_slice_remaining_ns;
+
+        if (rq->time_slice_remaining_ns > 0 && slice_end < tick)
+            tick = slice_end;
+        if (tick < next)
+            next = tick;
+    }
+
+    /* Idle with no sleepers: stay quiet until an IPI or device interrupt */
+    if (next == UINT64_MAX) {
+        apic_timer_set_tsc_deadline(0);
         return;
     }
 
-    update_time_accounting();
+    if (next < now + SCHED_TIMER_MIN_NS)
+        next = now + SCHED_TIMER_MIN_NS;
 
-    spinlock_irq_acquire(&scheduler_data_lock);
+    apic_timer_set_tsc_deadline(rdtsc() + ns_to_tsc(next - now));
+}
+
+static void __schedule(cpu_info_t *cpu) {
+    /* NOTE: Called with interrupts disabled and task switches postponed */
+    sched_rq_t *rq = &cpu->rq;
+    tcb_t *prev = cpu->current_thread;
+
+    /* Task switches were allowed, so no RCU reader is active here */
+    rcu_note_qs(cpu->cpu_id);
+
+    /* About to run out of work: try to steal before falling back to idle */
+    if (rq->nr_running == 0)
+        load_balance(cpu, true);
+
+    spinlock_irq_acquire(&rq->lock);
+
+    update_time_accounting(cpu);
+    rq->slice_clock_ns = rq->clock_ns;
+
+    int requeue_flags = rq->yield_pending ? 0 : ENQUEUE_PREEMPTED;
+    rq->yield_pending = false;
 
-    tcb_t *next_task = remove_from_ready_queue();
+    bool running = (prev != NULL && prev != rq->idle && prev->state == TASK_STATE_RUNNING);
+
+    /* Affinity changed under it: hand it to an allowed CPU once it is off ours */
+    bool push = running && !task_allowed_on_cpu(prev, cpu->cpu_id);
+    if (push) {
+        migrate_task_rq(rq, prev);
+        prev->cpu = select_task_cpu(prev);
+    }
+
+    /* Strict classes only give way to better tasks, so prev takes part in the pick */
+    if (running && !push && sched_class_of(prev)->strict)
+        enqueue_task(rq, prev, requeue_flags);
+
+    tcb_t *next_task = pick_next_task(rq);
 
     if (next_task == NULL) {
-        if (current_task == idle_task && current_task->state == TASK_STATE_RUNNING) {
-            /* Already running idle task, just continue */
-            time_slice_remaining_ns = 0;  /* no time slice for idle */
-            spinlock_irq_release(&scheduler_data_lock);
+        if (prev != NULL && prev->state == TASK_STATE_RUNNING && !push) {
+            /* Nothing else to run, keep going */
+            rq->time_slice_remaining_ns = (prev == rq->idle) ? 0 :
+                                          sched_class_of(prev)->time_slice(rq, prev);
+            spinlock_irq_release(&rq->lock);
+            program_next_event(cpu);
             return;
         }
-        next_task = idle_task;
-        time_slice_remaining_ns = 0;  /* no time slice for idle */
-    } else {
-        /* Set dynamic time slice based on priority */
-        time_slice_remaining_ns = calculate_time_slice(next_task->priority);
+        next_task = rq->idle;
+    } else if (next_task != prev) {
         next_task->switch_count++;
-        sched_stats.total_switches++;
+        rq->stats.total_switches++;
     }
 
-    if (current_task != NULL && current_task->state == TASK_STATE_RUNNING) {
-        /* Don't re-queue idle task */
-        if (current_task != idle_task) {
-            /* NEW: Track preemption */
-            current_task->preempt_count++;
+    if (running && prev != next_task) {
+        prev->preempt_count++;
 
+        if (prev->state == TASK_STATE_RUNNING && !push) {
             /* Reset priority if it was boosted by aging */
-            if (current_task->priority > current_task->base_priority) {
-                current_task->priority = current_task->base_priority;
+            if (prev->priority > prev->base_priority) {
+                prev->priority = prev->base_priority;
             }
-            add_to_ready_queue(current_task);
+            enqueue_task(rq, prev, requeue_flags);
         }
     }
 
+    /* Sized once prev is back on the queue, fair slices depend on the load */
+    rq->time_slice_remaining_ns = (next_task == rq->idle) ? 0 :
+                                  sched_class_of(next_task)->time_slice(rq, next_task);
+
     next_task->state = TASK_STATE_RUNNING;
+    next_task->cpu = cpu->cpu_id;
 
-    spinlock_irq_release(&scheduler_data_lock);
+    /* A strict task picked straight back never really waited */
+    if (next_task != prev)
+        account_latency(rq, next_task);
+    next_task->ready_tsc = 0;
+
+    if (next_task == prev) {
+        spinlock_irq_release(&rq->lock);
+        program_next_event(cpu);
+        return;
+    }
+
+    /* A task pushed here may still be switching out on its old CPU */
+    while (__atomic_load_n(&next_task->on_cpu, __ATOMIC_ACQUIRE)) {
+        /* Interrupts are off; answer any shootdown aimed at us */
+        mmu_tlb_shootdown_poll();
+        __asm__ volatile("pause");
+    }
+
+    /* prev stays on_cpu until its registers are saved; see finish_task_switch */
+    next_task->on_cpu = 1;
+    rq->prev_task = prev;
+    cpu->current_thread = next_task;
+
+    spinlock_irq_release(&rq->lock);
+
+    if (push) {
+        activate_task(prev, ENQUEUE_MIGRATED);
+        check_preempt_wakeup(prev);
+    }
+
+    program_next_event(cpu);
+
+    switch_to_task(prev, next_task);
+}
 
-    switch_to_task(next_task);
+void finish_task_switch(void) {
+    /* NOTE: Called with interrupts disabled on the CPU that just switched */
+    cpu_info_t *cpu = this_cpu();
+    tcb_t *prev = cpu->rq.prev_task;
+
+    cpu->rq.prev_task = NULL;
+    if (prev != NULL)
+        __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);
+}
+
+void schedule(void) {
+    uint64_t flags = irq_save();
+
+    cpu_info_t *cpu = this_cpu();
+    if (cpu == NULL || cpu->current_thread == NULL) {
+        irq_restore(flags);
+        return;
+    }
+
+    /* Check if task switches are postponed */
+    if (cpu->rq.postpone_task_switches != 0) {
+        cpu->rq.task_switch_postponed = 1;
+        irq_restore(flags);
+        return;
+    }
+
+    /* Held across the switch; the task we switch to drops it */
+    cpu->rq.postpone_task_switches++;
+
+    __schedule(cpu);
+
+    finish_task_switch();
+
+    /* We may have been resumed on another CPU */
+    cpu = this_cpu();
+    cpu->rq.postpone_task_switches--;
+
+    irq_restore(flags);
 }
 
 void yield(void) {
     lock_scheduler();
 
-    if (current_task != NULL) {
-        current_task->yield_count++;
+    tcb_t *current = get_current_task();
+    if (current != NULL) {
+        current->yield_count++;
+        this_cpu()->rq.yield_pending = true;
     }
 
     schedule();
@@ -356,11 +872,25 @@ void yield(void) {
 void block_task(uint8_t reason) {
     lock_scheduler();
 
-    if (current_task != NULL) {
-        current_task->state = reason;
+    tcb_t *current = get_current_task();
+    if (current != NULL && prepare_to_sleep(current, reason, 0))
+        schedule();
+
+    unlock_scheduler();
+}
+
+void cancel_pending_wakeup(void) {
+    lock_scheduler();
+
+    tcb_t *current = get_current_task();
+    if (current != NULL) {
+        sched_rq_t *rq = task_rq(current);
+
+        spinlock_irq_acquire(&rq->lock);
+        take_pending_wakeup(rq, current);
+        spinlock_irq_release(&rq->lock);
     }
 
-    schedule();
     unlock_scheduler();
 }
 
@@ -370,50 +900,45 @@ void unblock_task(tcb_t *task) {
     }
 
     lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
 
-    task->wakeup_count++;
+    /* Held across the enqueue so a sleeper sees either all of it or none */
+    sched_rq_t *rq = task_sleep_lock(task);
 
-    if (ready_queue_bitmap == 0 && current_task == idle_task) {
-        /* Preempt idle task immediately */
-        task->state = TASK_STATE_RUNNING;
-        spinlock_irq_release(&scheduler_data_lock);
-        switch_to_task(task);
-    } else {
-        /* Add to ready queue - will be picked up by next schedule() */
-        add_to_ready_queue(task);
-        spinlock_irq_release(&scheduler_data_lock);
+    if (task->state == TASK_STATE_TERMINATED) {
+        spinlock_irq_release(&rq->sleep_lock);
+        unlock_scheduler();
+        return;
     }
 
+    if (task->state == TASK_STATE_SLEEPING || task->state == TASK_STATE_INTERRUPTIBLE)
+        timer_wheel_del(&rq->sleepers, &task->sleep_node);
+
+    task->wakeup_count++;
+
+    activate_task(task, ENQUEUE_WAKEUP);
+    spinlock_irq_release(&rq->sleep_lock);
+
+    check_preempt_wakeup(task);
+
     unlock_scheduler();
 }
 
 void nano_sleep_until(uint64_t wake_time_ns) {
-    if (wake_time_ns <= time_since_boot_ns) {
+    if (wake_time_ns <= get_time_since_boot_ns()) {
         return;  // Already past wake time
     }
 
     lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-
-    current_task->sleep_expiry_ns = wake_time_ns;
-
-    tcb_t **insert_point = &sleeping_tasks;
-    while (*insert_point != NULL && (*insert_point)->sleep_expiry_ns <= wake_time_ns) {
-        insert_point = &(*insert_point)->next;
-    }
 
-    current_task->next = *insert_point;
-    *insert_point = current_task;
+    tcb_t *current = get_current_task();
+    if (prepare_to_sleep(current, TASK_STATE_SLEEPING, wake_time_ns))
+        schedule();
 
-    spinlock_irq_release(&scheduler_data_lock);
     unlock_scheduler();
-
-    block_task(TASK_STATE_SLEEPING);
 }
 
 void nano_sleep(uint64_t nanoseconds) {
-    nano_sleep_until(time_since_boot_ns + nanoseconds);
+    nano_sleep_until(get_time_since_boot_ns() + nanoseconds);
 }
 
 void sleep_ms(uint64_t milliseconds) {
@@ -437,24 +962,12 @@ int nano_sleep_interruptible(uint64_t nanoseconds) {
     uint64_t wake_time = get_time_since_boot_ns() + nanoseconds;
 
     lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-
-    task->sleep_expiry_ns = wake_time;
-    task->state = TASK_STATE_INTERRUPTIBLE;
-
-    tcb_t **insert_point = &sleeping_tasks;
-    while (*insert_point != NULL && (*insert_point)->sleep_expiry_ns <= wake_time) {
-        insert_point = &(*insert_point)->next;
-    }
 
-    task->next = *insert_point;
-    *insert_point = task;
+    if (prepare_to_sleep(task, TASK_STATE_INTERRUPTIBLE, wake_time))
+        schedule();
 
-    spinlock_irq_release(&scheduler_data_lock);
     unlock_scheduler();
 
-    block_task(TASK_STATE_INTERRUPTIBLE);
-
     if (task->pending_signals != 0) {
         return -1;  /* Interrupted */
     }
@@ -465,94 +978,212 @@ int nano_sleep_interruptible(uint64_t nanoseconds) {
 void task_wake_interruptible(tcb_t *task) {
     if (task == NULL) return;
 
-    lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-
     if (task->state == TASK_STATE_INTERRUPTIBLE) {
-        /* Remove from sleeping tasks queue */
-        tcb_t **prev = &sleeping_tasks;
-        tcb_t *curr = sleeping_tasks;
-
-        while (curr != NULL) {
-            if (curr == task) {
-                *prev = curr->next;
-                curr->next = NULL;
-                break;
-            }
-            prev = &curr->next;
-            curr = curr->next;
-        }
-
-        task->wakeup_count++;
-        spinlock_irq_release(&scheduler_data_lock);
         unblock_task(task);
-    } else {
-        spinlock_irq_release(&scheduler_data_lock);
     }
-
-    unlock_scheduler();
 }
 
 uint64_t get_time_since_boot_ns(void) {
-    update_time_accounting();
-    return time_since_boot_ns;
+    return read_clock();
 }
 
 void scheduler_timer_tick(void) {
     if (!scheduler_initialized) return;
-    update_time_accounting();
 
-    spinlock_irq_acquire(&scheduler_data_lock);
-    sched_stats.total_ticks++;
+    cpu_info_t *cpu = this_cpu();
+    if (cpu == NULL || cpu->current_thread == NULL) return;
 
-    tcb_t **prev_ptr = &sleeping_tasks;
-    tcb_t *task = sleeping_tasks;
+    sched_rq_t *rq = &cpu->rq;
+    uint64_t now = update_clock();
 
-    while (task != NULL && task->sleep_expiry_ns <= time_since_boot_ns) {
-        tcb_t *next = task->next;
-        *prev_ptr = next;
-        task->next = NULL;
+    spinlock_irq_acquire(&rq->sleep_lock);
 
+    wheel_node_t *node = timer_wheel_expire(&rq->sleepers, now);
+
+    while (node != NULL) {
+        wheel_node_t *next = node->next;
+        node->next = NULL;
+
+        tcb_t *task = container_of(node, tcb_t, sleep_node);
         if (task->state == TASK_STATE_SLEEPING || task->state == TASK_STATE_INTERRUPTIBLE) {
-            task->state = TASK_STATE_READY;
-            add_to_ready_queue(task);
+            activate_task(task, ENQUEUE_WAKEUP);
+            check_preempt_wakeup(task);
         }
 
-        task = next;
+        node = next;
     }
 
-    if (sched_stats.total_ticks % 10 == 0) {  /* Every ~100ms at 100Hz */
-        age_waiting_tasks();
-    }
+    spinlock_irq_release(&rq->sleep_lock);
 
-    spinlock_irq_release(&scheduler_data_lock);
+    spinlock_irq_acquire(&rq->lock);
 
-    if (time_slice_remaining_ns > 0) {
-        /* timer: ticks every 10ms at 100Hz */
-        uint64_t tick_ns = 10000000ULL;
+    update_time_accounting(cpu);
+    now = rq->clock_ns;
+    rq->stats.total_ticks++;
 
-        if (time_slice_remaining_ns <= tick_ns) {
-            time_slice_remaining_ns = 0;
-            // schedule();  /* DISABLED: Cannot task switch from interrupt */
+    bool need_resched = false;
+
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++) {
+        if (sched_classes[i]->tick != NULL && sched_classes[i]->tick(rq, now))
+            need_resched = true;
+    }
+
+    if (cpu->current_thread == rq->idle) {
+        need_resched = (rq->nr_running != 0);
+    } else if (rq->time_slice_remaining_ns > 0) {
+        /* Charge what actually elapsed; one-shot ticks are irregular */
+        uint64_t elapsed = (now > rq->slice_clock_ns) ? now - rq->slice_clock_ns : 0;
+        rq->slice_clock_ns = now;
+
+        if (rq->time_slice_remaining_ns <= elapsed) {
+            rq->time_slice_remaining_ns = 0;
+            need_resched = true;
         } else {
-            time_slice_remaining_ns -= tick_ns;
+            rq->time_slice_remaining_ns -= elapsed;
         }
     }
+
+    bool balance = (now >= rq->next_balance_ns);
+    if (balance)
+        rq->next_balance_ns = now + BALANCE_INTERVAL_NS;
+
+    spinlock_irq_release(&rq->lock);
+
+    if (balance) {
+        if (load_balance(cpu, false) && cpu->current_thread == rq->idle)
+            need_resched = true;
+    }
+
+    /* Postponed until interrupt_handler has sent the EOI */
+    if (need_resched)
+        schedule();
+    else
+        program_next_event(cpu);
 }
 
-void terminate_task(void) {
-    lock_scheduler();
+void scheduler_timer_start(void) {
+    uint64_t flags = irq_save();
+
+    cpu_info_t *cpu = this_cpu();
+
+    if (cpu != NULL && apic_timer_tsc_deadline_supported() && tsc_get_frequency() != 0) {
+        apic_timer_init_tsc_deadline(IRQ0);
+        cpu->rq.tickless = true;
+        program_next_event(cpu);
+    } else {
+        /* Periodic fallback at 1 / SCHED_TICK_NS */
+        uint64_t apic_freq = apic_timer_get_frequency();
+        uint32_t initial_count = (apic_freq / 16) / (1000000000ULL / SCHED_TICK_NS);
+        apic_timer_init(IRQ0, LAPIC_TIMER_DIV_16, initial_count, true);
+    }
+
+    irq_restore(flags);
+}
+
+void scheduler_resched_ipi(void) {
+    /* NOTE: Called from interrupt_handler with task switches postponed */
+    cpu_info_t *cpu = this_cpu();
+    if (cpu == NULL || cpu->current_thread == NULL)
+        return;
+
+    __atomic_store_n(&cpu->rq.resched_ipi_pending, 0, __ATOMIC_RELEASE);
+
+    spinlock_irq_acquire(&cpu->rq.lock);
+    cpu->rq.stats.resched_ipis++;
+    spinlock_irq_release(&cpu->rq.lock);
+
+    /* Runs once interrupt_handler drops lock_scheduler() after the EOI */
+    schedule();
+}
+
+static void reap_dead_tasks(work_t *work) {
+    (void)work;
+
+    tcb_t *dead = NULL;
+    bool busy = false;
+
+    /* Killed tasks may still sit on a wait queue, so only exited ones go */
     spinlock_irq_acquire(&scheduler_data_lock);
 
-    if (current_task != NULL) {
-        /* Add to terminated list */
-        current_task->next = terminated_tasks;
-        terminated_tasks = current_task;
+    tcb_t **link = &terminated_tasks;
+    while (*link != NULL) {
+        tcb_t *task = *link;
+
+        if (!task->exited || task->owner_proc != NULL) {
+            link = &task->next;
+        } else if (__atomic_load_n(&task->on_cpu, __ATOMIC_ACQUIRE)) {
+            busy = true;
+            link = &task->next;
+        } else {
+            *link = task->next;
+            task->next = dead;
+            dead = task;
+        }
     }
 
     spinlock_irq_release(&scheduler_data_lock);
 
-    block_task(TASK_STATE_TERMINATED);
+    if (busy)
+        queue_delayed_work(&reap_work, SCHED_TICK_NS);
+
+    if (dead == NULL)
+        return;
+
+    /* Remote CPUs may still be looking at it as someone's current_thread */
+    synchronize_rcu();
+
+    while (dead != NULL) {
+        tcb_t *task = dead;
+        dead = task->next;
+
+        kstack_free((void *)task->kernel_stack_base);
+        tcb_free(task);
+    }
+}
+
+void task_release(tcb_t *task) {
+    if (task == NULL)
+        return;
+
+    lock_scheduler();
+    task->owner_proc = NULL;
+    bool exited = task->exited;
+    unlock_scheduler();
+
+    if (exited)
+        queue_work(&reap_work.work);
+}
+
+void terminate_task(void) {
+    fpu_release_current();
+
+    lock_scheduler();
+
+    tcb_t *current = get_current_task();
+    if (current != NULL) {
+        sched_rq_t *rq = task_rq(current);
+
+        spinlock_irq_acquire(&scheduler_data_lock);
+
+        spinlock_irq_acquire(&rq->lock);
+        dequeue_task(rq, current, 0);
+        detach_task(rq, current);
+        current->state = TASK_STATE_TERMINATED;
+        spinlock_irq_release(&rq->lock);
+
+        /* Add to terminated list; nothing else links to it any more */
+        current->exited = 1;
+        current->next = terminated_tasks;
+        terminated_tasks = current;
+
+        spinlock_irq_release(&scheduler_data_lock);
+
+        /* Our own CPU's worker, so it can't run before we are switched out */
+        if (current->owner_proc == NULL)
+            queue_work(&reap_work.work);
+    }
+
+    schedule();
 
     unlock_scheduler();
 
@@ -560,14 +1191,23 @@ void terminate_task(void) {
 }
 
 void terminate_other_task(tcb_t *task) {
-    if (task == NULL || task == current_task) {
+    if (task == NULL || task == get_current_task()) {
         return;
     }
 
     lock_scheduler();
+
+    if (task->state == TASK_STATE_SLEEPING || task->state == TASK_STATE_INTERRUPTIBLE)
+        sleep_queue_remove(task);
+
     spinlock_irq_acquire(&scheduler_data_lock);
 
+    sched_rq_t *rq = task_rq_lock(task);
+    dequeue_task(rq, task, 0);
+    detach_task(rq, task);
     task->state = TASK_STATE_TERMINATED;
+    spinlock_irq_release(&rq->lock);
+
     task->next = terminated_tasks;
     terminated_tasks = task;
 
@@ -581,18 +1221,220 @@ void task_set_priority(tcb_t *task, uint8_t new_priority) {
 
     lock_scheduler();
 
+    sched_rq_t *rq = task_rq_lock(task);
+
+    /* Queued tasks must be requeued under their new bucket or weight */
+    bool queued = task->on_rq;
+    if (queued)
+        dequeue_task(rq, task, 0);
+
     task->priority = new_priority;
     task->base_priority = new_priority;
+    task->weight = sched_prio_to_weight(new_priority);
+
+    if (queued)
+        enqueue_task(rq, task, 0);
+
+    spinlock_irq_release(&rq->lock);
+
+    unlock_scheduler();
+}
+
+static int validate_sched_attr(const sched_attr_t *attr) {
+    switch (attr->policy) {
+        case SCHED_POLICY_FAIR:
+        case SCHED_POLICY_PRIO:
+            return 0;
+
+        case SCHED_POLICY_FIFO:
+        case SCHED_POLICY_RR:
+            if (attr->rt_priority < SCHED_RT_PRIO_MIN || attr->rt_priority > SCHED_RT_PRIO_MAX)
+                return -EINVAL;
+            return 0;
+
+        case SCHED_POLICY_DEADLINE:
+            if (attr->runtime_ns < SCHED_DL_RUNTIME_MIN_NS ||
+                attr->runtime_ns > attr->deadline_ns ||
+                attr->deadline_ns > attr->period_ns ||
+                attr->period_ns > SCHED_DL_PERIOD_MAX_NS)
+                return -EINVAL;
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+/* Make task's CPU pick again, e.g. after its class changed under it */
+static void resched_task_cpu(tcb_t *task) {
+    /* NOTE: Caller must hold lock_scheduler() */
+    cpu_info_t *cpu = smp_get_cpu(task->cpu);
+    if (cpu == NULL || !cpu->online)
+        return;
+
+    if (cpu == this_cpu())
+        schedule();
+    else
+        resched_cpu(cpu);
+}
+
+int task_set_sched_attr(tcb_t *task, const sched_attr_t *attr) {
+    if (task == NULL || attr == NULL)
+        return -EINVAL;
+
+    int err = validate_sched_attr(attr);
+    if (err != 0)
+        return err;
+
+    lock_scheduler();
+
+    sched_rq_t *rq = task_rq_lock(task);
+
+    if (task->state == TASK_STATE_TERMINATED) {
+        spinlock_irq_release(&rq->lock);
+        unlock_scheduler();
+        return -ESRCH;
+    }
+
+    if (attr->policy == SCHED_POLICY_DEADLINE) {
+        err = sched_dl_admit(rq, task, attr);
+        if (err != 0) {
+            spinlock_irq_release(&rq->lock);
+            unlock_scheduler();
+            return err;
+        }
+    }
+
+    bool queued = task->on_rq;
+    if (queued)
+        dequeue_task(rq, task, 0);
+
+    /* Admission above already swapped a deadline task's bandwidth */
+    if (task->policy != attr->policy)
+        detach_task(rq, task);
+
+    /* vruntime is meaningless across classes, start level with the queue */
+    if (attr->policy == SCHED_POLICY_FAIR && task->policy != SCHED_POLICY_FAIR)
+        task->vruntime = rq->fair.min_vruntime;
+
+    task->policy = attr->policy;
+    task->rt_priority = attr->rt_priority;
+
+    if (attr->policy == SCHED_POLICY_DEADLINE) {
+        task->dl_runtime_ns = attr->runtime_ns;
+        task->dl_deadline_ns = attr->deadline_ns;
+        task->dl_period_ns = attr->period_ns;
+        task->dl_budget_ns = (int64_t)attr->runtime_ns;
+        task->dl_abs_deadline_ns = get_time_since_boot_ns() + attr->deadline_ns;
+        task->dl_throttled = 0;
+    }
+
+    if (queued)
+        enqueue_task(rq, task, 0);
+
+    spinlock_irq_release(&rq->lock);
+
+    /* Running or queued, the right task may be a different one now */
+    if (queued)
+        check_preempt_wakeup(task);
+    else if (task->on_cpu)
+        resched_task_cpu(task);
+
+    unlock_scheduler();
+    return 0;
+}
+
+void task_get_sched_attr(tcb_t *task, sched_attr_t *attr) {
+    if (task == NULL || attr == NULL)
+        return;
+
+    lock_scheduler();
+
+    attr->policy = task->policy;
+    attr->rt_priority = task->rt_priority;
+    attr->runtime_ns = task->dl_runtime_ns;
+    attr->deadline_ns = task->dl_deadline_ns;
+    attr->period_ns = task->dl_period_ns;
+
+    unlock_scheduler();
+}
+
+int task_set_affinity(tcb_t *task, const cpumask_t *mask) {
+    if (task == NULL || mask == NULL)
+        return -EINVAL;
+
+    lock_scheduler();
+
+    sched_rq_t *rq = task_rq_lock(task);
+
+    cpumask_t old = task->cpus_allowed;
+    task->cpus_allowed = *mask;
+
+    /* The mask has to leave at least one online CPU the task may use */
+    bool usable = false;
+    for (uint32_t i = 0; i < g_cpu_count && !usable; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        usable = cpu != NULL && cpu->online && task_allowed_on_cpu(task, i);
+    }
+
+    int err = 0;
+    if (!usable)
+        err = -EINVAL;
+    else if (task->policy == SCHED_POLICY_DEADLINE && !cpumask_test(mask, task->cpu))
+        err = -EBUSY;   /* Bandwidth is reserved on its current CPU */
+
+    if (err != 0) {
+        task->cpus_allowed = old;
+        spinlock_irq_release(&rq->lock);
+        unlock_scheduler();
+        return err;
+    }
+
+    bool allowed_here = task_allowed_on_cpu(task, task->cpu);
+    bool requeue = task->on_rq && !allowed_here;
+
+    if (requeue)
+        dequeue_task(rq, task, 0);
+
+    spinlock_irq_release(&rq->lock);
+
+    if (requeue) {
+        /* activate_task() sees the old CPU is no longer allowed and moves it */
+        activate_task(task, 0);
+        check_preempt_wakeup(task);
+    } else if (!allowed_here && task->on_cpu) {
+        /* Pushed off by its CPU's next schedule() */
+        resched_task_cpu(task);
+    }
+
+    unlock_scheduler();
+    return 0;
+}
+
+void task_get_affinity(tcb_t *task, cpumask_t *mask) {
+    if (task == NULL || mask == NULL)
+        return;
+
+    lock_scheduler();
+
+    /* Report where the task can actually run, not just what it asked for */
+    cpumask_clear(mask);
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        if (task_allowed_on_cpu(task, i))
+            cpumask_set(mask, i);
+    }
 
     unlock_scheduler();
 }
 
 tcb_t *get_current_task(void) {
-    return current_task;
+    /* One gs-relative load, so a migration can't split it */
+    return this_cpu_read(current_thread);
 }
 
 uint64_t get_current_tid(void) {
-    return current_task ? current_task->tid : 0;
+    tcb_t *current = get_current_task();
+    return current ? current->tid : 0;
 }
 
 void task_set_owner_proc(tcb_t *task, struct pcb *proc) {
@@ -632,11 +1474,14 @@ void task_get_info(tcb_t *task, task_info_t *info) {
     strncpy(info->name, task->name, sizeof(info->name));
     info->state = task->state;
     info->priority = task->priority;
+    info->policy = task->policy;
     info->time_used_ns = task->time_used_ns;
     info->switch_count = task->switch_count;
     info->preempt_count = task->preempt_count;
     info->yield_count = task->yield_count;
     info->wakeup_count = task->wakeup_count;
+    info->cpu = task->cpu;
+    info->cpus_allowed = task->cpus_allowed;
 
     if (task->owner_proc != NULL) {
         struct pcb *proc = (struct pcb *)task->owner_proc;
@@ -652,104 +1497,197 @@ void scheduler_get_stats(sched_stats_t *stats) {
     if (stats == NULL)
         return;
 
-    lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-    *stats = sched_stats;
-    spinlock_irq_release(&scheduler_data_lock);
-    unlock_scheduler();
+    memset(stats, 0, sizeof(sched_stats_t));
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL)
+            continue;
+
+        spinlock_irq_acquire(&cpu->rq.lock);
+        stats->total_switches += cpu->rq.stats.total_switches;
+        stats->total_ticks += cpu->rq.stats.total_ticks;
+        stats->idle_time_ns += cpu->rq.stats.idle_time_ns;
+        stats->aging_boosts += cpu->rq.stats.aging_boosts;
+        stats->migrations_in += cpu->rq.stats.migrations_in;
+        stats->migrations_out += cpu->rq.stats.migrations_out;
+        stats->balance_runs += cpu->rq.stats.balance_runs;
+        stats->resched_ipis += cpu->rq.stats.resched_ipis;
+        stats->dl_throttles += cpu->rq.stats.dl_throttles;
+        spinlock_irq_release(&cpu->rq.lock);
+    }
+}
+
+int scheduler_get_cpu_stats(uint32_t cpu_id, sched_stats_t *stats) {
+    cpu_info_t *cpu = smp_get_cpu(cpu_id);
+    if (cpu == NULL || stats == NULL || cpu->rq.idle == NULL)
+        return -1;
+
+    spinlock_irq_acquire(&cpu->rq.lock);
+    *stats = cpu->rq.stats;
+    spinlock_irq_release(&cpu->rq.lock);
+
+    return 0;
+}
+
+int scheduler_get_cpu_latency(uint32_t cpu_id, sched_latency_t *latency) {
+    cpu_info_t *cpu = smp_get_cpu(cpu_id);
+    if (cpu == NULL || latency == NULL || cpu->rq.idle == NULL)
+        return -1;
+
+    spinlock_irq_acquire(&cpu->rq.lock);
+    *latency = cpu->rq.latency;
+    spinlock_irq_release(&cpu->rq.lock);
+
+    return 0;
+}
+
+void scheduler_reset_latency(void) {
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL)
+            continue;
+
+        spinlock_irq_acquire(&cpu->rq.lock);
+        memset(&cpu->rq.latency, 0, sizeof(sched_latency_t));
+        spinlock_irq_release(&cpu->rq.lock);
+    }
+}
+
+const char *scheduler_class_name(uint32_t class_idx) {
+    return (class_idx < NUM_SCHED_CLASSES) ? sched_classes[class_idx]->name : NULL;
 }
 
 void scheduler_dump_stats(void) {
-    spinlock_irq_acquire(&scheduler_data_lock);
+    sched_stats_t total;
+    scheduler_get_stats(&total);
+
+    uint64_t uptime_ns = get_time_since_boot_ns();
 
     printk("scheduler statistics:\n");
-    printk("Total context switches: %lu\n", sched_stats.total_switches);
-    printk("Total timer ticks: %lu\n", sched_stats.total_ticks);
-    printk("idle time: %lu ms (%lu%%)\n",
-           sched_stats.idle_time_ns / 1000000,
-           time_since_boot_ns > 0 ? (sched_stats.idle_time_ns * 100) / time_since_boot_ns : 0);
-    printk("aging boosts: %lu\n", sched_stats.aging_boosts);
-    printk("uptime: %lu ms\n", time_since_boot_ns / 1000000);
+    printk("Total context switches: %lu\n", total.total_switches);
+    printk("Total timer ticks: %lu\n", total.total_ticks);
+    printk("idle time: %lu ms\n", total.idle_time_ns / 1000000);
+    printk("aging boosts: %lu\n", total.aging_boosts);
+    printk("migrations: %lu\n", total.migrations_in);
+    printk("reschedule IPIs: %lu\n", total.resched_ipis);
+    printk("deadline throttles: %lu\n", total.dl_throttles);
+    printk("uptime: %lu ms\n", uptime_ns / 1000000);
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu->rq.idle == NULL)
+            continue;
+
+        sched_stats_t *st = &cpu->rq.stats;
+        printk("cpu%u: switches=%lu ticks=%lu idle=%lu ms (%lu%%) ready=%u\n",
+               cpu->cpu_id, st->total_switches, st->total_ticks,
+               st->idle_time_ns / 1000000,
+               uptime_ns > 0 ? (st->idle_time_ns * 100) / uptime_ns : 0,
+               cpu->rq.nr_running);
+        printk("      migrations in=%lu out=%lu, balance runs=%lu, resched IPIs=%lu\n",
+               st->migrations_in, st->migrations_out, st->balance_runs,
+               st->resched_ipis);
+    }
     printk("===========================\n\n");
-
-    spinlock_irq_release(&scheduler_data_lock);
 }
 
-void scheduler_dump_tasks(void) {
-    spinlock_irq_acquire(&scheduler_data_lock);
+static const char *state_names[] = {
+    "RUNNING", "READY", "SLEEPING", "PAUSED",
+    "WAITING_LOCK", "TERMINATED", "WAITING_EVENT", "INTERRUPTIBLE"
+};
 
-    printk("task dump:\n");
+static void dump_cpu_tasks(cpu_info_t *cpu) {
+    sched_rq_t *rq = &cpu->rq;
+    tcb_t *current = cpu->current_thread;
+
+    printk("cpu%u:\n", cpu->cpu_id);
+
+    if (current) {
+        printk("current: [%lu] %s (state=%s, class=%s, prio=%u/%u, time=%lu ms, switches=%lu)\n",
+               current->tid, current->name,
+               current->state < 8 ? state_names[current->state] : "UNKNOWN",
+               sched_class_of(current)->name,
+               current->priority, current->base_priority,
+               current->time_used_ns / 1000000,
+               current->switch_count);
+
+        printk("         preempts=%lu, yields=%lu, wakeups=%lu, cpus=%lx",
+               current->preempt_count, current->yield_count,
+               current->wakeup_count, current->cpus_allowed.bits[0]);
 
-    if (current_task) {
-        const char *state_names[] = {
-            "RUNNING", "READY", "SLEEPING", "PAUSED",
-            "WAITING_LOCK", "TERMINATED", "WAITING_EVENT", "INTERRUPTIBLE"
-        };
-
-        printk("current: [%lu] %s (state=%s, prio=%u/%u, time=%lu ms, switches=%lu)\n",
-               current_task->tid, current_task->name,
-               current_task->state < 8 ? state_names[current_task->state] : "UNKNOWN",
-               current_task->priority, current_task->base_priority,
-               current_task->time_used_ns / 1000000,
-               current_task->switch_count);
-
-        printk("         preempts=%lu, yields=%lu, wakeups=%lu",
-               current_task->preempt_count, current_task->yield_count,
-               current_task->wakeup_count);
-
-        if (current_task->owner_proc != NULL) {
-            struct pcb *proc = (struct pcb *)current_task->owner_proc;
+        if (current->owner_proc != NULL) {
+            struct pcb *proc = (struct pcb *)current->owner_proc;
             printk(", PID=%lu", proc->pid);
         }
         printk("\n");
     }
 
-    printk("\nready queues (by priority):\n");
-    for (int i = NUM_PRIORITY_QUEUES - 1; i >= 0; i--) {
-        if (ready_queue_heads[i] != NULL) {
-            printk("  queue %d (priority %u-%u):\n", i, i * 32, (i * 32) + 31);
-            tcb_t *task = ready_queue_heads[i];
-            int count = 0;
-            while (task != NULL && count < 20) {
-                printk("    [%lu] %s (prio=%u/%u, time=%lu ms, waits=%lu)\n",
-                       task->tid, task->name,
-                       task->priority, task->base_priority,
-                       task->time_used_ns / 1000000,
-                       task->wait_ticks);
-
-                if (task->owner_proc != NULL) {
-                    struct pcb *proc = (struct pcb *)task->owner_proc;
-                    printk("           PID=%lu", proc->pid);
-                }
+    for (size_t i = 0; i < NUM_SCHED_CLASSES; i++)
+        sched_classes[i]->dump(rq);
+}
 
-                task = task->next;
-                count++;
-            }
-        }
+void scheduler_dump_tasks(void) {
+    printk("task dump:\n");
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu->rq.idle == NULL)
+            continue;
+
+        spinlock_irq_acquire(&cpu->rq.lock);
+        dump_cpu_tasks(cpu);
+        spinlock_irq_release(&cpu->rq.lock);
     }
 
-    printk("\nsleeping tasks (sorted by wake time):\n");
-    tcb_t *task = sleeping_tasks;
-    int count = 0;
-    while (task != NULL && count < 20) {
-        const char *sleep_type = (task->state == TASK_STATE_INTERRUPTIBLE) ?
-                                 "interruptible" : "sleeping";
+    uint64_t now = get_time_since_boot_ns();
+
+    printk("\nsleeping tasks:\n");
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu->rq.idle == NULL)
+            continue;
+
+        spinlock_irq_acquire(&cpu->rq.sleep_lock);
 
-        printk("  [%lu] %s (%s, wake=%lu ms, in %ld ms)\n",
-               task->tid, task->name, sleep_type,
-               task->sleep_expiry_ns / 1000000,
-               (int64_t)(task->sleep_expiry_ns - time_since_boot_ns) / 1000000);
-        task = task->next;
-        count++;
+        timer_wheel_t *wheel = &cpu->rq.sleepers;
+        if (wheel->count > 0)
+            printk(" cpu%u (%u sleeping):\n", cpu->cpu_id, wheel->count);
+
+        int count = 0;
+        for (uint32_t level = 0; level < WHEEL_LEVELS && count < 20; level++) {
+            for (uint32_t slot = 0; slot < WHEEL_SLOTS && count < 20; slot++) {
+                wheel_node_t *node = wheel->slots[level][slot];
+                for (; node != NULL && count < 20; node = node->next, count++) {
+                    tcb_t *task = container_of(node, tcb_t, sleep_node);
+                    const char *sleep_type = (task->state == TASK_STATE_INTERRUPTIBLE) ?
+                                             "interruptible" : "sleeping";
+
+                    printk("  [%lu] %s (%s, wake=%lu ms, in %ld ms)\n",
+                           task->tid, task->name, sleep_type,
+                           task->sleep_expiry_ns / 1000000,
+                           (int64_t)(task->sleep_expiry_ns - now) / 1000000);
+                }
+            }
+        }
+
+        spinlock_irq_release(&cpu->rq.sleep_lock);
     }
 
     printk("================\n\n");
+}
 
-    spinlock_irq_release(&scheduler_data_lock);
+bool scheduler_cpu_idle(void) {
+    /* NOTE: A hint; a wakeup may land right after it was read */
+    return __atomic_load_n(&this_cpu()->rq.nr_running, __ATOMIC_RELAXED) == 0;
 }
 
 void idle_task_entry(void) {
     for (;;) {
+        /* Refilling the zeroed page pools is the only background work */
+        pmm_zero_idle();
+
         __asm__ volatile("sti; hlt");
 	yield();
     }
@@ -763,26 +1701,35 @@ void scheduler_init(void) {
         return;
     }
 
+    cpu_info_t *bsp = this_cpu();
+    if (bsp == NULL) {
+        epanic("sched", "no cpu_info for the boot CPU");
+        for (;;) __asm__("hlt");
+    }
 
     last_tsc = rdtsc();
     time_since_boot_ns = 0;
 
-    memset(&sched_stats, 0, sizeof(sched_stats_t));
+    tcb_cache = heap_create_slab_cache("tcb", sizeof(tcb_t), 64);
+    delayed_work_init(&reap_work, reap_dead_tasks);
 
-    tcb_t *boot_task = (tcb_t *)kmalloc(sizeof(tcb_t));
+    tcb_t *boot_task = tcb_alloc();
     if (boot_task == NULL) {
         epanic("sched", "failed to allocate boot task TCB");
         for (;;) __asm__("hlt");
     }
 
-    memset(boot_task, 0, sizeof(tcb_t));
-
     boot_task->tid = 0;
     strncpy(boot_task->name, "boot", sizeof(boot_task->name) - 1);
     boot_task->cr3 = paging_get_pml4();
     boot_task->state = TASK_STATE_RUNNING;
     boot_task->priority = PRIORITY_NORMAL;
     boot_task->base_priority = PRIORITY_NORMAL;
+    boot_task->policy = SCHED_POLICY_DEFAULT;
+    boot_task->weight = sched_prio_to_weight(PRIORITY_NORMAL);
+    boot_task->cpu = bsp->cpu_id;
+    cpumask_setall(&boot_task->cpus_allowed);
+    boot_task->on_cpu = 1;
     boot_task->next = NULL;
 
     boot_task->owner_proc = NULL;  /* Will be set by proc_init() */
@@ -803,33 +1750,62 @@ void scheduler_init(void) {
     boot_task->kernel_stack_size = KERNEL_STACK_SIZE;
     boot_task->rsp = 0;  /* Will be set on first task switch */
 
+    /* One idle task per CPU; they are never queued */
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || !cpu->online)
+            continue;
 
+        spinlock_irq_init_named(&cpu->rq.lock, "rq.lock");
+        spinlock_irq_init_named(&cpu->rq.sleep_lock, "rq.sleep_lock");
+        timer_wheel_init(&cpu->rq.sleepers, 0);
 
-    current_task = boot_task;
+        char name[32];
+        snprintk(name, sizeof(name), "idle%u", cpu->cpu_id);
 
-    idle_task = create_kernel_task(idle_task_entry, "idle", PRIORITY_IDLE);
-    if (idle_task == NULL) {
-        epanic("sched", "failed to create idle task");
-        for (;;) __asm__("hlt");
-    }
-
-    lock_scheduler();
-    spinlock_irq_acquire(&scheduler_data_lock);
-
-    int idle_queue = priority_to_queue(PRIORITY_IDLE);
-    if (ready_queue_heads[idle_queue] == idle_task) {
-        ready_queue_heads[idle_queue] = idle_task->next;
-        if (ready_queue_heads[idle_queue] == NULL) {
-            ready_queue_tails[idle_queue] = NULL;
-            ready_queue_bitmap &= ~(1 << idle_queue);
+        tcb_t *idle = create_kernel_task_paused(idle_task_entry, name, PRIORITY_IDLE);
+        if (idle == NULL) {
+            epanic("sched", "failed to create idle task");
+            for (;;) __asm__("hlt");
         }
+        idle->cpu = cpu->cpu_id;
+        cpumask_clear(&idle->cpus_allowed);
+        cpumask_set(&idle->cpus_allowed, cpu->cpu_id);
+        cpu->rq.idle = idle;
     }
-    idle_task->next = NULL;
 
-    spinlock_irq_release(&scheduler_data_lock);
-    unlock_scheduler();
+    bsp->rq.clock_ns = 0;
+    bsp->current_thread = boot_task;
 
-    scheduler_initialized = 1;
+    __atomic_store_n(&scheduler_initialized, 1, __ATOMIC_RELEASE);
 
     eend(0, NULL);
 }
+
+void scheduler_ap_start(void) {
+    /* Park until the BSP has built the run queues */
+    while (!__atomic_load_n(&scheduler_initialized, __ATOMIC_ACQUIRE))
+        __asm__ volatile("sti; hlt");
+
+    __asm__ volatile("cli");
+
+    cpu_info_t *cpu = this_cpu();
+    if (cpu == NULL || cpu->rq.idle == NULL)
+        for (;;) __asm__ volatile("cli; hlt");
+
+    tcb_t *idle = cpu->rq.idle;
+
+    cpu->rq.clock_ns = get_time_since_boot_ns();
+
+    /* Dropped by task_startup_wrapper once the idle task is running */
+    cpu->rq.postpone_task_switches = 1;
+
+    idle->state = TASK_STATE_RUNNING;
+    idle->on_cpu = 1;
+    cpu->current_thread = idle;
+
+    scheduler_timer_start();
+
+    /* The AP's boot stack is abandoned here */
+    switch_to_task(NULL, idle);
+}
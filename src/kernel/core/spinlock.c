@@ -1,37 +1,18 @@
 #include <arch/x86_64/atomic.h>
+#include <arch/x86_64/irqflags.h>
+#include <arch/x86_64/tsc.h>
 
 #include <core/spinlock.h>
 
+#include <mm/mmu.h>
+
+#include <klibc/string.h>
+
 static inline void cpu_pause(void)
 {
     __asm__ volatile("pause" ::: "memory");
 }
 
-static inline uint64_t save_irq_disable(void)
-{
-    uint64_t flags;
-    __asm__ volatile(
-        "pushfq\n\t"           /* Push RFLAGS onto stack */
-        "pop %0\n\t"           /* Pop into flags variable */
-        "cli"                  /* Disable interrupts */
-        : "=r"(flags)
-        :
-        : "memory"
-    );
-    return flags;
-}
-
-static inline void restore_irq(uint64_t flags)
-{
-    __asm__ volatile(
-        "push %0\n\t"          /* Push flags onto stack */
-        "popfq"                /* Pop into RFLAGS */
-        :
-        : "r"(flags)
-        : "memory", "cc"
-    );
-}
-
 void spinlock_init(spinlock_t *lock)
 {
     atomic_store_32(&lock->lock, 0);
@@ -80,40 +61,165 @@ bool spinlock_is_locked(spinlock_t *lock)
     return (atomic_load_acquire_32(&lock->lock) & 1) != 0;
 }
 
+#if SPINLOCK_LOCKSTAT
+static spinlock_irq_t *volatile lockstat_list;
+
+static inline void lockstat_acquired(spinlock_irq_t *lock, uint64_t wait_start) {
+    /* NOTE: Caller must hold lock */
+    uint64_t now = rdtsc();
+
+    lock->stat.acquisitions++;
+    if (wait_start != 0) {
+        lock->stat.contended++;
+        lock->stat.wait_cycles += now - wait_start;
+    }
+    lock->stat.hold_start = now;
+
+    /* First acquisition of a named lock publishes it; the flag is ours to test */
+    if (lock->name != NULL && !lock->stat_listed) {
+        lock->stat_listed = true;
+        spinlock_irq_t *head = lockstat_list;
+        do {
+            lock->stat_next = head;
+        } while (!__atomic_compare_exchange_n(&lockstat_list, &head, lock, false,
+                                              __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+}
+
+static inline void lockstat_released(spinlock_irq_t *lock) {
+    lock->stat.hold_cycles += rdtsc() - lock->stat.hold_start;
+}
+#else
+static inline void lockstat_acquired(spinlock_irq_t *lock, uint64_t wait_start) {
+    (void)lock;
+    (void)wait_start;
+}
+
+static inline void lockstat_released(spinlock_irq_t *lock) {
+    (void)lock;
+}
+#endif
+
 void spinlock_irq_init(spinlock_irq_t *lock)
+{
+    spinlock_irq_init_named(lock, NULL);
+}
+
+void spinlock_irq_init_named(spinlock_irq_t *lock, const char *name)
 {
     atomic_store_32(&lock->lock, 0);
     lock->flags = 0;
+    lock->tail = NULL;
+#if SPINLOCK_LOCKSTAT
+    lock->name = name;
+    lock->stat_next = NULL;
+    lock->stat_listed = false;
+    memset(&lock->stat, 0, sizeof(lock->stat));
+#else
+    (void)name;
+#endif
 }
 
-void spinlock_irq_acquire(spinlock_irq_t *lock)
+static inline bool spinlock_irq_try_lock(spinlock_irq_t *lock)
 {
-    uint64_t flags = save_irq_disable();
+    uint32_t expected = 0;
+    return atomic_compare_exchange_32(&lock->lock, &expected, 1);
+}
 
-    if (!atomic_bit_test_and_set_32(&lock->lock, 0)) {
-        /* Lock acquired on first try */
-        lock->flags = flags;
-        return;
+/*
+ * A waiter spins with interrupts off, so it can't take the TLB flush
+ * IPI. The lock holder may be waiting for exactly that ack, so every
+ * wait loop here answers shootdowns by hand.
+ */
+static inline void spinlock_irq_relax(void)
+{
+    mmu_tlb_shootdown_poll();
+    cpu_pause();
+}
+
+static void spinlock_irq_acquire_slow(spinlock_irq_t *lock)
+{
+    mcs_node_t node = { .next = NULL, .wait = 1 };
+
+    /* Join the queue, then wait for the waiter ahead of us to make us head */
+    mcs_node_t *prev = __atomic_exchange_n(&lock->tail, &node, __ATOMIC_ACQ_REL);
+    if (prev != NULL) {
+        __atomic_store_n(&prev->next, &node, __ATOMIC_RELEASE);
+        while (atomic_load_acquire_32(&node.wait))
+            spinlock_irq_relax();
     }
 
-    while (1) {
-        cpu_pause();
+    /* Head of the queue: the only waiter touching the lock word */
+    for (;;) {
+        if (atomic_load_acquire_32(&lock->lock) == 0 && spinlock_irq_try_lock(lock))
+            break;
+        spinlock_irq_relax();
+    }
 
-        if ((atomic_load_acquire_32(&lock->lock) & 1) == 0) {
-            if (!atomic_bit_test_and_set_32(&lock->lock, 0)) {
-                /* Lock acquired */
-                lock->flags = flags;
-                return;
-            }
-        }
+    /* Pass the head on; node must not be referenced once we return */
+    mcs_node_t *self = &node;
+    if (__atomic_compare_exchange_n(&lock->tail, &self, NULL, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        return;
+
+    mcs_node_t *next;
+    while ((next = __atomic_load_n(&node.next, __ATOMIC_ACQUIRE)) == NULL)
+        spinlock_irq_relax();
+    atomic_store_release_32(&next->wait, 0);
+}
+
+void spinlock_irq_acquire(spinlock_irq_t *lock)
+{
+    uint64_t flags = irq_save();
+    uint64_t wait_start = 0;
+
+    /* Fast path only when nobody is queued, so waiters aren't starved */
+    if (lock->tail != NULL || !spinlock_irq_try_lock(lock)) {
+        if (SPINLOCK_LOCKSTAT)
+            wait_start = rdtsc();
+        spinlock_irq_acquire_slow(lock);
     }
+
+    lock->flags = flags;
+    lockstat_acquired(lock, wait_start);
 }
 
 void spinlock_irq_release(spinlock_irq_t *lock)
 {
     uint64_t flags = lock->flags;
 
+    lockstat_released(lock);
     atomic_store_release_32(&lock->lock, 0);
 
-    restore_irq(flags);
+    irq_restore(flags);
+}
+
+void lockstat_for_each(void (*fn)(const char *name, const lockstat_t *stat, void *data),
+                       void *data)
+{
+#if SPINLOCK_LOCKSTAT
+    /* Entries are never unlinked; counters are read without their lock */
+    for (spinlock_irq_t *lock = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE);
+         lock != NULL; lock = lock->stat_next) {
+        lockstat_t snap = lock->stat;
+        fn(lock->name, &snap, data);
+    }
+#else
+    (void)fn;
+    (void)data;
+#endif
+}
+
+void lockstat_reset(void)
+{
+#if SPINLOCK_LOCKSTAT
+    /* Racy against a concurrent holder, which is fine for statistics */
+    for (spinlock_irq_t *lock = __atomic_load_n(&lockstat_list, __ATOMIC_ACQUIRE);
+         lock != NULL; lock = lock->stat_next) {
+        lock->stat.acquisitions = 0;
+        lock->stat.contended = 0;
+        lock->stat.wait_cycles = 0;
+        lock->stat.hold_cycles = 0;
+    }
+#endif
 }
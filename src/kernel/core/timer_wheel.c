@@ -0,0 +1,175 @@
+#include <core/timer_wheel.h>
+
+#include <klibc/string.h>
+
+static inline uint64_t ns_to_jiffies_up(uint64_t ns) {
+    return (ns + WHEEL_GRAN_NS - 1) >> WHEEL_GRAN_SHIFT;
+}
+
+static void wheel_link(timer_wheel_t *wheel, wheel_node_t *node,
+                       uint32_t level, uint32_t slot) {
+    wheel_node_t **head = &wheel->slots[level][slot];
+
+    node->next = *head;
+    if (*head != NULL)
+        (*head)->pprev = &node->next;
+    *head = node;
+    node->pprev = head;
+
+    node->level = level;
+    node->slot = slot;
+    wheel->bitmap[level] |= 1ULL << slot;
+}
+
+static void wheel_place(timer_wheel_t *wheel, wheel_node_t *node) {
+    uint64_t expires = node->expires;
+
+    /* Already due: fire on the slot being processed next */
+    if (expires < wheel->clk)
+        expires = wheel->clk;
+
+    uint64_t delta = expires - wheel->clk;
+    if (delta > WHEEL_MAX_DELTA) {
+        expires = wheel->clk + WHEEL_MAX_DELTA;
+        delta = WHEEL_MAX_DELTA;
+    }
+
+    uint32_t level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << ((level + 1) * WHEEL_SLOT_BITS)))
+        level++;
+
+    uint32_t slot = (expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    wheel_link(wheel, node, level, slot);
+}
+
+static void wheel_cascade(timer_wheel_t *wheel, uint32_t level, uint32_t slot) {
+    wheel_node_t *node = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    wheel->bitmap[level] &= ~(1ULL << slot);
+
+    while (node != NULL) {
+        wheel_node_t *next = node->next;
+        wheel_place(wheel, node);
+        node = next;
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *wheel, uint64_t now_ns) {
+    memset(wheel, 0, sizeof(timer_wheel_t));
+    wheel->clk = now_ns >> WHEEL_GRAN_SHIFT;
+}
+
+void timer_wheel_add(timer_wheel_t *wheel, wheel_node_t *node, uint64_t expires_ns) {
+    if (wheel_node_pending(node))
+        timer_wheel_del(wheel, node);
+
+    node->expires = ns_to_jiffies_up(expires_ns);
+    wheel_place(wheel, node);
+    wheel->count++;
+}
+
+void timer_wheel_del(timer_wheel_t *wheel, wheel_node_t *node) {
+    if (!wheel_node_pending(node))
+        return;
+
+    *node->pprev = node->next;
+    if (node->next != NULL)
+        node->next->pprev = node->pprev;
+
+    if (wheel->slots[node->level][node->slot] == NULL)
+        wheel->bitmap[node->level] &= ~(1ULL << node->slot);
+
+    node->next = NULL;
+    node->pprev = NULL;
+    wheel->count--;
+}
+
+wheel_node_t *timer_wheel_expire(timer_wheel_t *wheel, uint64_t now_ns) {
+    uint64_t now = now_ns >> WHEEL_GRAN_SHIFT;
+    wheel_node_t *expired = NULL;
+
+    while (wheel->clk <= now) {
+        if (wheel->count == 0) {
+            wheel->clk = now + 1;
+            break;
+        }
+
+        uint32_t idx = wheel->clk & WHEEL_SLOT_MASK;
+
+        /* Level 0 wrapped: pull the next slot of each coarser level down */
+        if (idx == 0) {
+            for (uint32_t level = 1; level < WHEEL_LEVELS; level++) {
+                uint32_t slot = (wheel->clk >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+                wheel_cascade(wheel, level, slot);
+                if (slot != 0)
+                    break;
+            }
+        }
+
+        /* Skip straight to the next populated slot or the next wrap */
+        uint64_t pending = wheel->bitmap[0] >> idx;
+        if (!(pending & 1)) {
+            uint64_t next = pending ? wheel->clk + __builtin_ctzll(pending)
+                                    : (wheel->clk | WHEEL_SLOT_MASK) + 1;
+            wheel->clk = (next > now + 1) ? now + 1 : next;
+            continue;
+        }
+
+        wheel_node_t *node = wheel->slots[0][idx];
+        wheel->slots[0][idx] = NULL;
+        wheel->bitmap[0] &= ~(1ULL << idx);
+
+        while (node != NULL) {
+            wheel_node_t *next = node->next;
+
+            if (node->expires > wheel->clk) {
+                /* Clamped at WHEEL_MAX_DELTA, not due yet */
+                wheel_place(wheel, node);
+            } else {
+                node->pprev = NULL;
+                node->next = expired;
+                expired = node;
+                wheel->count--;
+            }
+
+            node = next;
+        }
+
+        wheel->clk++;
+    }
+
+    return expired;
+}
+
+static uint64_t wheel_next_in_level(const timer_wheel_t *wheel, uint32_t level) {
+    uint64_t bits = wheel->bitmap[level];
+    if (bits == 0)
+        return UINT64_MAX;
+
+    /* Coarser slots are due when clk reaches the boundary that cascades them */
+    uint32_t shift = level * WHEEL_SLOT_BITS;
+    uint64_t base = wheel->clk >> shift;
+    if (level > 0 && (wheel->clk & ((1ULL << shift) - 1)) != 0)
+        base++;
+
+    uint32_t pos = base & WHEEL_SLOT_MASK;
+    uint64_t rotated = (bits >> pos) | (pos != 0 ? bits << (WHEEL_SLOTS - pos) : 0);
+
+    return (base + __builtin_ctzll(rotated)) << shift;
+}
+
+uint64_t timer_wheel_next_expiry(const timer_wheel_t *wheel) {
+    if (wheel->count == 0)
+        return UINT64_MAX;
+
+    uint64_t next = UINT64_MAX;
+    for (uint32_t level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t when = wheel_next_in_level(wheel, level);
+        if (when < next)
+            next = when;
+    }
+
+    return next << WHEEL_GRAN_SHIFT;
+}
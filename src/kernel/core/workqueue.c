@@ -0,0 +1,244 @@
+#include <arch/x86_64/smp.h>
+
+#include <core/workqueue.h>
+#include <core/scheduler.h>
+#include <core/spinlock.h>
+
+#include <mm/heap.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+#include <klibc/string.h>
+
+/* One pool per CPU, each drained by a kworker pinned to that CPU */
+typedef struct worker_pool {
+    spinlock_irq_t lock;            /* Protects everything below */
+    work_t *head;
+    work_t *tail;
+    timer_wheel_t timers;           /* Armed delayed work */
+    tcb_t *worker;
+    bool idle;                      /* Worker is (about to be) asleep */
+    uint64_t processed;
+} worker_pool_t;
+
+static worker_pool_t *pools[SMP_MAX_CPUS];
+
+static inline worker_pool_t *this_pool(void) {
+    cpu_info_t *cpu = smp_get_current_cpu();
+    return (cpu != NULL) ? pools[cpu->cpu_id] : NULL;
+}
+
+static void pool_append(worker_pool_t *pool, work_t *work) {
+    /* NOTE: Caller must hold pool->lock */
+    work->next = NULL;
+    if (pool->tail == NULL)
+        pool->head = work;
+    else
+        pool->tail->next = work;
+    pool->tail = work;
+}
+
+static bool pool_claim_worker(worker_pool_t *pool) {
+    /* NOTE: Caller must hold pool->lock; true if the worker needs a wakeup */
+    bool wake = pool->idle;
+    pool->idle = false;
+    return wake;
+}
+
+static void pool_expire_timers(worker_pool_t *pool, uint64_t now) {
+    /* NOTE: Caller must hold pool->lock */
+    wheel_node_t *node = timer_wheel_expire(&pool->timers, now);
+
+    while (node != NULL) {
+        wheel_node_t *next = node->next;
+        delayed_work_t *dwork = container_of(node, delayed_work_t, timer);
+
+        pool_append(pool, &dwork->work);
+        node = next;
+    }
+}
+
+static void worker_thread(void) {
+    /* Pinned before it was started, so the pool never changes under us */
+    worker_pool_t *pool = this_pool();
+
+    for (;;) {
+        spinlock_irq_acquire(&pool->lock);
+
+        pool_expire_timers(pool, get_time_since_boot_ns());
+
+        work_t *list = pool->head;
+        pool->head = NULL;
+        pool->tail = NULL;
+
+        if (list == NULL) {
+            uint64_t next = timer_wheel_next_expiry(&pool->timers);
+            pool->idle = true;
+            spinlock_irq_release(&pool->lock);
+
+            /* A queue_work() in between leaves a pending wakeup, nothing is lost */
+            if (next == UINT64_MAX)
+                block_task(TASK_STATE_WAITING_EVENT);
+            else
+                nano_sleep_until(next);
+
+            spinlock_irq_acquire(&pool->lock);
+            pool->idle = false;
+            spinlock_irq_release(&pool->lock);
+            continue;
+        }
+
+        spinlock_irq_release(&pool->lock);
+
+        while (list != NULL) {
+            work_t *work = list;
+            list = work->next;
+            work->next = NULL;
+
+            /* Cleared first, so the function may queue itself again */
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+            work->func(work);
+            pool->processed++;
+        }
+    }
+}
+
+void work_init(work_t *work, work_func_t func) {
+    work->next = NULL;
+    work->func = func;
+    work->pending = 0;
+}
+
+void delayed_work_init(delayed_work_t *dwork, work_func_t func) {
+    work_init(&dwork->work, func);
+    memset(&dwork->timer, 0, sizeof(dwork->timer));
+    dwork->cpu = 0;
+}
+
+static bool queue_work_pool(worker_pool_t *pool, work_t *work) {
+    if (pool == NULL || work == NULL)
+        return false;
+
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL))
+        return false;
+
+    spinlock_irq_acquire(&pool->lock);
+    pool_append(pool, work);
+    bool wake = pool_claim_worker(pool);
+    spinlock_irq_release(&pool->lock);
+
+    if (wake)
+        unblock_task(pool->worker);
+
+    return true;
+}
+
+bool queue_work(work_t *work) {
+    worker_pool_t *pool = this_pool();
+
+    /* A CPU without a worker hands its work to the boot CPU's */
+    return queue_work_pool(pool != NULL ? pool : pools[0], work);
+}
+
+bool queue_work_on(uint32_t cpu, work_t *work) {
+    if (cpu >= SMP_MAX_CPUS)
+        return false;
+    return queue_work_pool(pools[cpu], work);
+}
+
+bool queue_delayed_work(delayed_work_t *dwork, uint64_t delay_ns) {
+    if (dwork == NULL)
+        return false;
+
+    if (delay_ns == 0)
+        return queue_work(&dwork->work);
+
+    cpu_info_t *cpu = smp_get_current_cpu();
+    worker_pool_t *pool = this_pool();
+    if (pool == NULL)
+        return false;
+
+    if (__atomic_exchange_n(&dwork->work.pending, 1, __ATOMIC_ACQ_REL))
+        return false;
+
+    dwork->cpu = cpu->cpu_id;
+
+    spinlock_irq_acquire(&pool->lock);
+    timer_wheel_add(&pool->timers, &dwork->timer, get_time_since_boot_ns() + delay_ns);
+
+    /* The worker may be asleep until a later timer, or with none at all */
+    bool wake = pool_claim_worker(pool);
+    spinlock_irq_release(&pool->lock);
+
+    if (wake)
+        unblock_task(pool->worker);
+
+    return true;
+}
+
+bool cancel_delayed_work(delayed_work_t *dwork) {
+    if (dwork == NULL || dwork->cpu >= SMP_MAX_CPUS || pools[dwork->cpu] == NULL)
+        return false;
+
+    worker_pool_t *pool = pools[dwork->cpu];
+    bool cancelled = false;
+
+    spinlock_irq_acquire(&pool->lock);
+    if (wheel_node_pending(&dwork->timer)) {
+        timer_wheel_del(&pool->timers, &dwork->timer);
+        __atomic_store_n(&dwork->work.pending, 0, __ATOMIC_RELEASE);
+        cancelled = true;
+    }
+    spinlock_irq_release(&pool->lock);
+
+    return cancelled;
+}
+
+void workqueue_init(void) {
+    ebegin("Starting kernel workers");
+
+    uint64_t now = get_time_since_boot_ns();
+    uint32_t started = 0;
+
+    for (uint32_t i = 0; i < smp_get_cpu_count() && i < SMP_MAX_CPUS; i++) {
+        cpu_info_t *cpu = smp_get_cpu(i);
+        if (cpu == NULL || !cpu->online)
+            continue;
+
+        worker_pool_t *pool = (worker_pool_t *)kmalloc(sizeof(worker_pool_t));
+        if (pool == NULL) {
+            eerror("workqueue: no memory for cpu%u's pool\n", i);
+            continue;
+        }
+
+        memset(pool, 0, sizeof(worker_pool_t));
+        spinlock_irq_init(&pool->lock);
+        timer_wheel_init(&pool->timers, now);
+
+        char name[32] = "kworker/";
+        size_t len = strlen(name);
+        if (i >= 10)
+            name[len++] = '0' + (char)(i / 10);
+        name[len++] = '0' + (char)(i % 10);
+        name[len] = '\0';
+
+        tcb_t *worker = create_kernel_task_paused(worker_thread, name, PRIORITY_HIGH);
+        if (worker == NULL) {
+            kfree(pool);
+            continue;
+        }
+
+        cpumask_t mask;
+        cpumask_clear(&mask);
+        cpumask_set(&mask, i);
+        task_set_affinity(worker, &mask);
+
+        pool->worker = worker;
+        pools[i] = pool;
+        task_start(worker);
+        started++;
+    }
+
+    eend(started == 0 ? -1 : 0, NULL);
+}
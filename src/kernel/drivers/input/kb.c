@@ -5,6 +5,8 @@
 #include <arch/x86_64/intr.h>
 #include <arch/x86_64/io.h>
 
+#include <core/workqueue.h>
+
 #include <video/printk.h>
 #include <video/log.h>
 
@@ -73,6 +75,13 @@ static uint16_t      kb_modifiers = 0;
 static uint8_t       kb_led_state = 0;
 static kb_callback_t kb_callback  = NULL;
 
+static void kb_work_fn(work_t *work) {
+    (void)work;
+    kb_poll();
+}
+
+static work_t kb_work = WORK_INIT(kb_work_fn);
+
 static void kb_irq_handler(struct interrupt_frame *frame) {
     (void)frame;
 
@@ -86,6 +95,9 @@ static void kb_irq_handler(struct interrupt_frame *frame) {
         kb_buf[kb_buf_head] = sc;
         kb_buf_head = next;
     }
+
+    /* Decoding and the callback run later in a kworker */
+    queue_work(&kb_work);
 }
 
 void kb_poll(void) {
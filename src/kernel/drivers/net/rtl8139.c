@@ -4,6 +4,8 @@
 #include <arch/x86_64/idt.h>
 #include <arch/x86_64/io.h>
 
+#include <core/workqueue.h>
+
 #include <drivers/net/rtl8139.h>
 #include <drivers/pci.h>
 
@@ -39,18 +41,15 @@ static int rtl_wait_cmd(uint8_t mask, uint8_t target, uint32_t timeout_iters)
     return -1;
 }
 
-static void rtl8139_irq_handler(struct interrupt_frame *frame)
-{
-    (void)frame;
+#define RTL_ISR_RX_EVENTS   (RTL_ISR_ROK | RTL_ISR_RER | RTL_ISR_RXOVW | RTL_ISR_FOVW)
 
-    if (!g_rtl_ready)
-        return;
+static volatile uint16_t g_rx_events;    /* RX status bits left for the worker */
 
-    uint16_t isr = rtl_r16(RTL_INTRSTATUS);
-    if (!isr)
-        return;   /* Shared IRQ line — not us */
+static void rtl8139_rx_work(work_t *work)
+{
+    (void)work;
 
-    rtl_w16(RTL_INTRSTATUS, isr);
+    uint16_t isr = __atomic_exchange_n(&g_rx_events, 0, __ATOMIC_ACQ_REL);
 
     if (isr & RTL_ISR_ROK) {
         while (!(rtl_r8(RTL_CHIPCMD) & RTL_CMD_BUFE)) {
@@ -84,6 +83,28 @@ static void rtl8139_irq_handler(struct interrupt_frame *frame)
         g_rtl.rx_offset = 0;
         rtl_w16(RTL_RXBUFPTR, (uint16_t)(0 - 0x10));
     }
+}
+
+static work_t g_rx_work = WORK_INIT(rtl8139_rx_work);
+
+static void rtl8139_irq_handler(struct interrupt_frame *frame)
+{
+    (void)frame;
+
+    if (!g_rtl_ready)
+        return;
+
+    uint16_t isr = rtl_r16(RTL_INTRSTATUS);
+    if (!isr)
+        return;   /* Shared IRQ line — not us */
+
+    rtl_w16(RTL_INTRSTATUS, isr);
+
+    /* The ring is drained and dispatched in a kworker, with interrupts on */
+    if (isr & RTL_ISR_RX_EVENTS) {
+        __atomic_fetch_or(&g_rx_events, isr & RTL_ISR_RX_EVENTS, __ATOMIC_RELEASE);
+        queue_work(&g_rx_work);
+    }
 
     if (isr & RTL_ISR_TOK) {
         for (int i = 0; i < RTL_TX_DESC_COUNT; i++) {
@@ -11,6 +11,7 @@
 #include <core/scheduler.h>
 
 #include <arch/x86_64/mmu.h>
+#include <arch/x86_64/pageops.h>
 
 #include <video/printk.h>
 
@@ -107,7 +108,10 @@ static int load_segments(const uint8_t *data, size_t data_size,
             uint8_t *kpage   = (uint8_t *)PHYS_TO_VIRT(phys);
             uint64_t chunk   = PAGE_SIZE - page_off;
             if (chunk > remaining) chunk = remaining;
-            memcpy(kpage + page_off, data + src_off, chunk);
+            if (chunk == PAGE_SIZE)
+                copy_page(kpage, data + src_off);
+            else
+                memcpy(kpage + page_off, data + src_off, chunk);
             src_off   += chunk;
             remaining -= chunk;
             vcur      += PAGE_SIZE;
@@ -1,7 +1,12 @@
 #include <arch/x86_64/cpuid.h>
 
+#include <arch/x86_64/smp.h>
+
 #include <blk/blk.h>
 
+#include <core/scheduler.h>
+#include <core/spinlock.h>
+
 #include <drivers/pci.h>
 
 #include <fs/sysdir.h>
@@ -121,8 +126,9 @@ static int sysdir_buf_write(char *buf, size_t size, const char *fmt, ...) {
                 break;
             }
             case 'u': {
-                uint32_t v = __builtin_va_arg(ap, uint32_t);
-                char tmp[12]; int tlen = 0;
+                uint64_t v = long_mod ? __builtin_va_arg(ap, uint64_t)
+                                      : __builtin_va_arg(ap, uint32_t);
+                char tmp[21]; int tlen = 0;
                 if (v == 0) { tmp[tlen++] = '0'; }
                 else {
                     while (v) { tmp[tlen++] = '0' + (v % 10); v /= 10; }
@@ -726,6 +732,131 @@ int sysdev_register_class(void) {
     return 0;
 }
 
+static int sched_show_latency(char *buf, size_t size, int kind) {
+    size_t pos = 0;
+
+#define W(...) do { \
+    int _w = sysdir_buf_write(buf + pos, size - pos, __VA_ARGS__); \
+    if (_w > 0) pos += (size_t)_w; \
+} while (0)
+
+    W("# cpu class samples, then %u buckets: <1us, <2us, <4us, ...\n",
+      (uint32_t)SCHED_LAT_BUCKETS);
+
+    sched_latency_t lat;
+    for (uint32_t cpu = 0; cpu < smp_get_cpu_count(); cpu++) {
+        if (scheduler_get_cpu_latency(cpu, &lat) != 0)
+            continue;
+
+        for (uint32_t class = 0; class < SCHED_NR_CLASSES; class++) {
+            uint32_t *hist = lat.hist[kind][class];
+            uint32_t samples = 0;
+
+            for (int b = 0; b < SCHED_LAT_BUCKETS; b++)
+                samples += hist[b];
+            if (samples == 0)
+                continue;
+
+            W("cpu%u %s %u", cpu, scheduler_class_name(class), samples);
+            for (int b = 0; b < SCHED_LAT_BUCKETS; b++)
+                W(" %u", hist[b]);
+            W("\n");
+        }
+    }
+
+#undef W
+    return (int)pos;
+}
+
+static int sched_show_wakeup_latency(char *buf, size_t size) {
+    return sched_show_latency(buf, size, SCHED_LAT_WAKEUP);
+}
+static int sched_show_runq_latency(char *buf, size_t size) {
+    return sched_show_latency(buf, size, SCHED_LAT_RUNQ);
+}
+static int sched_store_latency_reset(const char *buf, size_t len) {
+    (void)buf;
+    scheduler_reset_latency();
+    return (int)len;
+}
+
+static sysfs_attr_t sched_attrs[] = {
+    SYSFS_ATTR_RO("wakeup_latency", sched_show_wakeup_latency),
+    SYSFS_ATTR_RO("runq_latency",   sched_show_runq_latency),
+    SYSFS_ATTR_WO("latency_reset",  sched_store_latency_reset),
+    SYSFS_ATTR_SENTINEL
+};
+
+static sysdev_t sched_dev = {
+    .name   = "sched",
+    .subsys = SYSDEV_SUBSYS_KERNEL,   /* -> /sys/kernel/sched/ */
+    .attrs  = sched_attrs,
+};
+
+int sysdev_register_sched(void) {
+    int ret = sysdev_register(&sched_dev);
+    if (ret != 0)
+        printk("sysdir: failed to register /sys/kernel/sched: %d\n", ret);
+    return ret;
+}
+
+typedef struct {
+    char *buf;
+    size_t size;
+    size_t pos;
+} locks_show_ctx_t;
+
+static void locks_show_one(const char *name, const lockstat_t *stat, void *data) {
+    locks_show_ctx_t *ctx = (locks_show_ctx_t *)data;
+    int w = sysdir_buf_write(ctx->buf + ctx->pos, ctx->size - ctx->pos,
+                             "%s %lu %lu %lu %lu\n", name, stat->acquisitions,
+                             stat->contended, stat->wait_cycles, stat->hold_cycles);
+    if (w > 0)
+        ctx->pos += (size_t)w;
+}
+
+static int locks_show_stat(char *buf, size_t size) {
+    locks_show_ctx_t ctx = { .buf = buf, .size = size, .pos = 0 };
+
+    if (!SPINLOCK_LOCKSTAT) {
+        return sysdir_buf_write(buf, size,
+                                "# lockstat disabled, build with -DSPINLOCK_LOCKSTAT=1\n");
+    }
+
+    int w = sysdir_buf_write(buf, size,
+                             "# name acquisitions contended wait_cycles hold_cycles\n");
+    if (w > 0)
+        ctx.pos = (size_t)w;
+
+    lockstat_for_each(locks_show_one, &ctx);
+    return (int)ctx.pos;
+}
+
+static int locks_store_reset(const char *buf, size_t len) {
+    (void)buf;
+    lockstat_reset();
+    return (int)len;
+}
+
+static sysfs_attr_t locks_attrs[] = {
+    SYSFS_ATTR_RO("stat",  locks_show_stat),
+    SYSFS_ATTR_WO("reset", locks_store_reset),
+    SYSFS_ATTR_SENTINEL
+};
+
+static sysdev_t locks_dev = {
+    .name   = "locks",
+    .subsys = SYSDEV_SUBSYS_KERNEL,   /* -> /sys/kernel/locks/ */
+    .attrs  = locks_attrs,
+};
+
+int sysdev_register_locks(void) {
+    int ret = sysdev_register(&locks_dev);
+    if (ret != 0)
+        printk("sysdir: failed to register /sys/kernel/locks: %d\n", ret);
+    return ret;
+}
+
 int sysdir_init(void) {
     int ret;
 
@@ -754,5 +885,17 @@ int sysdir_init(void) {
         eerror("sysdir: class registration failed: %d\n", ret);
         return ret;
     }
+
+    ret = sysdev_register_sched();
+    if (ret != 0) {
+        eerror("sysdir: sched registration failed: %d\n", ret);
+        return ret;
+    }
+
+    ret = sysdev_register_locks();
+    if (ret != 0) {
+        eerror("sysdir: locks registration failed: %d\n", ret);
+        return ret;
+    }
     return 0;
 }
\ No newline at end of file
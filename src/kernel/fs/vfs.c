@@ -1,4 +1,6 @@
 #include <core/spinlock.h>
+#include <core/rwlock.h>
+#include <core/rcu.h>
 #include <core/mutex.h>
 #include <core/proc.h>
 
@@ -22,9 +24,9 @@ static struct {
     const vfs_filesystem_ops_t *fs_types[16];
     uint32_t num_fs_types;
 
-    spinlock_irq_t mount_lock;
+    spinlock_irq_t mount_lock;      /* Serialises mount_list writers; readers use RCU */
     spinlock_irq_t vnode_lock;
-    spinlock_irq_t fs_type_lock;
+    rwlock_t fs_type_lock;
 
     uint64_t stat_lookups;
     uint64_t stat_opens;
@@ -65,9 +67,9 @@ void vfs_init(void) {
 
     memset(&vfs_state, 0, sizeof(vfs_state));
 
-    spinlock_irq_init(&vfs_state.mount_lock);
-    spinlock_irq_init(&vfs_state.vnode_lock);
-    spinlock_irq_init(&vfs_state.fs_type_lock);
+    spinlock_irq_init_named(&vfs_state.mount_lock, "vfs.mount_lock");
+    spinlock_irq_init_named(&vfs_state.vnode_lock, "vfs.vnode_lock");
+    rwlock_init(&vfs_state.fs_type_lock);
 
     vfs_state.mount_list = NULL;
     vfs_state.vnode_list = NULL;
@@ -81,23 +83,23 @@ int vfs_register_filesystem(const vfs_filesystem_ops_t *fs_ops) {
     if (!vfs_state.initialized || fs_ops == NULL || fs_ops->fs_name == NULL)
         return -EINVAL;
 
-    spinlock_irq_acquire(&vfs_state.fs_type_lock);
+    rwlock_write_acquire(&vfs_state.fs_type_lock);
 
     for (uint32_t i = 0; i < vfs_state.num_fs_types; i++) {
         if (strcmp(vfs_state.fs_types[i]->fs_name, fs_ops->fs_name) == 0) {
-            spinlock_irq_release(&vfs_state.fs_type_lock);
+            rwlock_write_release(&vfs_state.fs_type_lock);
             return -EEXIST;
         }
     }
 
     if (vfs_state.num_fs_types >= 16) {
-        spinlock_irq_release(&vfs_state.fs_type_lock);
+        rwlock_write_release(&vfs_state.fs_type_lock);
         return -ENOMEM;
     }
 
     vfs_state.fs_types[vfs_state.num_fs_types++] = fs_ops;
 
-    spinlock_irq_release(&vfs_state.fs_type_lock);
+    rwlock_write_release(&vfs_state.fs_type_lock);
 
     veinfo("vfs: registered filesystem type '%s'", fs_ops->fs_name);
     return 0;
@@ -107,7 +109,7 @@ int vfs_unregister_filesystem(const char *fs_name) {
     if (!vfs_state.initialized || fs_name == NULL)
         return -EINVAL;
 
-    spinlock_irq_acquire(&vfs_state.fs_type_lock);
+    rwlock_write_acquire(&vfs_state.fs_type_lock);
 
     for (uint32_t i = 0; i < vfs_state.num_fs_types; i++) {
         if (strcmp(vfs_state.fs_types[i]->fs_name, fs_name) == 0) {
@@ -115,28 +117,28 @@ int vfs_unregister_filesystem(const char *fs_name) {
                 vfs_state.fs_types[j] = vfs_state.fs_types[j + 1];
             vfs_state.num_fs_types--;
 
-            spinlock_irq_release(&vfs_state.fs_type_lock);
+            rwlock_write_release(&vfs_state.fs_type_lock);
             printk("vfs: unregistered filesystem type '%s'\n", fs_name);
             return 0;
         }
     }
 
-    spinlock_irq_release(&vfs_state.fs_type_lock);
+    rwlock_write_release(&vfs_state.fs_type_lock);
     return -ENOENT;
 }
 
 static const vfs_filesystem_ops_t *vfs_find_filesystem(const char *fs_name) {
-    spinlock_irq_acquire(&vfs_state.fs_type_lock);
+    uint64_t flags = rwlock_read_acquire(&vfs_state.fs_type_lock);
 
     for (uint32_t i = 0; i < vfs_state.num_fs_types; i++) {
         if (strcmp(vfs_state.fs_types[i]->fs_name, fs_name) == 0) {
             const vfs_filesystem_ops_t *ops = vfs_state.fs_types[i];
-            spinlock_irq_release(&vfs_state.fs_type_lock);
+            rwlock_read_release(&vfs_state.fs_type_lock, flags);
             return ops;
         }
     }
 
-    spinlock_irq_release(&vfs_state.fs_type_lock);
+    rwlock_read_release(&vfs_state.fs_type_lock, flags);
     return NULL;
 }
 
@@ -204,7 +206,7 @@ int vfs_mount(const char *device, const char *mountpoint, const char *fstype, ui
 
     spinlock_irq_acquire(&vfs_state.mount_lock);
     mount->mnt_next = vfs_state.mount_list;
-    vfs_state.mount_list = mount;
+    rcu_assign_pointer(vfs_state.mount_list, mount);
     spinlock_irq_release(&vfs_state.mount_lock);
 
     veinfo("vfs: mounted %s on %s (type %s)\n",
@@ -229,9 +231,12 @@ int vfs_unmount(const char *mountpoint) {
                 return -EBUSY;
             }
 
-            *prev = mount->mnt_next;
+            rcu_assign_pointer(*prev, mount->mnt_next);
             spinlock_irq_release(&vfs_state.mount_lock);
 
+            /* Path walks may still be looking at it */
+            synchronize_rcu();
+
             if (mount->mnt_ops->unmount)
                 mount->mnt_ops->unmount(mount);
 
@@ -259,12 +264,12 @@ vfs_mount_t *vfs_find_mount(const char *path) {
     if (!vfs_state.initialized || path == NULL)
         return NULL;
 
-    spinlock_irq_acquire(&vfs_state.mount_lock);
+    rcu_read_lock();
 
     vfs_mount_t *best_mount = NULL;
     size_t best_len = 0;
 
-    vfs_mount_t *mount = vfs_state.mount_list;
+    vfs_mount_t *mount = rcu_dereference(vfs_state.mount_list);
     while (mount != NULL) {
         size_t len = strlen(mount->mnt_path);
 
@@ -275,10 +280,10 @@ vfs_mount_t *vfs_find_mount(const char *path) {
             }
         }
 
-        mount = mount->mnt_next;
+        mount = rcu_dereference(mount->mnt_next);
     }
 
-    spinlock_irq_release(&vfs_state.mount_lock);
+    rcu_read_unlock();
     return best_mount ? best_mount : vfs_state.root_mount;
 }
 
@@ -558,8 +563,8 @@ int vfs_lookup(const char *path, vnode_t **result) {
 
         if (ret != 0) { kfree(temp); return ret; }
 
-        spinlock_irq_acquire(&vfs_state.mount_lock);
-        vfs_mount_t *mnt = vfs_state.mount_list;
+        rcu_read_lock();
+        vfs_mount_t *mnt = rcu_dereference(vfs_state.mount_list);
         while (mnt != NULL) {
             if (mnt->mnt_covered == next_vnode && mnt->mnt_root != NULL) {
                 vfs_vnode_ref(mnt->mnt_root);
@@ -567,9 +572,9 @@ int vfs_lookup(const char *path, vnode_t **result) {
                 next_vnode = mnt->mnt_root;
                 break;
             }
-            mnt = mnt->mnt_next;
+            mnt = rcu_dereference(mnt->mnt_next);
         }
-        spinlock_irq_release(&vfs_state.mount_lock);
+        rcu_read_unlock();
 
         current = next_vnode;
         token   = next;
@@ -1187,9 +1192,9 @@ void vfs_dump_mounts(void) {
     if (!vfs_state.initialized) { printk("vfs: not initialized\n"); return; }
 
     printk("vfs: mounted filesystems:\n");
-    spinlock_irq_acquire(&vfs_state.mount_lock);
+    rcu_read_lock();
 
-    vfs_mount_t *mount = vfs_state.mount_list;
+    vfs_mount_t *mount = rcu_dereference(vfs_state.mount_list);
     int count = 0;
 
     while (mount != NULL) {
@@ -1199,10 +1204,10 @@ void vfs_dump_mounts(void) {
                mount->mnt_ops->fs_name,
                (mount->mnt_flags & VFS_MNT_RDONLY) ? "ro" : "rw");
         count++;
-        mount = mount->mnt_next;
+        mount = rcu_dereference(mount->mnt_next);
     }
 
-    spinlock_irq_release(&vfs_state.mount_lock);
+    rcu_read_unlock();
     printk("vfs: total mounts: %d\n", count);
 }
 
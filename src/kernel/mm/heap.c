@@ -95,7 +95,7 @@ static struct {
 #define ALIGN_UP(addr, align)   (((addr) + (align) - 1) & ~((align) - 1))
 #define IS_ALIGNED(addr, align) (((addr) & ((align) - 1)) == 0)
 
-static spinlock_irq_t heap_lock = SPINLOCK_IRQ_INIT;
+static spinlock_irq_t heap_lock = SPINLOCK_IRQ_INIT_NAMED("heap_lock");
 
 static heap_slab_cache_t *slab_16 = NULL;
 static heap_slab_cache_t *slab_32 = NULL;
@@ -106,6 +106,9 @@ static heap_slab_cache_t *slab_512 = NULL;
 
 #define SLAB_SIZE  (4 * PAGE_SIZE)  /* 16KB per slab */
 
+/* Dedicated caches may hold bigger objects than kmalloc routes to slabs */
+#define SLAB_CACHE_MAX_SIZE (SLAB_SIZE / 4)
+
 static slab_t *slab_create(heap_slab_cache_t *cache) {
     /* Allocate memory for slab control structure */
     uint64_t slab_ctrl_phys = pmm_alloc_page();
@@ -146,7 +149,7 @@ static slab_t *slab_create(heap_slab_cache_t *cache) {
 }
 
 heap_slab_cache_t *heap_create_slab_cache(const char *name, size_t obj_size, size_t align) {
-    if (obj_size > SLAB_MAX_SIZE || obj_size < SLAB_MIN_SIZE) {
+    if (obj_size > SLAB_CACHE_MAX_SIZE || obj_size < SLAB_MIN_SIZE) {
         ewarn("heap: invalid slab object size %lu", obj_size);
         return NULL;
     }
@@ -162,7 +165,7 @@ heap_slab_cache_t *heap_create_slab_cache(const char *name, size_t obj_size, siz
     strncpy(cache->name, name, sizeof(cache->name) - 1);
     cache->obj_size = obj_size;
     cache->align = (align == 0) ? sizeof(void *) : align;
-    cache->lock.lock = 0;
+    spinlock_irq_init(&cache->lock);
     
     slab_t *initial_slab = slab_create(cache);
     if (initial_slab == NULL) {
@@ -0,0 +1,113 @@
+#include <arch/x86_64/irqflags.h>
+#include <arch/x86_64/smp.h>
+
+#include <core/scheduler.h>
+
+#include <mm/kstack.h>
+#include <mm/mmu.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+
+#include <video/printk.h>
+#include <video/log.h>
+
+#define KSTACK_GUARD_SIZE   PAGE_SIZE
+#define KSTACK_REGION_SIZE  (KSTACK_GUARD_SIZE + KERNEL_STACK_SIZE)
+
+/* Only ever touched by its own CPU, with interrupts off */
+typedef struct kstack_cache {
+    void *stacks[KSTACK_CACHE_SIZE];
+    uint32_t count;
+    uint64_t hits;
+    uint64_t misses;
+} kstack_cache_t;
+
+static kstack_cache_t kstack_caches[SMP_MAX_CPUS];
+static volatile uint64_t kstack_mapped;
+
+static inline kstack_cache_t *this_cache(void) {
+    cpu_info_t *cpu = smp_get_current_cpu();
+    return (cpu != NULL) ? &kstack_caches[cpu->cpu_id] : NULL;
+}
+
+static void *kstack_map(void) {
+    vm_space_t *space = vmm_get_kernel_space();
+
+    uint64_t region = vmm_alloc_region(space, KSTACK_REGION_SIZE, VMM_READ | VMM_WRITE, 0);
+    if (region == 0)
+        return NULL;
+
+    /* The area keeps covering the guard, so nothing else is placed there */
+    mmu_context_t *ctx = (mmu_context_t *)space->mmu_ctx;
+    uint64_t guard_phys = mmu_virt_to_phys(ctx, region);
+
+    if (mmu_unmap_page(ctx, region) != 0) {
+        vmm_free_region(space, region);
+        return NULL;
+    }
+    if (guard_phys != 0)
+        pmm_free_page(guard_phys);
+
+    __atomic_add_fetch(&kstack_mapped, 1, __ATOMIC_RELAXED);
+    return (void *)(region + KSTACK_GUARD_SIZE);
+}
+
+static void kstack_unmap(void *stack) {
+    /* Only mapped pages are returned to the PMM, the guard is skipped */
+    vmm_free_region(vmm_get_kernel_space(), (uint64_t)stack - KSTACK_GUARD_SIZE);
+    __atomic_sub_fetch(&kstack_mapped, 1, __ATOMIC_RELAXED);
+}
+
+void *kstack_alloc(void) {
+    uint64_t flags = irq_save();
+
+    kstack_cache_t *cache = this_cache();
+    if (cache != NULL && cache->count > 0) {
+        void *stack = cache->stacks[--cache->count];
+        cache->hits++;
+        irq_restore(flags);
+        return stack;
+    }
+
+    if (cache != NULL)
+        cache->misses++;
+
+    irq_restore(flags);
+
+    void *stack = kstack_map();
+    if (stack == NULL)
+        eerror("kstack: cannot map a kernel stack\n");
+    return stack;
+}
+
+void kstack_free(void *stack) {
+    if (stack == NULL)
+        return;
+
+    uint64_t flags = irq_save();
+
+    kstack_cache_t *cache = this_cache();
+    if (cache != NULL && cache->count < KSTACK_CACHE_SIZE) {
+        cache->stacks[cache->count++] = stack;
+        irq_restore(flags);
+        return;
+    }
+
+    irq_restore(flags);
+    kstack_unmap(stack);
+}
+
+void kstack_get_stats(kstack_stats_t *stats) {
+    if (stats == NULL)
+        return;
+
+    stats->cache_hits = 0;
+    stats->cache_misses = 0;
+
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        stats->cache_hits += kstack_caches[i].hits;
+        stats->cache_misses += kstack_caches[i].misses;
+    }
+
+    stats->mapped = __atomic_load_n(&kstack_mapped, __ATOMIC_RELAXED);
+}
@@ -1,5 +1,8 @@
 #include <arch/x86_64/cpuid.h>
+#include <arch/x86_64/irqflags.h>
 #include <arch/x86_64/mmu.h>
+#include <arch/x86_64/pageops.h>
+#include <arch/x86_64/smp.h>
 
 #include <mm/mmu.h>
 #include <mm/pmm.h>
@@ -27,8 +30,21 @@ static struct {
     uint64_t pages_unmapped;
     uint64_t tables_allocated;
     uint64_t tlb_flushes;
+    uint64_t tlb_shootdowns;
+    uint64_t tlb_ipis_received;
 } mmu_stats;
 
+/* One shootdown in flight at a time; targets clear their bit in pending */
+static struct {
+    volatile uint32_t lock;
+    phys_addr_t pml4_phys;
+    bool kernel;                /* Kernel half: flush on every CPU */
+    bool full;
+    uint32_t nr_ranges;
+    mmu_tlb_range_t ranges[MMU_TLB_BATCH_RANGES];
+    volatile uint64_t pending;  /* Bitmask of cpu_id still to flush */
+} tlb_shootdown;
+
 static struct {
     bool supports_2mb_pages;
     bool supports_1gb_pages;
@@ -192,6 +208,24 @@ void mmu_destroy_context(mmu_context_t *ctx) {
     pmm_free_page(VIRT_TO_PHYS((uint64_t)ctx));
 }
 
+static cpu_info_t *tlb_this_cpu(void) {
+    /* Nothing to shoot down at until smp_init has filled g_cpus */
+    return g_cpu_count != 0 ? smp_get_current_cpu() : NULL;
+}
+
+void mmu_activate_pml4(phys_addr_t pml4_phys) {
+    cpu_info_t *cpu = tlb_this_cpu();
+
+    /* Publish before loading so a concurrent shootdown either sees us
+     * here or we pick up its PTE changes with the CR3 load */
+    if (cpu != NULL) {
+        cpu->active_pml4 = pml4_phys;
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    mmu_load_cr3(pml4_phys);
+}
+
 void mmu_switch_context(mmu_context_t *ctx) {
     if (ctx == NULL) {
         return;
@@ -199,7 +233,7 @@ void mmu_switch_context(mmu_context_t *ctx) {
 
     uint64_t current_cr3 = mmu_get_cr3();
     if (current_cr3 != ctx->pml4_phys) {
-        mmu_load_cr3(ctx->pml4_phys);
+        mmu_activate_pml4(ctx->pml4_phys);
         mmu_stats.tlb_flushes++;
         ctx->stats.tlb_stats.context_switches++;
     }
@@ -232,6 +266,19 @@ int mmu_map_page(mmu_context_t *ctx, uint64_t virt_addr, uint64_t phys_addr, uin
     return 0;
 }
 
+static int clear_pte(mmu_context_t *ctx, uint64_t virt_addr) {
+    pte_t *pte = walk_page_tables(ctx, virt_addr, 0, 0);
+    if (pte == NULL || !pte_is_present(*pte)) {
+        return -1;
+    }
+
+    *pte = 0;
+
+    mmu_stats.pages_unmapped++;
+    ctx->stats.pages_unmapped++;
+    return 0;
+}
+
 int mmu_unmap_page(mmu_context_t *ctx, uint64_t virt_addr) {
     if (ctx == NULL) {
         ctx = &kernel_ctx;
@@ -239,16 +286,14 @@ int mmu_unmap_page(mmu_context_t *ctx, uint64_t virt_addr) {
 
     virt_addr &= ~(PAGE_SIZE - 1);
 
-    pte_t *pte = walk_page_tables(ctx, virt_addr, 0, 0);
-    if (pte == NULL || !pte_is_present(*pte)) {
+    if (clear_pte(ctx, virt_addr) != 0) {
         return -1;
     }
 
-    *pte = 0;
-    mmu_invlpg(virt_addr);
-
-    mmu_stats.pages_unmapped++;
-    ctx->stats.pages_unmapped++;
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+    mmu_tlb_batch_add(&batch, virt_addr, PAGE_SIZE);
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -282,10 +327,17 @@ int mmu_unmap_range(mmu_context_t *ctx, uint64_t virt_start, size_t size) {
 
     size_t num_pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
 
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+
     for (size_t i = 0; i < num_pages; i++) {
-        mmu_unmap_page(ctx, virt_start + (i * PAGE_SIZE));
+        uint64_t virt = (virt_start & ~(PAGE_SIZE - 1)) + (i * PAGE_SIZE);
+        if (clear_pte(ctx, virt) == 0) {
+            mmu_tlb_batch_add(&batch, virt, PAGE_SIZE);
+        }
     }
 
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -390,6 +442,8 @@ void mmu_print_stats(void) {
     printk("pages unmapped:     %lu\n", mmu_stats.pages_unmapped);
     printk("page tables alloc:  %lu\n", mmu_stats.tables_allocated);
     printk("tlb flushes:        %lu\n", mmu_stats.tlb_flushes);
+    printk("tlb shootdowns:     %lu (%lu IPIs received)\n",
+           mmu_stats.tlb_shootdowns, mmu_stats.tlb_ipis_received);
     printk("memory used:        %lu KB\n",
            (mmu_stats.tables_allocated * PAGE_SIZE) / 1024);
 }
@@ -529,35 +583,206 @@ int mmu_map_range_auto(mmu_context_t *ctx, uint64_t virt_start, uint64_t phys_st
     return 0;
 }
 
-void mmu_flush_tlb_single(uint64_t virt_addr) {
-    mmu_invlpg(virt_addr);
-    kernel_ctx.stats.tlb_stats.single_flushes++;
+static void tlb_flush_local(bool kernel, bool full, const mmu_tlb_range_t *ranges,
+                            uint32_t nr_ranges) {
+    if (full) {
+        if (kernel && cpu_features.supports_global_pages)
+            mmu_flush_tlb_global();
+        else
+            mmu_flush_tlb();
+        return;
+    }
+
+    for (uint32_t i = 0; i < nr_ranges; i++) {
+        for (size_t j = 0; j < ranges[i].pages; j++) {
+            mmu_invlpg(ranges[i].virt_start + (j * MMU_PAGE_SIZE_4K));
+        }
+    }
 }
 
-void mmu_flush_tlb_range(uint64_t virt_start, size_t size) {
-    size_t num_pages = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
+static void tlb_shootdown_service(uint32_t cpu_id) {
+    /* NOTE: Called with interrupts disabled */
+    uint64_t bit = 1ULL << cpu_id;
+
+    if (!(__atomic_load_n(&tlb_shootdown.pending, __ATOMIC_ACQUIRE) & bit))
+        return;
+
+    tlb_flush_local(tlb_shootdown.kernel, tlb_shootdown.full,
+                    tlb_shootdown.ranges, tlb_shootdown.nr_ranges);
+
+    __atomic_fetch_and(&tlb_shootdown.pending, ~bit, __ATOMIC_RELEASE);
+}
+
+void mmu_tlb_shootdown_ipi(void) {
+    cpu_info_t *cpu = tlb_this_cpu();
+    if (cpu == NULL)
+        return;
+
+    __atomic_fetch_add(&mmu_stats.tlb_ipis_received, 1, __ATOMIC_RELAXED);
+    tlb_shootdown_service(cpu->cpu_id);
+}
+
+void mmu_tlb_shootdown_poll(void) {
+    /* NOTE: Interrupts must be off, or the IPI could race us for the pending bit */
+    if (__atomic_load_n(&tlb_shootdown.pending, __ATOMIC_RELAXED) == 0)
+        return;
+
+    cpu_info_t *cpu = tlb_this_cpu();
+    if (cpu != NULL)
+        tlb_shootdown_service(cpu->cpu_id);
+}
 
-    if (num_pages > 32) {
-        mmu_flush_tlb_all();
+static uint64_t tlb_shootdown_targets(cpu_info_t *self, phys_addr_t pml4_phys, bool kernel) {
+    uint64_t mask = 0;
+
+    for (uint32_t i = 0; i < g_cpu_count; i++) {
+        cpu_info_t *cpu = g_cpus[i];
+        if (cpu == NULL || cpu == self || !cpu->online)
+            continue;
+
+        if (kernel || cpu->active_pml4 == pml4_phys)
+            mask |= 1ULL << cpu->cpu_id;
+    }
+
+    return mask;
+}
+
+void mmu_tlb_batch_init(mmu_tlb_batch_t *batch, mmu_context_t *ctx) {
+    batch->ctx = ctx;
+    batch->nr_ranges = 0;
+    batch->full = false;
+    batch->nr_pages = 0;
+}
+
+void mmu_tlb_batch_add(mmu_tlb_batch_t *batch, virt_addr_t virt_addr, size_t size) {
+    if (batch->full || size == 0)
+        return;
+
+    virt_addr_t start = virt_addr & ~(MMU_PAGE_SIZE_4K - 1);
+    size_t pages = MMU_PAGES_4K(size + (virt_addr - start));
+
+    batch->nr_pages += pages;
+    if (batch->nr_pages > MMU_TLB_FULL_FLUSH_PAGES) {
+        batch->full = true;
         return;
     }
 
-    for (size_t i = 0; i < num_pages; i++) {
-        mmu_invlpg(virt_start + (i * MMU_PAGE_SIZE_4K));
+    if (batch->nr_ranges > 0) {
+        mmu_tlb_range_t *last = &batch->ranges[batch->nr_ranges - 1];
+        if (last->virt_start + last->pages * MMU_PAGE_SIZE_4K == start) {
+            last->pages += pages;
+            return;
+        }
+    }
+
+    if (batch->nr_ranges == MMU_TLB_BATCH_RANGES) {
+        batch->full = true;
+        return;
+    }
+
+    batch->ranges[batch->nr_ranges].virt_start = start;
+    batch->ranges[batch->nr_ranges].pages = pages;
+    batch->nr_ranges++;
+}
+
+void mmu_tlb_batch_flush(mmu_tlb_batch_t *batch) {
+    if (batch->nr_ranges == 0 && !batch->full)
+        return;
+
+    mmu_context_t *ctx = batch->ctx;
+    phys_addr_t pml4_phys = ctx ? ctx->pml4_phys : mmu_get_cr3();
+    mmu_tlb_stats_t *stats = ctx ? &ctx->stats.tlb_stats : &kernel_ctx.stats.tlb_stats;
+
+    /* Kernel half mappings are shared by every address space */
+    bool kernel = (ctx == &kernel_ctx);
+    for (uint32_t i = 0; i < batch->nr_ranges && !kernel; i++) {
+        if (batch->ranges[i].virt_start >= MMU_HIGHER_HALF)
+            kernel = true;
     }
 
-    kernel_ctx.stats.tlb_stats.single_flushes += num_pages;
+    uint64_t flags = irq_save();
+
+    cpu_info_t *self = tlb_this_cpu();
+
+    /* PTE stores must be visible before we sample active_pml4 */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t targets = tlb_shootdown_targets(self, pml4_phys, kernel);
+
+    if (targets != 0) {
+        /* Keep serving other CPUs' shootdowns while we wait our turn */
+        while (__atomic_exchange_n(&tlb_shootdown.lock, 1, __ATOMIC_ACQUIRE)) {
+            if (self != NULL)
+                tlb_shootdown_service(self->cpu_id);
+            __asm__ volatile("pause");
+        }
+
+        tlb_shootdown.pml4_phys = pml4_phys;
+        tlb_shootdown.kernel = kernel;
+        tlb_shootdown.full = batch->full;
+        tlb_shootdown.nr_ranges = batch->nr_ranges;
+        for (uint32_t i = 0; i < batch->nr_ranges; i++)
+            tlb_shootdown.ranges[i] = batch->ranges[i];
+
+        __atomic_store_n(&tlb_shootdown.pending, targets, __ATOMIC_RELEASE);
+
+        uint64_t ipis = 0;
+        for (uint32_t i = 0; i < g_cpu_count; i++) {
+            if (g_cpus[i] != NULL && (targets & (1ULL << g_cpus[i]->cpu_id))) {
+                smp_send_ipi(g_cpus[i]->lapic_id, SMP_IPI_TLB_FLUSH);
+                ipis++;
+            }
+        }
+
+        tlb_flush_local(kernel, batch->full, batch->ranges, batch->nr_ranges);
+
+        while (__atomic_load_n(&tlb_shootdown.pending, __ATOMIC_ACQUIRE) != 0)
+            __asm__ volatile("pause");
+
+        __atomic_store_n(&tlb_shootdown.lock, 0, __ATOMIC_RELEASE);
+
+        mmu_stats.tlb_shootdowns++;
+        stats->shootdowns++;
+        stats->shootdown_ipis += ipis;
+        stats->batched_ranges += batch->nr_ranges;
+    } else {
+        tlb_flush_local(kernel, batch->full, batch->ranges, batch->nr_ranges);
+    }
+
+    irq_restore(flags);
+
+    if (batch->full)
+        stats->full_flushes++;
+    else
+        stats->single_flushes += batch->nr_pages;
+
+    mmu_tlb_batch_init(batch, ctx);
+}
+
+void mmu_flush_tlb_single(uint64_t virt_addr) {
+    mmu_flush_tlb_range(virt_addr, MMU_PAGE_SIZE_4K);
+}
+
+void mmu_flush_tlb_range(uint64_t virt_start, size_t size) {
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, NULL);
+    mmu_tlb_batch_add(&batch, virt_start, size);
+    mmu_tlb_batch_flush(&batch);
 }
 
 void mmu_flush_tlb_all(void) {
-    mmu_flush_tlb();
-    kernel_ctx.stats.tlb_stats.full_flushes++;
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, NULL);
+    batch.full = true;
+    mmu_tlb_batch_flush(&batch);
 }
 
 void mmu_flush_tlb_context(mmu_context_t *ctx) {
     if (ctx) {
-        mmu_load_cr3(ctx->pml4_phys);
-        ctx->stats.tlb_stats.full_flushes++;
+        mmu_tlb_batch_t batch;
+        mmu_tlb_batch_init(&batch, ctx);
+        batch.full = true;
+        mmu_tlb_batch_flush(&batch);
     }
 }
 
@@ -568,6 +793,9 @@ int mmu_mark_cow(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
 
     size_t num_pages = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
 
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+
     for (size_t i = 0; i < num_pages; i++) {
         uint64_t virt = virt_addr + (i * MMU_PAGE_SIZE_4K);
         pte_t *pte = walk_page_tables(ctx, virt, 0, 0);
@@ -580,10 +808,11 @@ int mmu_mark_cow(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
             uint64_t phys = pte_get_addr(*pte);
             *pte = pte_create(phys, flags);
 
-            mmu_invlpg(virt);
+            mmu_tlb_batch_add(&batch, virt, MMU_PAGE_SIZE_4K);
         }
     }
 
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -616,31 +845,39 @@ int mmu_break_cow(mmu_context_t *ctx, uint64_t virt_addr) {
         return 0;  /* not a COW page */
     }
 
-    uint64_t new_phys = pmm_alloc_page();
-    if (new_phys == 0) {
-        return -1;
-    }
-
     uint64_t old_phys = pte_get_addr(*pte);
-    void *old_virt = PHYS_TO_VIRT(old_phys);
-    void *new_virt = PHYS_TO_VIRT(new_phys);
-    memcpy(new_virt, old_virt, MMU_PAGE_SIZE_4K);
-
     flags |= MMU_WRITABLE;
     flags &= ~MMU_AVAILABLE_1;
-    *pte = pte_create(new_phys, flags);
 
-    mmu_invlpg(virt_addr);
+    if (pmm_page_refcount(old_phys) == 1) {
+        /* Every other sharer is gone, the frame is ours to write */
+        *pte = pte_create(old_phys, flags);
+        ctx->stats.cow_reuses++;
+    } else {
+        uint64_t new_phys = pmm_alloc_page();
+        if (new_phys == 0) {
+            return -1;
+        }
+
+        copy_page(PHYS_TO_VIRT(new_phys), PHYS_TO_VIRT(old_phys));
+        *pte = pte_create(new_phys, flags);
+
+        pmm_page_add_map(new_phys);
+        pmm_page_remove_map(old_phys);
+        pmm_free_page(old_phys);
+    }
+
+    /* Other threads of this space may still hold the read-only old page */
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+    mmu_tlb_batch_add(&batch, virt_addr, MMU_PAGE_SIZE_4K);
+    mmu_tlb_batch_flush(&batch);
 
     ctx->stats.cow_breaks++;
     return 0;
 }
 
-int mmu_change_flags(mmu_context_t *ctx, uint64_t virt_addr, uint64_t new_flags) {
-    if (ctx == NULL) {
-        ctx = &kernel_ctx;
-    }
-
+static int set_pte_flags(mmu_context_t *ctx, uint64_t virt_addr, uint64_t new_flags) {
     pte_t *pte = walk_page_tables(ctx, virt_addr, 0, 0);
     if (!pte || !pte_is_present(*pte)) {
         return -1;
@@ -655,22 +892,37 @@ int mmu_change_flags(mmu_context_t *ctx, uint64_t virt_addr, uint64_t new_flags)
     if (new_flags & MMU_MAP_GLOBAL) arch_flags |= MMU_GLOBAL;
 
     *pte = pte_create(phys, arch_flags);
-    mmu_invlpg(virt_addr);
 
     return 0;
 }
 
+int mmu_change_flags(mmu_context_t *ctx, uint64_t virt_addr, uint64_t new_flags) {
+    return mmu_change_flags_range(ctx, virt_addr, MMU_PAGE_SIZE_4K, new_flags);
+}
+
 int mmu_change_flags_range(mmu_context_t *ctx, uint64_t virt_start, size_t size,
                            uint64_t new_flags) {
+    if (ctx == NULL) {
+        ctx = &kernel_ctx;
+    }
+
     size_t num_pages = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
+    int ret = 0;
+
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
 
     for (size_t i = 0; i < num_pages; i++) {
-        if (mmu_change_flags(ctx, virt_start + (i * MMU_PAGE_SIZE_4K), new_flags) != 0) {
-            return -1;
+        uint64_t virt = virt_start + (i * MMU_PAGE_SIZE_4K);
+        if (set_pte_flags(ctx, virt, new_flags) != 0) {
+            ret = -1;
+            break;
         }
+        mmu_tlb_batch_add(&batch, virt, MMU_PAGE_SIZE_4K);
     }
 
-    return 0;
+    mmu_tlb_batch_flush(&batch);
+    return ret;
 }
 
 int mmu_make_readonly(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
@@ -680,6 +932,9 @@ int mmu_make_readonly(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
 
     size_t num_pages = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
 
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+
     for (size_t i = 0; i < num_pages; i++) {
         uint64_t virt = virt_addr + (i * MMU_PAGE_SIZE_4K);
         pte_t *pte = walk_page_tables(ctx, virt, 0, 0);
@@ -691,10 +946,11 @@ int mmu_make_readonly(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
             uint64_t phys = pte_get_addr(*pte);
             *pte = pte_create(phys, flags);
 
-            mmu_invlpg(virt);
+            mmu_tlb_batch_add(&batch, virt, MMU_PAGE_SIZE_4K);
         }
     }
 
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -705,6 +961,9 @@ int mmu_make_writable(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
 
     size_t num_pages = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
 
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+
     for (size_t i = 0; i < num_pages; i++) {
         uint64_t virt = virt_addr + (i * MMU_PAGE_SIZE_4K);
         pte_t *pte = walk_page_tables(ctx, virt, 0, 0);
@@ -716,10 +975,11 @@ int mmu_make_writable(mmu_context_t *ctx, uint64_t virt_addr, size_t size) {
             uint64_t phys = pte_get_addr(*pte);
             *pte = pte_create(phys, flags);
 
-            mmu_invlpg(virt);
+            mmu_tlb_batch_add(&batch, virt, MMU_PAGE_SIZE_4K);
         }
     }
 
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -784,10 +1044,14 @@ void mmu_print_context_stats(mmu_context_t *ctx) {
     printk("pages unmapped:     %lu\n", ctx->stats.pages_unmapped);
     printk("page tables alloc:  %lu\n", ctx->stats.tables_allocated);
     printk("cow breaks:         %lu\n", ctx->stats.cow_breaks);
+    printk("cow reuses:         %lu\n", ctx->stats.cow_reuses);
     printk("page faults:        %lu\n", ctx->stats.page_faults);
     printk("TLB single flushes: %lu\n", ctx->stats.tlb_stats.single_flushes);
     printk("TLB full flushes:   %lu\n", ctx->stats.tlb_stats.full_flushes);
     printk("Context switches:   %lu\n", ctx->stats.tlb_stats.context_switches);
+    printk("TLB shootdowns:     %lu (%lu IPIs, %lu ranges)\n",
+           ctx->stats.tlb_stats.shootdowns, ctx->stats.tlb_stats.shootdown_ipis,
+           ctx->stats.tlb_stats.batched_ranges);
 }
 
 void mmu_print_tlb_stats(mmu_context_t *ctx) {
@@ -799,6 +1063,9 @@ void mmu_print_tlb_stats(mmu_context_t *ctx) {
     printk("Single page flushes: %lu\n", ctx->stats.tlb_stats.single_flushes);
     printk("Full tlb flushes:    %lu\n", ctx->stats.tlb_stats.full_flushes);
     printk("Context switches:    %lu\n", ctx->stats.tlb_stats.context_switches);
+    printk("Shootdowns:          %lu\n", ctx->stats.tlb_stats.shootdowns);
+    printk("Shootdown IPIs:      %lu\n", ctx->stats.tlb_stats.shootdown_ipis);
+    printk("Batched ranges:      %lu\n", ctx->stats.tlb_stats.batched_ranges);
 }
 
 void mmu_parse_fault_error(uint64_t error_code, mmu_fault_info_t *info) {
@@ -861,19 +1128,32 @@ int mmu_copy_range(mmu_context_t *dst, mmu_context_t *src,
                    uint64_t virt_start, size_t size, bool cow) {
     if (!dst || !src) return -1;
     size_t n = (size + MMU_PAGE_SIZE_4K - 1) / MMU_PAGE_SIZE_4K;
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, src);
+    int ret = 0;
     for (size_t i = 0; i < n; i++) {
         uint64_t virt = virt_start + i * MMU_PAGE_SIZE_4K;
         pte_t *src_pte = walk_page_tables(src, virt, 0, 0);
         if (!src_pte || !pte_is_present(*src_pte)) continue;
         uint64_t phys  = pte_get_addr(*src_pte);
         uint64_t flags = pte_get_flags(*src_pte);
-        if (cow) flags = (flags & ~MMU_WRITABLE) | MMU_AVAILABLE_1;
+        /* Only writable pages go COW, read-only ones are simply shared */
+        if (cow && (flags & (MMU_WRITABLE | MMU_AVAILABLE_1))) {
+            flags = (flags & ~MMU_WRITABLE) | MMU_AVAILABLE_1;
+            if (pte_get_flags(*src_pte) != flags) {
+                *src_pte = pte_create(phys, flags);
+                mmu_tlb_batch_add(&batch, virt, MMU_PAGE_SIZE_4K);
+            }
+        }
         pte_t *dst_pte = walk_page_tables(dst, virt, 1, flags);
-        if (!dst_pte) return -1;
+        if (!dst_pte) { ret = -1; break; }
         *dst_pte = pte_create(phys, flags);
-        mmu_invlpg(virt);
+        /* Each copy holds the frame, so whichever side unmaps last frees it */
+        pmm_get_page(phys);
+        pmm_page_add_map(phys);
     }
-    return 0;
+    mmu_tlb_batch_flush(&batch);
+    return ret;
 }
 
 int mmu_remap_page(mmu_context_t *ctx, uint64_t old_virt, uint64_t new_virt) {
@@ -883,11 +1163,17 @@ int mmu_remap_page(mmu_context_t *ctx, uint64_t old_virt, uint64_t new_virt) {
     uint64_t phys  = pte_get_addr(*old);
     uint64_t flags = pte_get_flags(*old);
     *old = 0;
-    mmu_invlpg(old_virt);
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+    mmu_tlb_batch_add(&batch, old_virt, MMU_PAGE_SIZE_4K);
     pte_t *newpte = walk_page_tables(ctx, new_virt, 1, flags);
-    if (!newpte) return -1;
+    if (!newpte) {
+        mmu_tlb_batch_flush(&batch);
+        return -1;
+    }
     *newpte = pte_create(phys, flags);
-    mmu_invlpg(new_virt);
+    mmu_tlb_batch_add(&batch, new_virt, MMU_PAGE_SIZE_4K);
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -900,8 +1186,15 @@ int mmu_map_batch(mmu_context_t *ctx, const mmu_mapping_t *mappings, size_t coun
 }
 
 int mmu_unmap_batch(mmu_context_t *ctx, const uint64_t *virt_addrs, size_t count) {
-    for (size_t i = 0; i < count; i++)
-        mmu_unmap_page(ctx, virt_addrs[i]);
+    if (!ctx) ctx = &kernel_ctx;
+    mmu_tlb_batch_t batch;
+    mmu_tlb_batch_init(&batch, ctx);
+    for (size_t i = 0; i < count; i++) {
+        uint64_t virt = virt_addrs[i] & ~(PAGE_SIZE - 1);
+        if (clear_pte(ctx, virt) == 0)
+            mmu_tlb_batch_add(&batch, virt, PAGE_SIZE);
+    }
+    mmu_tlb_batch_flush(&batch);
     return 0;
 }
 
@@ -54,7 +54,7 @@ static inline paging_page_size_t mmu_to_paging_page_size(mmu_page_size_t size) {
 }
 
 void paging_load_pml4(uint64_t pml4_phys) {
-    mmu_load_cr3(pml4_phys);
+    mmu_activate_pml4(pml4_phys);
 }
 
 uint64_t paging_get_pml4(void) {
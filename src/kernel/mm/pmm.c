@@ -1,3 +1,8 @@
+#include <arch/x86_64/irqflags.h>
+#include <arch/x86_64/pageops.h>
+#include <arch/x86_64/smp.h>
+
+#include <core/scheduler.h>
 #include <core/spinlock.h>
 
 #include <video/printk.h>
@@ -13,17 +18,36 @@ extern volatile struct limine_memmap_request memmap_request;
 
 uint64_t hhdm_offset = 0;
 
+/*
+ * Each zone is a binary buddy system. A free block of 2^order pages is
+ * linked into its zone's free_area[order] through its first page, and
+ * that page's page_t is flagged PAGE_FLAG_BUDDY with the order, so a
+ * free can tell in O(1) whether its buddy is a free block of the same
+ * size. Zone limits are aligned well past the largest block, so
+ * buddies never straddle two zones.
+ *
+ * Allocated frames carry a reference count. pmm_free_page() drops one
+ * reference and the frame only goes back with the last, which is what
+ * lets fork share anonymous pages until one side writes.
+ */
+
 typedef struct page_frame {
     struct page_frame *next;
+    struct page_frame *prev;
 } page_frame_t;
 
+typedef struct pmm_free_area {
+    page_frame_t *head;
+    uint64_t count;             /* Free blocks of this order */
+} pmm_free_area_t;
+
 typedef struct pmm_zone {
     const char *name;
     uint64_t start_addr;        /* Physical start address of zone */
     uint64_t end_addr;          /* Physical end address of zone */
     uint64_t total_pages;       /* Total pages in this zone */
     uint64_t free_pages;        /* Currently free pages */
-    page_frame_t *free_stack;   /* Head of free page stack (O(1) access) */
+    pmm_free_area_t free_area[PMM_MAX_ORDER + 1];
     
     uint64_t watermark_min;
     uint64_t watermark_low;
@@ -34,15 +58,52 @@ typedef struct pmm_zone {
 
 static pmm_zone_t zones[PMM_ZONE_COUNT];
 
+static page_t *pmm_pages;           /* One per page frame below pmm_max_pfn */
+static uint64_t pmm_max_pfn;
+static uint64_t pmm_map_phys;       /* Where pmm_pages itself lives */
+static uint64_t pmm_map_bytes;
+
 static uint64_t total_memory_bytes = 0;
 static uint64_t usable_memory_bytes = 0;
 
 static spinlock_irq_t pmm_locks[PMM_ZONE_COUNT] = {
-    SPINLOCK_IRQ_INIT,
-    SPINLOCK_IRQ_INIT,
-    SPINLOCK_IRQ_INIT
+    SPINLOCK_IRQ_INIT_NAMED("pmm_lock/dma"),
+    SPINLOCK_IRQ_INIT_NAMED("pmm_lock/dma32"),
+    SPINLOCK_IRQ_INIT_NAMED("pmm_lock/normal")
 };
 
+/*
+ * Single pages go through a per-CPU list per zone, so most allocations
+ * and frees never touch the zone lock. Freed pages go on the head (hot,
+ * likely still in cache), refills on the tail, and drains take from the
+ * tail. Each list has its own lock, taken with interrupts off. The owner
+ * is almost always the only one taking it; another CPU takes it only to
+ * drain the list when its zone has run dry.
+ *
+ * Next to it sits a list of pages that this CPU's kzerod already
+ * cleared while the CPU had nothing better to do. Allocations take
+ * from it first and skip clear_page(); only its next link is dirty.
+ */
+typedef struct pmm_pcp {
+    page_frame_t *head;         /* Hottest page */
+    page_frame_t *tail;         /* Coldest page */
+    uint32_t count;
+    spinlock_t lock;            /* Owner, or a CPU draining it under pressure */
+    
+    page_frame_t *zero_head;    /* Singly linked through next */
+    uint32_t zero_count;
+
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t drains;
+    uint64_t zero_hits;
+    uint64_t zero_filled;
+} pmm_pcp_t;
+
+static pmm_pcp_t pmm_pcps[SMP_MAX_CPUS][PMM_ZONE_COUNT];
+
 static int pmm_addr_to_zone(uint64_t addr) {
     if (addr < PMM_DMA_LIMIT) {
         return PMM_ZONE_DMA;
@@ -63,12 +124,138 @@ static void pmm_calculate_watermarks(pmm_zone_t *zone) {
     zone->watermark_high = zone->watermark_min * 3;
 }
 
-static void pmm_add_page_to_zone(pmm_zone_t *zone, uint64_t phys_addr) {
+static void pmm_set_allocated(uint64_t phys_addr, uint64_t pages) {
+    /* Fresh frames start with the caller's reference and no mappings */
+    page_t *page = &pmm_pages[phys_addr >> PAGE_SHIFT];
+    for (uint64_t i = 0; i < pages; i++) {
+        page[i].refcount = 1;
+        page[i].mapcount = 0;
+    }
+}
+
+static bool pmm_put_page(page_t *page, uint64_t phys_addr) {
+    /* True when this dropped the last reference */
+    uint32_t ref = __atomic_load_n(&page->refcount, __ATOMIC_RELAXED);
+    do {
+        if (ref == 0) {
+            ewarn("pmm: attempted to free free page 0x%016lx", phys_addr);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&page->refcount, &ref, ref - 1, false,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return ref == 1;
+}
+
+static void pmm_list_add(pmm_zone_t *zone, uint64_t phys_addr, unsigned int order) {
+    /* NOTE: Caller must hold the zone's lock */
     page_frame_t *frame = (page_frame_t *)PHYS_TO_VIRT(phys_addr);
-    frame->next = zone->free_stack;
-    zone->free_stack = frame;
-    zone->total_pages++;
-    zone->free_pages++;
+    pmm_free_area_t *area = &zone->free_area[order];
+
+    frame->prev = NULL;
+    frame->next = area->head;
+    if (area->head != NULL)
+        area->head->prev = frame;
+    area->head = frame;
+    area->count++;
+
+    page_t *page = &pmm_pages[phys_addr >> PAGE_SHIFT];
+    page->flags |= PAGE_FLAG_BUDDY;
+    page->order = (uint8_t)order;
+}
+
+static void pmm_list_del(pmm_zone_t *zone, page_frame_t *frame, unsigned int order) {
+    /* NOTE: Caller must hold the zone's lock */
+    pmm_free_area_t *area = &zone->free_area[order];
+
+    if (frame->prev != NULL)
+        frame->prev->next = frame->next;
+    else
+        area->head = frame->next;
+    if (frame->next != NULL)
+        frame->next->prev = frame->prev;
+    area->count--;
+
+    pmm_pages[VIRT_TO_PHYS((uint64_t)frame) >> PAGE_SHIFT].flags &= ~PAGE_FLAG_BUDDY;
+}
+
+static void pmm_free_block(pmm_zone_t *zone, uint64_t phys_addr, unsigned int order) {
+    /* NOTE: Caller must hold the zone's lock */
+    uint64_t pfn = phys_addr >> PAGE_SHIFT;
+
+    zone->free_pages += 1ULL << order;
+
+    /* Merge upwards while the buddy is a free block of the same order */
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (buddy >= pmm_max_pfn || !(pmm_pages[buddy].flags & PAGE_FLAG_BUDDY) ||
+            pmm_pages[buddy].order != order)
+            break;
+
+        pmm_list_del(zone, (page_frame_t *)PHYS_TO_VIRT(buddy << PAGE_SHIFT), order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+
+    pmm_list_add(zone, pfn << PAGE_SHIFT, order);
+}
+
+static uint64_t pmm_alloc_block(pmm_zone_t *zone, unsigned int order) {
+    /* NOTE: Caller must hold the zone's lock */
+    unsigned int found = order;
+    while (found <= PMM_MAX_ORDER && zone->free_area[found].head == NULL)
+        found++;
+
+    if (found > PMM_MAX_ORDER)
+        return 0;
+
+    page_frame_t *frame = zone->free_area[found].head;
+    pmm_list_del(zone, frame, found);
+
+    uint64_t phys_addr = VIRT_TO_PHYS((uint64_t)frame);
+
+    /* Hand the upper halves back until the block is the size asked for */
+    while (found > order) {
+        found--;
+        pmm_list_add(zone, phys_addr + (PAGE_SIZE << found), found);
+    }
+
+    zone->free_pages -= 1ULL << order;
+    return phys_addr;
+}
+
+static unsigned int pmm_largest_order(uint64_t pfn, uint64_t pages) {
+    /* Biggest block that starts at pfn, is aligned to its size and fits */
+    unsigned int order = 0;
+    while (order < PMM_MAX_ORDER &&
+           (pfn & ((1ULL << (order + 1)) - 1)) == 0 &&
+           (1ULL << (order + 1)) <= pages)
+        order++;
+    return order;
+}
+
+static void pmm_free_range(uint64_t phys_addr, uint64_t pages, bool count_total) {
+    /* Split at zone limits, then free in the largest aligned blocks */
+    while (pages > 0) {
+        int zone_idx = pmm_addr_to_zone(phys_addr);
+        pmm_zone_t *zone = &zones[zone_idx];
+
+        uint64_t pfn = phys_addr >> PAGE_SHIFT;
+        uint64_t zone_pages = pages;
+        if (zone->end_addr != UINT64_MAX && phys_addr + pages * PAGE_SIZE > zone->end_addr)
+            zone_pages = (zone->end_addr - phys_addr) / PAGE_SIZE;
+
+        unsigned int order = pmm_largest_order(pfn, zone_pages);
+        uint64_t block = 1ULL << order;
+
+        spinlock_irq_acquire(&pmm_locks[zone_idx]);
+        if (count_total)
+            zone->total_pages += block;
+        pmm_free_block(zone, phys_addr, order);
+        spinlock_irq_release(&pmm_locks[zone_idx]);
+
+        phys_addr += block * PAGE_SIZE;
+        pages -= block;
+    }
 }
 
 static void pmm_add_region(uint64_t base, uint64_t length) {
@@ -87,15 +274,53 @@ static void pmm_add_region(uint64_t base, uint64_t length) {
         return;
     }
     
-    uint64_t num_pages = length / PAGE_SIZE;
+    for (uint64_t pfn = aligned_base >> PAGE_SHIFT;
+         pfn < (aligned_base + length) >> PAGE_SHIFT; pfn++) {
+        pmm_pages[pfn].flags &= ~PAGE_FLAG_RESERVED;
+    }
     
-    for (uint64_t i = 0; i < num_pages; i++) {
-        uint64_t phys_addr = aligned_base + (i * PAGE_SIZE);
-        int zone_idx = pmm_addr_to_zone(phys_addr);
-        pmm_zone_t *zone = &zones[zone_idx];
-        
-        pmm_add_page_to_zone(zone, phys_addr);
+    pmm_free_range(aligned_base, length / PAGE_SIZE, true);
+}
+
+static bool pmm_setup_page_array(struct limine_memmap_response *memmap) {
+    /* The page array covers every usable frame; carve it out of the first region that fits */
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap->entries[i];
+        if (entry->type != LIMINE_MEMMAP_USABLE)
+            continue;
+
+        uint64_t end_pfn = PAGE_ALIGN_DOWN(entry->base + entry->length) >> PAGE_SHIFT;
+        if (end_pfn > pmm_max_pfn)
+            pmm_max_pfn = end_pfn;
     }
+
+    uint64_t map_bytes = PAGE_ALIGN_UP(pmm_max_pfn * sizeof(page_t));
+
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap->entries[i];
+        if (entry->type != LIMINE_MEMMAP_USABLE)
+            continue;
+
+        uint64_t base = PAGE_ALIGN_UP(entry->base);
+        uint64_t end = PAGE_ALIGN_DOWN(entry->base + entry->length);
+        if (end <= base || end - base < map_bytes)
+            continue;
+
+        pmm_pages = (page_t *)PHYS_TO_VIRT(base);
+        memset(pmm_pages, 0, map_bytes);
+
+        /* Everything starts reserved; pmm_add_region() releases the usable frames */
+        for (uint64_t pfn = 0; pfn < pmm_max_pfn; pfn++) {
+            pmm_pages[pfn].flags = PAGE_FLAG_RESERVED;
+            pmm_pages[pfn].zone = (uint8_t)pmm_addr_to_zone(pfn << PAGE_SHIFT);
+        }
+
+        pmm_map_phys = base;
+        pmm_map_bytes = map_bytes;
+        return true;
+    }
+
+    return false;
 }
 
 void pmm_init(void) {
@@ -110,21 +335,18 @@ void pmm_init(void) {
     zones[PMM_ZONE_DMA].end_addr = PMM_DMA_LIMIT;
     zones[PMM_ZONE_DMA].total_pages = 0;
     zones[PMM_ZONE_DMA].free_pages = 0;
-    zones[PMM_ZONE_DMA].free_stack = NULL;
     
     zones[PMM_ZONE_DMA32].name = "DMA32";
     zones[PMM_ZONE_DMA32].start_addr = PMM_DMA_LIMIT;
     zones[PMM_ZONE_DMA32].end_addr = PMM_DMA32_LIMIT;
     zones[PMM_ZONE_DMA32].total_pages = 0;
     zones[PMM_ZONE_DMA32].free_pages = 0;
-    zones[PMM_ZONE_DMA32].free_stack = NULL;
     
     zones[PMM_ZONE_NORMAL].name = "normal";
     zones[PMM_ZONE_NORMAL].start_addr = PMM_DMA32_LIMIT;
     zones[PMM_ZONE_NORMAL].end_addr = UINT64_MAX;
     zones[PMM_ZONE_NORMAL].total_pages = 0;
     zones[PMM_ZONE_NORMAL].free_pages = 0;
-    zones[PMM_ZONE_NORMAL].free_stack = NULL;
     
     if (memmap_request.response == NULL) {
         epanic("pmm", "no memory map from bootloader");
@@ -140,6 +362,28 @@ void pmm_init(void) {
         
         if (entry->type == LIMINE_MEMMAP_USABLE) {
             usable_memory_bytes += entry->length;
+        }
+    }
+    
+    if (!pmm_setup_page_array(memmap)) {
+        epanic("pmm", "no room for the page array");
+        for(;;);
+    }
+    
+    for (uint64_t i = 0; i < memmap->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap->entries[i];
+        
+        if (entry->type != LIMINE_MEMMAP_USABLE) {
+            continue;
+        }
+        
+        uint64_t end = entry->base + entry->length;
+        if (pmm_map_phys >= entry->base && pmm_map_phys < end) {
+            /* Everything but the page array */
+            uint64_t map_end = pmm_map_phys + pmm_map_bytes;
+            pmm_add_region(entry->base, pmm_map_phys - entry->base);
+            pmm_add_region(map_end, end - map_end);
+        } else {
             pmm_add_region(entry->base, entry->length);
         }
     }
@@ -149,6 +393,135 @@ void pmm_init(void) {
     }
 }
 
+static pmm_pcp_t *pmm_this_pcp(int zone_idx) {
+    /* NOTE: Interrupts must be off; NULL until this CPU has its cpu_info_t */
+    cpu_info_t *cpu = smp_get_current_cpu();
+    return (cpu != NULL) ? &pmm_pcps[cpu->cpu_id][zone_idx] : NULL;
+}
+
+static void pcp_push_head(pmm_pcp_t *pcp, page_frame_t *frame) {
+    frame->prev = NULL;
+    frame->next = pcp->head;
+    if (pcp->head != NULL)
+        pcp->head->prev = frame;
+    else
+        pcp->tail = frame;
+    pcp->head = frame;
+    pcp->count++;
+}
+
+static void pcp_push_tail(pmm_pcp_t *pcp, page_frame_t *frame) {
+    frame->next = NULL;
+    frame->prev = pcp->tail;
+    if (pcp->tail != NULL)
+        pcp->tail->next = frame;
+    else
+        pcp->head = frame;
+    pcp->tail = frame;
+    pcp->count++;
+}
+
+static page_frame_t *pcp_pop_head(pmm_pcp_t *pcp) {
+    page_frame_t *frame = pcp->head;
+    pcp->head = frame->next;
+    if (pcp->head != NULL)
+        pcp->head->prev = NULL;
+    else
+        pcp->tail = NULL;
+    pcp->count--;
+    return frame;
+}
+
+static page_frame_t *pcp_pop_tail(pmm_pcp_t *pcp) {
+    page_frame_t *frame = pcp->tail;
+    pcp->tail = frame->prev;
+    if (pcp->tail != NULL)
+        pcp->tail->next = NULL;
+    else
+        pcp->head = NULL;
+    pcp->count--;
+    return frame;
+}
+
+static void pmm_pcp_drain(int zone_idx, pmm_pcp_t *pcp, uint32_t count) {
+    /* NOTE: Caller must hold pcp->lock with interrupts off */
+    if (pcp->count == 0 && (count != UINT32_MAX || pcp->zero_count == 0)) {
+        return;
+    }
+    
+    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    
+    /* A full drain means memory is short, so the zeroed pages go too */
+    if (count == UINT32_MAX) {
+        while (pcp->zero_count > 0) {
+            page_frame_t *frame = pcp->zero_head;
+            pcp->zero_head = frame->next;
+            pcp->zero_count--;
+            pmm_free_block(&zones[zone_idx], VIRT_TO_PHYS((uint64_t)frame), 0);
+        }
+    }
+    
+    while (count-- > 0 && pcp->count > 0) {
+        page_frame_t *frame = pcp_pop_tail(pcp);
+        pmm_free_block(&zones[zone_idx], VIRT_TO_PHYS((uint64_t)frame), 0);
+    }
+    
+    spinlock_irq_release(&pmm_locks[zone_idx]);
+    
+    pcp->drains++;
+}
+
+static uint32_t pmm_pcp_refill(int zone_idx, pmm_pcp_t *pcp) {
+    /* NOTE: Caller must hold pcp->lock with interrupts off */
+    uint32_t got = 0;
+    
+    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    
+    while (got < PMM_PCP_BATCH) {
+        uint64_t phys_addr = pmm_alloc_block(&zones[zone_idx], 0);
+        if (phys_addr == 0) {
+            break;
+        }
+        pcp_push_tail(pcp, (page_frame_t *)PHYS_TO_VIRT(phys_addr));
+        got++;
+    }
+    
+    spinlock_irq_release(&pmm_locks[zone_idx]);
+    
+    return got;
+}
+
+void pmm_drain_pcp(int zone_idx) {
+    if (zone_idx < 0 || zone_idx >= PMM_ZONE_COUNT) {
+        return;
+    }
+    
+    uint64_t flags = irq_save();
+    
+    /* Every CPU's pages are back in the zone by the time we return */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        pmm_pcp_t *pcp = &pmm_pcps[i][zone_idx];
+        if (pcp->count == 0 && pcp->zero_count == 0) {
+            continue;
+        }
+        
+        spinlock_acquire(&pcp->lock);
+        pmm_pcp_drain(zone_idx, pcp, UINT32_MAX);
+        spinlock_release(&pcp->lock);
+    }
+    
+    irq_restore(flags);
+}
+
+static uint64_t pmm_zone_free_pages(int zone_idx) {
+    /* Pages parked on per-CPU lists are still free; the sum is only a snapshot */
+    uint64_t free = zones[zone_idx].free_pages;
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        free += pmm_pcps[i][zone_idx].count + pmm_pcps[i][zone_idx].zero_count;
+    }
+    return free;
+}
+
 uint64_t pmm_alloc_page(void) {
     /* Try NORMAL first (preferred), then DMA32, then DMA */
     uint64_t addr = pmm_alloc_page_zone(PMM_ZONE_NORMAL);
@@ -170,31 +543,89 @@ uint64_t pmm_alloc_page(void) {
     return 0;
 }
 
-uint64_t pmm_alloc_page_zone(int zone_idx) {
-    if (zone_idx < 0 || zone_idx >= PMM_ZONE_COUNT) {
-        return 0;
-    }
-    
+static uint64_t pmm_alloc_page_direct(int zone_idx) {
     spinlock_irq_acquire(&pmm_locks[zone_idx]);
     
     pmm_zone_t *zone = &zones[zone_idx];
     
-    if (zone->free_stack == NULL) {
+    uint64_t phys_addr = pmm_alloc_block(zone, 0);
+    if (phys_addr == 0) {
         zone->stats.alloc_failed++;
         spinlock_irq_release(&pmm_locks[zone_idx]);
         return 0;
     }
     
-    page_frame_t *frame = zone->free_stack;
-    zone->free_stack = frame->next;
-    zone->free_pages--;
     zone->stats.alloc_count++;
     
-    uint64_t phys_addr = VIRT_TO_PHYS((uint64_t)frame);
-    
     spinlock_irq_release(&pmm_locks[zone_idx]);
     
-    memset((void *)frame, 0, PAGE_SIZE);
+    pmm_set_allocated(phys_addr, 1);
+    clear_page(PHYS_TO_VIRT(phys_addr));
+    
+    return phys_addr;
+}
+
+uint64_t pmm_alloc_page_zone(int zone_idx) {
+    if (zone_idx < 0 || zone_idx >= PMM_ZONE_COUNT) {
+        return 0;
+    }
+    
+    /* Nothing to find, e.g. no memory above 4 GB */
+    if (zones[zone_idx].total_pages == 0) {
+        return 0;
+    }
+    
+    uint64_t flags = irq_save();
+    
+    pmm_pcp_t *pcp = pmm_this_pcp(zone_idx);
+    if (pcp == NULL) {
+        irq_restore(flags);
+        return pmm_alloc_page_direct(zone_idx);
+    }
+    
+    spinlock_acquire(&pcp->lock);
+    
+    if (pcp->zero_count > 0) {
+        page_frame_t *frame = pcp->zero_head;
+        pcp->zero_head = frame->next;
+        pcp->zero_count--;
+        pcp->allocs++;
+        pcp->zero_hits++;
+        
+        spinlock_release(&pcp->lock);
+        irq_restore(flags);
+        
+        frame->next = NULL;
+        
+        uint64_t phys_addr = VIRT_TO_PHYS((uint64_t)frame);
+        pmm_set_allocated(phys_addr, 1);
+        return phys_addr;
+    }
+    
+    if (pcp->count > 0) {
+        pcp->hits++;
+    } else {
+        pcp->misses++;
+        
+        if (pmm_pcp_refill(zone_idx, pcp) == 0) {
+            spinlock_release(&pcp->lock);
+            irq_restore(flags);
+            
+            /* Other CPUs may be sitting on the rest of the zone */
+            pmm_drain_pcp(zone_idx);
+            return pmm_alloc_page_direct(zone_idx);
+        }
+    }
+    
+    page_frame_t *frame = pcp_pop_head(pcp);
+    pcp->allocs++;
+    
+    spinlock_release(&pcp->lock);
+    irq_restore(flags);
+    
+    uint64_t phys_addr = VIRT_TO_PHYS((uint64_t)frame);
+    pmm_set_allocated(phys_addr, 1);
+    clear_page(frame);
     
     return phys_addr;
 }
@@ -209,28 +640,199 @@ void pmm_free_page(uint64_t phys_addr) {
         return;
     }
     
-    int zone_idx = pmm_addr_to_zone(phys_addr);
+    if ((phys_addr >> PAGE_SHIFT) >= pmm_max_pfn ||
+        (pmm_pages[phys_addr >> PAGE_SHIFT].flags & PAGE_FLAG_RESERVED)) {
+        ewarn("pmm: attempted to free unmanaged address 0x%016lx", phys_addr);
+        return;
+    }
     
-    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    /* Still shared, e.g. with a forked address space */
+    if (!pmm_put_page(&pmm_pages[phys_addr >> PAGE_SHIFT], phys_addr)) {
+        return;
+    }
     
+    int zone_idx = pmm_addr_to_zone(phys_addr);
     pmm_zone_t *zone = &zones[zone_idx];
     
-    page_frame_t *frame = (page_frame_t *)PHYS_TO_VIRT(phys_addr);
-    frame->next = zone->free_stack;
-    zone->free_stack = frame;
-    zone->free_pages++;
+    uint64_t flags = irq_save();
+    
+    pmm_pcp_t *pcp = pmm_this_pcp(zone_idx);
+    if (pcp != NULL) {
+        spinlock_acquire(&pcp->lock);
+        
+        pcp_push_head(pcp, (page_frame_t *)PHYS_TO_VIRT(phys_addr));
+        pcp->frees++;
+        
+        /* Give back everything when the zone runs low, a batch when we hoard */
+        if (zone->free_pages < zone->watermark_min) {
+            pmm_pcp_drain(zone_idx, pcp, UINT32_MAX);
+        } else if (pcp->count > PMM_PCP_HIGH) {
+            pmm_pcp_drain(zone_idx, pcp, PMM_PCP_BATCH);
+        }
+        
+        spinlock_release(&pcp->lock);
+        irq_restore(flags);
+        return;
+    }
+    
+    irq_restore(flags);
+    
+    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    
+    pmm_free_block(zone, phys_addr, 0);
     zone->stats.free_count++;
     
     spinlock_irq_release(&pmm_locks[zone_idx]);
 }
 
+static bool pmm_zero_one(int zone_idx) {
+    /* NOTE: Runs on the CPU whose list it fills; false once there is nothing to do */
+    pmm_zone_t *zone = &zones[zone_idx];
+    
+    uint64_t flags = irq_save();
+    
+    pmm_pcp_t *pcp = pmm_this_pcp(zone_idx);
+    if (pcp == NULL || pcp->zero_count >= PMM_ZERO_HIGH) {
+        irq_restore(flags);
+        return false;
+    }
+    
+    /* Don't hoard zeroed pages out of a zone that is getting tight */
+    if (pmm_zone_free_pages(zone_idx) < zone->watermark_high) {
+        irq_restore(flags);
+        return false;
+    }
+    
+    spinlock_acquire(&pcp->lock);
+    
+    if (pcp->count == 0 && pmm_pcp_refill(zone_idx, pcp) == 0) {
+        spinlock_release(&pcp->lock);
+        irq_restore(flags);
+        return false;
+    }
+    
+    /* The coldest page; the hot ones serve allocations that write anyway */
+    page_frame_t *frame = pcp_pop_tail(pcp);
+    
+    spinlock_release(&pcp->lock);
+    irq_restore(flags);
+    
+    /* Kept out of the cache, the page may sit in the pool for a while */
+    clear_page_nt(frame);
+    
+    flags = irq_save();
+    
+    pcp = pmm_this_pcp(zone_idx);
+    spinlock_acquire(&pcp->lock);
+    
+    frame->next = pcp->zero_head;
+    pcp->zero_head = frame;
+    pcp->zero_count++;
+    pcp->zero_filled++;
+    
+    spinlock_release(&pcp->lock);
+    irq_restore(flags);
+    
+    return true;
+}
+
+static tcb_t *pmm_zero_tasks[SMP_MAX_CPUS];
+
+static void pmm_zero_thread(void) {
+    /* Pinned before it was started; only ever woken by its CPU's idle loop */
+    for (;;) {
+        /* The DMA zone is too small to set pages aside */
+        for (int zone_idx = PMM_ZONE_DMA32; zone_idx < PMM_ZONE_COUNT; zone_idx++) {
+            if (zones[zone_idx].total_pages == 0) {
+                continue;
+            }
+            
+            /* Back off as soon as anything else wants this CPU */
+            while (scheduler_cpu_idle() && pmm_zero_one(zone_idx)) {
+            }
+        }
+        
+        block_task(TASK_STATE_WAITING_EVENT);
+    }
+}
+
+static bool pmm_zero_wanted(uint32_t cpu_id) {
+    for (int zone_idx = PMM_ZONE_DMA32; zone_idx < PMM_ZONE_COUNT; zone_idx++) {
+        if (zones[zone_idx].total_pages == 0 ||
+            pmm_pcps[cpu_id][zone_idx].zero_count >= PMM_ZERO_LOW) {
+            continue;
+        }
+        
+        if (pmm_zone_free_pages(zone_idx) >= zones[zone_idx].watermark_high) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+void pmm_zero_idle(void) {
+    /* NOTE: The idle task only runs while kzerod is blocked, so no handshake is needed */
+    uint64_t flags = irq_save();
+    
+    cpu_info_t *cpu = smp_get_current_cpu();
+    tcb_t *task = NULL;
+    if (cpu != NULL && cpu->cpu_id < SMP_MAX_CPUS && pmm_zero_wanted(cpu->cpu_id)) {
+        task = pmm_zero_tasks[cpu->cpu_id];
+    }
+    
+    irq_restore(flags);
+    
+    if (task != NULL) {
+        unblock_task(task);
+    }
+}
+
+void pmm_zero_init(void) {
+    ebegin("Starting page zeroing threads");
+    
+    uint32_t started = 0;
+    
+    for (uint32_t i = 0; i < smp_get_cpu_count() && i < SMP_MAX_CPUS; i++) {
+        cpu_info_t *cpu = smp_get_cpu(i);
+        if (cpu == NULL || !cpu->online) {
+            continue;
+        }
+        
+        char name[32] = "kzerod/";
+        size_t len = strlen(name);
+        if (i >= 10) {
+            name[len++] = '0' + (char)(i / 10);
+        }
+        name[len++] = '0' + (char)(i % 10);
+        name[len] = '\0';
+        
+        tcb_t *task = create_kernel_task_paused(pmm_zero_thread, name, PRIORITY_IDLE);
+        if (task == NULL) {
+            continue;
+        }
+        
+        cpumask_t mask;
+        cpumask_clear(&mask);
+        cpumask_set(&mask, i);
+        task_set_affinity(task, &mask);
+        
+        pmm_zero_tasks[i] = task;
+        task_start(task);
+        started++;
+    }
+    
+    eend(started == 0 ? -1 : 0, NULL);
+}
+
 void pmm_print_stats(void) {
     uint64_t total_free_pages = 0;
     uint64_t total_used_pages = 0;
     
     for (int i = 0; i < PMM_ZONE_COUNT; i++) {
-        total_free_pages += zones[i].free_pages;
-        total_used_pages += zones[i].total_pages - zones[i].free_pages;
+        uint64_t free = pmm_zone_free_pages(i);
+        total_free_pages += free;
+        total_used_pages += zones[i].total_pages - free;
     }
     
     uint64_t free_memory = total_free_pages * PAGE_SIZE;
@@ -250,21 +852,36 @@ void pmm_print_zones(void) {
     
     for (int i = 0; i < PMM_ZONE_COUNT; i++) {
         pmm_zone_t *zone = &zones[i];
-        uint64_t free_mb = (zone->free_pages * PAGE_SIZE) / (1024 * 1024);
+        uint64_t free_pages = pmm_zone_free_pages(i);
+        uint64_t free_mb = (free_pages * PAGE_SIZE) / (1024 * 1024);
         uint64_t total_mb = (zone->total_pages * PAGE_SIZE) / (1024 * 1024);
-        uint64_t used_pages = zone->total_pages - zone->free_pages;
+        uint64_t used_pages = zone->total_pages - free_pages;
+        
+        pmm_zone_stats_t stats;
+        pmm_get_stats(i, &stats);
+        uint64_t lookups = stats.pcp_hits + stats.pcp_misses;
         
         printk("Zone %d (%s):\n", i, zone->name);
         printk("  range:       0x%016lx - 0x%016lx\n",
                zone->start_addr, zone->end_addr);
         printk("  total pages: %lu (%lu MB)\n", zone->total_pages, total_mb);
-        printk("  free pages:  %lu (%lu MB)\n", zone->free_pages, free_mb);
+        printk("  free pages:  %lu (%lu MB, %lu on per-CPU lists)\n",
+               free_pages, free_mb, free_pages - zone->free_pages);
         printk("  used pages:  %lu\n", used_pages);
         printk("  watermarks:  min=%lu low=%lu high=%lu\n",
                zone->watermark_min, zone->watermark_low, zone->watermark_high);
         printk("  stats:       allocs=%lu frees=%lu failed=%lu\n",
-               zone->stats.alloc_count, zone->stats.free_count, 
-               zone->stats.alloc_failed);
+               stats.alloc_count, stats.free_count, stats.alloc_failed);
+        printk("  per-CPU:     hits=%lu misses=%lu (%lu%% hit) drains=%lu\n",
+               stats.pcp_hits, stats.pcp_misses,
+               lookups ? stats.pcp_hits * 100 / lookups : 0, stats.pcp_drains);
+        printk("  pre-zeroed:  hits=%lu filled=%lu\n",
+               stats.zero_hits, stats.zero_filled);
+        printk("  free blocks:");
+        for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+            printk(" %lu", zone->free_area[order].count);
+        }
+        printk("\n");
     }
     
 }
@@ -284,14 +901,7 @@ uint64_t pmm_alloc_page_flags(uint32_t flags) {
         addr = pmm_alloc_page();
     }
     
-    if (addr == 0) {
-        return 0;
-    }
-    
-    if (flags & PMM_ALLOC_ZERO) {
-        memset(PHYS_TO_VIRT(addr), 0, PAGE_SIZE);
-    }
-    
+    /* Single pages are always zeroed, so PMM_ALLOC_ZERO needs nothing more */
     return addr;
 }
 
@@ -308,81 +918,151 @@ uint64_t pmm_alloc_pages(size_t count, int zone_idx) {
         return 0;
     }
     
-    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    unsigned int order = 0;
+    while ((1ULL << order) < count) {
+        order++;
+    }
     
     pmm_zone_t *zone = &zones[zone_idx];
     
-    if (zone->free_pages < count) {
+    if (order > PMM_MAX_ORDER) {
+        printk("pmm: warning: %lu pages is more than one block in zone %s\n",
+               count, zone->name);
+        return 0;
+    }
+    
+    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    
+    uint64_t start_addr = pmm_alloc_block(zone, order);
+    if (start_addr == 0) {
+        /* Pages cached on any CPU may complete a block */
+        spinlock_irq_release(&pmm_locks[zone_idx]);
+        pmm_drain_pcp(zone_idx);
+        spinlock_irq_acquire(&pmm_locks[zone_idx]);
+        start_addr = pmm_alloc_block(zone, order);
+    }
+    
+    if (start_addr == 0) {
         zone->stats.alloc_failed++;
         spinlock_irq_release(&pmm_locks[zone_idx]);
+        
+        printk("pmm: warning: could not find %lu contiguous pages in zone %s\n",
+               count, zone->name);
         return 0;
     }
     
-    page_frame_t *prev = NULL;
-    page_frame_t *current = zone->free_stack;
+    zone->stats.alloc_count += count;
+    
+    spinlock_irq_release(&pmm_locks[zone_idx]);
+    
+    /* Only what was asked for is kept, the rest of the block goes straight back */
+    uint64_t block = 1ULL << order;
+    if (block > count) {
+        pmm_free_range(start_addr + count * PAGE_SIZE, block - count, false);
+    }
+    
+    pmm_set_allocated(start_addr, count);
+    clear_pages(PHYS_TO_VIRT(start_addr), count);
+    
+    return start_addr;
+}
+
+void pmm_free_pages(uint64_t phys_addr, size_t count) {
+    if (phys_addr == 0 || count == 0) {
+        return;
+    }
+    
+    if (!IS_PAGE_ALIGNED(phys_addr) ||
+        (phys_addr >> PAGE_SHIFT) + count > pmm_max_pfn) {
+        ewarn("pmm: attempted to free bad range 0x%016lx (%lu pages)", phys_addr, count);
+        return;
+    }
+    
+    /* Drop a reference on each page, and give back the runs that hit zero */
+    uint64_t run_start = 0;
+    uint64_t run_pages = 0;
+    uint64_t freed = 0;
     
-    while (current != NULL) {
-        uint64_t start_addr = VIRT_TO_PHYS((uint64_t)current);
-        bool is_contiguous = true;
+    for (size_t i = 0; i <= count; i++) {
+        uint64_t addr = phys_addr + i * PAGE_SIZE;
+        bool last = false;
         
-        page_frame_t *check = current;
-        for (size_t i = 0; i < count && check != NULL; i++) {
-            uint64_t expected_addr = start_addr + (i * PAGE_SIZE);
-            uint64_t actual_addr = VIRT_TO_PHYS((uint64_t)check);
-            
-            if (actual_addr != expected_addr) {
-                is_contiguous = false;
-                break;
+        if (i < count) {
+            page_t *page = &pmm_pages[addr >> PAGE_SHIFT];
+            if (page->flags & PAGE_FLAG_RESERVED) {
+                ewarn("pmm: attempted to free unmanaged address 0x%016lx", addr);
+            } else {
+                last = pmm_put_page(page, addr);
             }
-            
-            check = check->next;
         }
         
-        if (is_contiguous) {
-            /* found contiguous pages! Remove them from free list */
-            page_frame_t *to_remove = current;
-            for (size_t i = 0; i < count; i++) {
-                page_frame_t *next = to_remove->next;
-                
-                if (prev == NULL) {
-                    zone->free_stack = next;
-                } else {
-                    prev->next = next;
-                }
-                
-                zone->free_pages--;
-                to_remove = next;
+        if (last) {
+            if (run_pages == 0) {
+                run_start = addr;
             }
-            
-            zone->stats.alloc_count += count;
-            
-            spinlock_irq_release(&pmm_locks[zone_idx]);
-            
-            for (size_t i = 0; i < count; i++) {
-                memset(PHYS_TO_VIRT(start_addr + (i * PAGE_SIZE)), 0, PAGE_SIZE);
-            }
-            
-            return start_addr;
+            run_pages++;
+        } else if (run_pages > 0) {
+            pmm_free_range(run_start, run_pages, false);
+            freed += run_pages;
+            run_pages = 0;
         }
-        
-        prev = current;
-        current = current->next;
     }
     
-    zone->stats.alloc_failed++;
+    if (freed == 0) {
+        return;
+    }
+    
+    int zone_idx = pmm_addr_to_zone(phys_addr);
+    spinlock_irq_acquire(&pmm_locks[zone_idx]);
+    zones[zone_idx].stats.free_count += freed;
     spinlock_irq_release(&pmm_locks[zone_idx]);
+}
+
+page_t *pmm_phys_to_page(uint64_t phys_addr) {
+    uint64_t pfn = phys_addr >> PAGE_SHIFT;
     
-    printk("pmm: warning: could not find %lu contiguous pages in zone %s\n",
-           count, zone->name);
-    return 0;
+    if (pmm_pages == NULL || pfn >= pmm_max_pfn ||
+        (pmm_pages[pfn].flags & PAGE_FLAG_RESERVED)) {
+        return NULL;
+    }
+    return &pmm_pages[pfn];
 }
 
-void pmm_free_pages(uint64_t phys_addr, size_t count) {
-    for (size_t i = 0; i < count; i++) {
-        pmm_free_page(phys_addr + (i * PAGE_SIZE));
+uint64_t pmm_page_to_phys(const page_t *page) {
+    return (uint64_t)(page - pmm_pages) << PAGE_SHIFT;
+}
+
+void pmm_get_page(uint64_t phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+    if (page != NULL) {
+        __atomic_add_fetch(&page->refcount, 1, __ATOMIC_RELAXED);
     }
 }
 
+uint32_t pmm_page_refcount(uint64_t phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+    return (page != NULL) ? __atomic_load_n(&page->refcount, __ATOMIC_ACQUIRE) : 0;
+}
+
+void pmm_page_add_map(uint64_t phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+    if (page != NULL) {
+        __atomic_add_fetch(&page->mapcount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void pmm_page_remove_map(uint64_t phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+    if (page != NULL && __atomic_load_n(&page->mapcount, __ATOMIC_RELAXED) > 0) {
+        __atomic_sub_fetch(&page->mapcount, 1, __ATOMIC_RELAXED);
+    }
+}
+
+uint32_t pmm_page_mapcount(uint64_t phys_addr) {
+    page_t *page = pmm_phys_to_page(phys_addr);
+    return (page != NULL) ? __atomic_load_n(&page->mapcount, __ATOMIC_RELAXED) : 0;
+}
+
 void pmm_get_watermarks(int zone, pmm_watermarks_t *wm) {
     if (zone < 0 || zone >= PMM_ZONE_COUNT || wm == NULL) {
         return;
@@ -398,7 +1078,7 @@ bool pmm_is_low_memory(int zone) {
         return true;  /* Treat invalid zone as low memory */
     }
     
-    return zones[zone].free_pages < zones[zone].watermark_low;
+    return pmm_zone_free_pages(zone) < zones[zone].watermark_low;
 }
 
 void pmm_get_stats(int zone, pmm_zone_stats_t *stats) {
@@ -409,6 +1089,18 @@ void pmm_get_stats(int zone, pmm_zone_stats_t *stats) {
     spinlock_irq_acquire(&pmm_locks[zone]);
     *stats = zones[zone].stats;
     spinlock_irq_release(&pmm_locks[zone]);
+    
+    /* Per-CPU counters are read unlocked; close enough for statistics */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        pmm_pcp_t *pcp = &pmm_pcps[i][zone];
+        stats->alloc_count += pcp->allocs;
+        stats->free_count += pcp->frees;
+        stats->pcp_hits += pcp->hits;
+        stats->pcp_misses += pcp->misses;
+        stats->pcp_drains += pcp->drains;
+        stats->zero_hits += pcp->zero_hits;
+        stats->zero_filled += pcp->zero_filled;
+    }
 }
 
 void pmm_reserve_region(uint64_t base, uint64_t length) {
@@ -435,7 +1127,7 @@ uint64_t pmm_get_total_pages(void) {
 uint64_t pmm_get_free_pages(void) {
     uint64_t total = 0;
     for (int i = 0; i < PMM_ZONE_COUNT; i++) {
-        total += zones[i].free_pages;
+        total += pmm_zone_free_pages(i);
     }
     return total;
 }
@@ -448,7 +1140,7 @@ uint64_t pmm_get_zone_free_pages(int zone) {
     if (zone < 0 || zone >= PMM_ZONE_COUNT) {
         return 0;
     }
-    return zones[zone].free_pages;
+    return pmm_zone_free_pages(zone);
 }
 
 uint64_t pmm_get_zone_total_pages(int zone) {
@@ -18,7 +18,7 @@
 
 static vm_space_t kernel_space;
 static int vmm_initialized = 0;
-static spinlock_irq_t vmm_lock = SPINLOCK_IRQ_INIT;
+static spinlock_irq_t vmm_lock = SPINLOCK_IRQ_INIT_NAMED("vmm_lock");
 
 static struct {
     uint64_t lazy_allocations;      /* Pages allocated on page fault */
@@ -237,6 +237,7 @@ void vmm_destroy_space(vm_space_t *space) {
                 if (mmu_is_mapped((mmu_context_t *)space->mmu_ctx, virt)) {
                     uint64_t phys = mmu_virt_to_phys((mmu_context_t *)space->mmu_ctx, virt);
                     if (phys != 0) {
+                        pmm_page_remove_map(phys);
                         pmm_free_page(phys);
                     }
                     mmu_unmap_page((mmu_context_t *)space->mmu_ctx, virt);
@@ -350,10 +351,7 @@ static int vmm_map_region_internal(vm_space_t *space, uint64_t virt_addr, size_t
                     return -1;
                 }
 
-                /* Zero the page if requested (default) */
-                if (alloc_flags & VMM_ALLOC_ZERO || !(alloc_flags & ~VMM_ALLOC_ZERO)) {
-                    memset(PHYS_TO_VIRT(phys), 0, PAGE_SIZE);
-                }
+                /* pmm_alloc_page() hands out zeroed pages, VMM_ALLOC_ZERO holds already */
 
                 if (mmu_map_page((mmu_context_t *)space->mmu_ctx, virt, phys, mmu_flags) != 0) {
                     pmm_free_page(phys);
@@ -368,6 +366,7 @@ static int vmm_map_region_internal(vm_space_t *space, uint64_t virt_addr, size_t
                     pmm_free_page(area_phys);
                     return -1;
                 }
+                pmm_page_add_map(phys);
             }
             space->mapped_size += aligned_size;
             vmm_stats.eager_allocations += aligned_size / PAGE_SIZE;
@@ -413,6 +412,7 @@ static int vmm_unmap_region_internal(vm_space_t *space, uint64_t virt_addr, size
                         if (mmu_is_mapped((mmu_context_t *)space->mmu_ctx, virt)) {
                             uint64_t phys = mmu_virt_to_phys((mmu_context_t *)space->mmu_ctx, virt);
                             if (phys != 0) {
+                                pmm_page_remove_map(phys);
                                 pmm_free_page(phys);
                             }
                         }
@@ -520,7 +520,7 @@ int vmm_handle_page_fault(vm_space_t *space, uint64_t virt_addr,
     if (is_present && is_write && already_mapped) {
         /* Check if this is a COW page */
         if (mmu_is_cow_page((mmu_context_t *)space->mmu_ctx, page_addr)) {
-            /* Break COW - this allocates a new page and copies data */
+            /* Break COW - copies the page unless nobody else holds it */
             if (mmu_break_cow((mmu_context_t *)space->mmu_ctx, page_addr) != 0) {
                 printk("vmm: failed to break COW at 0x%016lx\n", page_addr);
                 spinlock_irq_release(&vmm_lock);
@@ -551,8 +551,7 @@ int vmm_handle_page_fault(vm_space_t *space, uint64_t virt_addr,
             return -1;
         }
 
-        memset(PHYS_TO_VIRT(phys), 0, PAGE_SIZE);
-
+        /* Already zeroed, usually in the background by kzerod */
         uint64_t mmu_flags = vmm_flags_to_mmu(area->flags);
 
         if (mmu_map_page((mmu_context_t *)space->mmu_ctx, page_addr, phys, mmu_flags) != 0) {
@@ -560,6 +559,7 @@ int vmm_handle_page_fault(vm_space_t *space, uint64_t virt_addr,
             spinlock_irq_release(&vmm_lock);
             return -1;
         }
+        pmm_page_add_map(phys);
 
         space->mapped_size += PAGE_SIZE;
         vmm_stats.lazy_allocations++;
@@ -768,7 +768,7 @@ vm_space_t *vmm_fork_space(vm_space_t *parent) {
         vmm_insert_area(child, child_area);
 
         if (parent_area->type == VMM_TYPE_ANON) {
-            /* Copy the page tables with COW flag using MMU layer */
+            /* Share the frames COW; each copied PTE takes a page reference */
             if (mmu_copy_range((mmu_context_t *)child->mmu_ctx,
                               (mmu_context_t *)parent->mmu_ctx,
                               parent_area->virt_start,
@@ -13,7 +13,7 @@
 
 static int column_position = 0;
 
-static spinlock_irq_t printk_lock = SPINLOCK_IRQ_INIT;
+static spinlock_irq_t printk_lock = SPINLOCK_IRQ_INIT_NAMED("printk_lock");
 
 extern struct flanterm_context *g_ft_ctx;
 
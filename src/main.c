@@ -1,6 +1,8 @@
 #include <arch/x86_64/syscall.h>
 #include <arch/x86_64/serial.h>
 #include <arch/x86_64/cpuid.h>
+#include <arch/x86_64/fpu.h>
+#include <arch/x86_64/pageops.h>
 #include <arch/x86_64/ioapic.h>
 #include <arch/x86_64/apic.h>
 #include <arch/x86_64/smp.h>
@@ -19,6 +21,9 @@
 
 #include <core/scheduler.h>
 #include <core/proc.h>
+#include <core/workqueue.h>
+#include <core/rcu.h>
+#include <core/mutex.h>
 
 #include <blk/bcache.h>
 #include <blk/blk.h>
@@ -78,8 +83,6 @@ static volatile uint64_t limine_requests_end_marker[] =
 
 struct flanterm_context *g_ft_ctx = NULL;
 
-void fpu_enable(void);
-
 extern const uint8_t _binary_bin_hello_start[];
 extern const uint8_t _binary_bin_hello_end[];
 
@@ -125,6 +128,7 @@ void kmain(void) {
 
     ebegin("Starting GDT");
     gdt_init();
+    smp_early_init();
     eend(0, NULL);
 
     ebegin("Starting IDT");
@@ -158,10 +162,12 @@ void kmain(void) {
     pic_disable();
     ioapic_init();
 
+    fpu_init();
     smp_init();
 
     rtc_init();
     tsc_init();
+    pageops_init();
 
     ebegin("Scanning PCI bus");
     pci_init();
@@ -187,9 +193,11 @@ void kmain(void) {
     proc_init();
     syscall_init();
 
-    uint64_t apic_freq     = apic_timer_get_frequency();
-    uint32_t initial_count = (apic_freq / 16) / 100;
-    apic_timer_init(IRQ0, LAPIC_TIMER_DIV_16, initial_count, true);
+    scheduler_timer_start();
+
+    workqueue_init();
+    rcu_init();
+    pmm_zero_init();
 
     ebegin("Starting virtual filesystem");
     vfs_init();
@@ -215,11 +223,14 @@ void kmain(void) {
     rtl8139_init();
     eth_init();
 
+#ifdef MUTEX_BENCHMARK
+    mutex_benchmark();
+#endif
+
     __asm__ volatile("sti");
 
     for (;;) {
         yield();
-        kb_poll();
         __asm__ volatile("hlt");
     }
 }